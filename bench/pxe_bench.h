@@ -0,0 +1,44 @@
+#ifndef PIXIE_BENCH_H_
+#define PIXIE_BENCH_H_
+
+#include "pixie.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <time.h>
+
+// Helpers for the programs in bench/, which are built against the server's
+// objects with `make bench` and run by hand. Each one prints its results and
+// exits with 1 if one of its checks fails. Every program includes this once,
+// which also gives it the sprintf_s that pxe_main.c defines for the server.
+
+#ifndef _MSC_VER
+int sprintf_s(char* str, size_t str_size, const char* format, ...) {
+  va_list args;
+
+  va_start(args, format);
+
+  int result = vsprintf(str, format, args);
+
+  va_end(args);
+
+  return result;
+}
+#endif
+
+static inline u64 pxe_bench_now_ns(void) {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return (u64)now.tv_sec * 1000000000ULL + (u64)now.tv_nsec;
+}
+
+// Keeps the compiler from dropping work whose result is otherwise unused.
+static inline void pxe_bench_consume(u64 value) {
+  static volatile u64 sink;
+
+  sink += value;
+}
+
+#endif
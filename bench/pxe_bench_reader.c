@@ -0,0 +1,194 @@
+#include "pxe_bench.h"
+#include "pxe_buffer.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Decodes a chunk-sized payload split over 64-byte buffers, like a chunk data
+// packet received in small reads. The reader continues from the buffer it last
+// read, and the reference resets it before every field so each read walks the
+// chain from its head, which is how every read found its buffer before the
+// reader kept its place.
+//
+//   bench/pxe_bench_reader [decodes]
+
+#define PXE_BENCH_BUFFER_SIZE 64
+#define PXE_BENCH_SECTIONS 8
+#define PXE_BENCH_PALETTE_SIZE 16
+#define PXE_BENCH_SECTION_LONGS 256
+
+typedef struct pxe_bench_payload {
+  u8* data;
+  size_t size;
+  pxe_buffer* buffers;
+  pxe_buffer_chain* chains;
+  // What a decode adds up the payload's fields to.
+  u64 checksum;
+} pxe_bench_payload;
+
+static size_t pxe_bench_put_be(u8* out, u64 value, size_t size) {
+  for (size_t i = 0; i < size; ++i) {
+    out[i] = (u8)(value >> ((size - i - 1) * 8));
+  }
+
+  return size;
+}
+
+// Lays the payload out like the sections of a chunk: block count, bits per
+// block, a palette of VarInts and the data array's longs.
+static void pxe_bench_create_payload(pxe_bench_payload* payload) {
+  size_t max_size = PXE_BENCH_SECTIONS *
+                    (3 + 5 * (PXE_BENCH_PALETTE_SIZE + 2) +
+                     PXE_BENCH_SECTION_LONGS * sizeof(u64));
+  u8* data = malloc(max_size);
+  size_t size = 0;
+  u64 checksum = 0;
+  u64 state = 0x9E3779B97F4A7C15ULL;
+
+  for (u32 section = 0; section < PXE_BENCH_SECTIONS; ++section) {
+    size += pxe_bench_put_be(data + size, 4096, 2);
+    size += pxe_bench_put_be(data + size, 4, 1);
+    size += pxe_varint_write(PXE_BENCH_PALETTE_SIZE, (char*)data + size);
+    checksum += 4096 + 4 + PXE_BENCH_PALETTE_SIZE;
+
+    // Block states range from one to three VarInt bytes.
+    for (u32 i = 0; i < PXE_BENCH_PALETTE_SIZE; ++i) {
+      i32 state_id = (i32)(i * 1733 + section * 97) % 20000;
+
+      size += pxe_varint_write(state_id, (char*)data + size);
+      checksum += (u64)state_id;
+    }
+
+    size += pxe_varint_write(PXE_BENCH_SECTION_LONGS, (char*)data + size);
+    checksum += PXE_BENCH_SECTION_LONGS;
+
+    for (u32 i = 0; i < PXE_BENCH_SECTION_LONGS; ++i) {
+      state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+      size += pxe_bench_put_be(data + size, state, sizeof(u64));
+      checksum += state;
+    }
+  }
+
+  size_t count = (size + PXE_BENCH_BUFFER_SIZE - 1) / PXE_BENCH_BUFFER_SIZE;
+
+  payload->data = data;
+  payload->size = size;
+  payload->buffers = calloc(count, sizeof(pxe_buffer));
+  payload->chains = calloc(count, sizeof(pxe_buffer_chain));
+  payload->checksum = checksum;
+
+  for (size_t i = 0; i < count; ++i) {
+    size_t offset = i * PXE_BENCH_BUFFER_SIZE;
+    size_t buffer_size = size - offset < PXE_BENCH_BUFFER_SIZE
+                             ? size - offset
+                             : PXE_BENCH_BUFFER_SIZE;
+
+    payload->buffers[i].data = data + offset;
+    payload->buffers[i].size = buffer_size;
+    payload->buffers[i].max_size = buffer_size;
+    payload->chains[i].buffer = payload->buffers + i;
+    payload->chains[i].next = i + 1 < count ? payload->chains + i + 1 : NULL;
+  }
+}
+
+// Resetting to the same read_pos drops the reader's place in the chain.
+#define PXE_BENCH_FORGET(reader, walk)                            \
+  do {                                                            \
+    if (walk) {                                                   \
+      pxe_buffer_reader_reset(reader, (reader)->chain,            \
+                              (reader)->read_pos);                \
+    }                                                             \
+  } while (0)
+
+// Returns the sum of the payload's fields, or 0 if any of them failed to read.
+static u64 pxe_bench_decode(pxe_buffer_chain* chain, bool32 walk) {
+  pxe_buffer_reader reader;
+  u64 checksum = 0;
+
+  pxe_buffer_reader_reset(&reader, chain, 0);
+
+  for (u32 section = 0; section < PXE_BENCH_SECTIONS; ++section) {
+    u16 block_count;
+    u8 bits_per_block;
+    i32 palette_size;
+    i32 long_count;
+
+    PXE_BENCH_FORGET(&reader, walk);
+    if (!pxe_buffer_read_u16(&reader, &block_count)) return 0;
+    PXE_BENCH_FORGET(&reader, walk);
+    if (!pxe_buffer_read_u8(&reader, &bits_per_block)) return 0;
+    PXE_BENCH_FORGET(&reader, walk);
+    if (!pxe_buffer_read_varint(&reader, &palette_size)) return 0;
+
+    checksum += block_count + bits_per_block + (u64)palette_size;
+
+    for (i32 i = 0; i < palette_size; ++i) {
+      i32 state_id;
+
+      PXE_BENCH_FORGET(&reader, walk);
+      if (!pxe_buffer_read_varint(&reader, &state_id)) return 0;
+
+      checksum += (u64)state_id;
+    }
+
+    PXE_BENCH_FORGET(&reader, walk);
+    if (!pxe_buffer_read_varint(&reader, &long_count)) return 0;
+
+    checksum += (u64)long_count;
+
+    for (i32 i = 0; i < long_count; ++i) {
+      u64 value;
+
+      PXE_BENCH_FORGET(&reader, walk);
+      if (!pxe_buffer_read_u64(&reader, &value)) return 0;
+
+      checksum += value;
+    }
+  }
+
+  return checksum;
+}
+
+// Returns the average nanoseconds per decode, or 0 if a decode came out wrong.
+static u64 pxe_bench_run(pxe_bench_payload* payload, u32 decodes,
+                         bool32 walk) {
+  u64 start = pxe_bench_now_ns();
+
+  for (u32 i = 0; i < decodes; ++i) {
+    u64 checksum = pxe_bench_decode(payload->chains, walk);
+
+    if (checksum != payload->checksum) return 0;
+
+    pxe_bench_consume(checksum);
+  }
+
+  return (pxe_bench_now_ns() - start) / decodes;
+}
+
+int main(int argc, char* argv[]) {
+  u32 decodes = argc > 1 ? (u32)atoi(argv[1]) : 2000;
+  pxe_bench_payload payload;
+
+  if (decodes == 0) decodes = 1;
+
+  pxe_bench_create_payload(&payload);
+
+  u64 cached = pxe_bench_run(&payload, decodes, 0);
+  // Walking from the head is much slower, so it gets fewer decodes.
+  u64 walked = pxe_bench_run(&payload, decodes / 20 + 1, 1);
+
+  if (cached == 0 || walked == 0) {
+    fprintf(stderr, "A decode didn't match the payload.\n");
+    return 1;
+  }
+
+  printf("%zu bytes in %d-byte buffers\n", payload.size, PXE_BENCH_BUFFER_SIZE);
+  printf("%-22s %10.1f us\n", "cached position:", cached / 1000.0);
+  printf("%-22s %10.1f us\n", "walk from the head:", walked / 1000.0);
+
+  free(payload.chains);
+  free(payload.buffers);
+  free(payload.data);
+
+  return 0;
+}
@@ -0,0 +1,166 @@
+#include "pxe_bench.h"
+#include "pxe_buffer.h"
+#include "pxe_ring.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Decodes a burst of player position packets from a receive ring, where they
+// wrap around the end of the ring, and from the same bytes in 64-byte chain
+// buffers like the pool's smallest reads. The ring is read through a chain of
+// one buffer the way sessions with PXE_SESSION_RECEIVE_RING read it.
+//
+//   bench/pxe_bench_ring [decodes]
+
+#define PXE_BENCH_RING_SIZE pxe_kilobytes(64)
+#define PXE_BENCH_BUFFER_SIZE 64
+#define PXE_BENCH_PACKETS 2000
+// Where the packets start in the ring, so they run past its end.
+#define PXE_BENCH_RING_OFFSET pxe_kilobytes(40)
+#define PXE_BENCH_PLAYER_POSITION_ID 0x12
+
+// Frames a Player Position packet and returns its size.
+static size_t pxe_bench_write_position(u8* out, u32 index) {
+  u8 body[32];
+  size_t size = pxe_varint_write(PXE_BENCH_PLAYER_POSITION_ID, (char*)body);
+  double position[3] = {index * 0.25, 64.0, index * -0.5};
+
+  for (size_t i = 0; i < pxe_array_size(position); ++i) {
+    u64 bits;
+
+    memcpy(&bits, position + i, sizeof(bits));
+
+    for (size_t j = 0; j < sizeof(bits); ++j) {
+      body[size++] = (u8)(bits >> ((sizeof(bits) - j - 1) * 8));
+    }
+  }
+
+  body[size++] = index & 1;
+
+  size_t header_size = pxe_varint_write((i32)size, (char*)out);
+
+  memcpy(out + header_size, body, size);
+
+  return header_size + size;
+}
+
+// Adds up the packets' fields in sum. Returns 0 if any of them failed to read.
+static bool32 pxe_bench_decode(pxe_buffer_chain* chain, double* sum) {
+  pxe_buffer_reader reader;
+
+  *sum = 0;
+
+  pxe_buffer_reader_reset(&reader, chain, 0);
+
+  for (u32 i = 0; i < PXE_BENCH_PACKETS; ++i) {
+    i32 length;
+    i32 id;
+    double x, y, z;
+    u8 on_ground;
+
+    if (!pxe_buffer_read_varint(&reader, &length) ||
+        !pxe_buffer_read_varint(&reader, &id) ||
+        !pxe_buffer_read_double(&reader, &x) ||
+        !pxe_buffer_read_double(&reader, &y) ||
+        !pxe_buffer_read_double(&reader, &z) ||
+        !pxe_buffer_read_u8(&reader, &on_ground)) {
+      return 0;
+    }
+
+    *sum += length + id + x + y + z + on_ground;
+  }
+
+  return 1;
+}
+
+// Returns the average nanoseconds per decode, or 0 if a decode came out
+// different from expected.
+static u64 pxe_bench_run(pxe_buffer_chain* chain, u32 decodes,
+                         double expected) {
+  u64 start = pxe_bench_now_ns();
+
+  for (u32 i = 0; i < decodes; ++i) {
+    double sum;
+
+    if (!pxe_bench_decode(chain, &sum) || sum != expected) return 0;
+
+    pxe_bench_consume((u64)sum);
+  }
+
+  return (pxe_bench_now_ns() - start) / decodes;
+}
+
+int main(int argc, char* argv[]) {
+  u32 decodes = argc > 1 ? (u32)atoi(argv[1]) : 5000;
+  pxe_ring ring;
+
+  if (decodes == 0) decodes = 1;
+
+  if (!pxe_ring_create(&ring, PXE_BENCH_RING_SIZE)) {
+    fprintf(stderr, "Failed to create the receive ring.\n");
+    return 1;
+  }
+
+  // One byte is left behind so the ring doesn't reset to its start when the
+  // filler is consumed.
+  pxe_ring_produce(&ring, PXE_BENCH_RING_OFFSET);
+  pxe_ring_consume(&ring, PXE_BENCH_RING_OFFSET - 1);
+
+  size_t size = 0;
+  u8* data = pxe_ring_write_ptr(&ring);
+
+  for (u32 i = 0; i < PXE_BENCH_PACKETS; ++i) {
+    size += pxe_bench_write_position(data + size, i);
+  }
+
+  pxe_ring_produce(&ring, size);
+  pxe_ring_consume(&ring, 1);
+
+  pxe_buffer ring_buffer = {pxe_ring_read_ptr(&ring), pxe_ring_used(&ring),
+                            pxe_ring_used(&ring), 0, NULL, NULL};
+  pxe_buffer_chain ring_chain = {&ring_buffer, NULL};
+
+  // The same bytes split into a chain of small buffers.
+  size_t count = (size + PXE_BENCH_BUFFER_SIZE - 1) / PXE_BENCH_BUFFER_SIZE;
+  u8* chain_data = malloc(size);
+  pxe_buffer* buffers = calloc(count, sizeof(pxe_buffer));
+  pxe_buffer_chain* chains = calloc(count, sizeof(pxe_buffer_chain));
+
+  memcpy(chain_data, pxe_ring_read_ptr(&ring), size);
+
+  for (size_t i = 0; i < count; ++i) {
+    size_t offset = i * PXE_BENCH_BUFFER_SIZE;
+    size_t buffer_size = size - offset < PXE_BENCH_BUFFER_SIZE
+                             ? size - offset
+                             : PXE_BENCH_BUFFER_SIZE;
+
+    buffers[i].data = chain_data + offset;
+    buffers[i].size = buffer_size;
+    buffers[i].max_size = buffer_size;
+    chains[i].buffer = buffers + i;
+    chains[i].next = i + 1 < count ? chains + i + 1 : NULL;
+  }
+
+  double expected;
+  bool32 decoded = pxe_bench_decode(chains, &expected);
+  bool32 wrapped = (ring.head & (ring.size - 1)) + size > ring.size;
+  u64 ring_time = pxe_bench_run(&ring_chain, decodes, expected);
+  u64 chain_time = pxe_bench_run(chains, decodes, expected);
+  int result = 0;
+
+  if (!decoded || !wrapped || ring_time == 0 || chain_time == 0) {
+    fprintf(stderr, "The ring and the chain didn't decode the same packets.\n");
+    result = 1;
+  } else {
+    printf("%u packets, %zu bytes\n", PXE_BENCH_PACKETS, size);
+    printf("%-22s %10.1f us\n", "ring:", ring_time / 1000.0);
+    printf("%-22s %10.1f us\n", "64-byte chain:", chain_time / 1000.0);
+  }
+
+  free(chains);
+  free(buffers);
+  free(chain_data);
+  pxe_ring_destroy(&ring);
+
+  return result;
+}
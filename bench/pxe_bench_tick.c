@@ -0,0 +1,185 @@
+#include "pxe_bench.h"
+#include "pxe_session.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Times the per-session scan that the tick and the broadcasts make over every
+// connected player, with the hot records in their own array the way the
+// session pages keep them, against the same records interleaved with the rest
+// of each session. Slots are visited in shuffled order like live_sessions
+// after players come and go, and the cache is flushed before every scan since
+// a tick rarely finds the sessions still cached from the one before.
+//
+//   bench/pxe_bench_tick [scans per size]
+
+// Larger than the last level cache of the machines this runs on.
+#define PXE_BENCH_FLUSH_SIZE pxe_megabytes(64)
+
+typedef struct pxe_bench_interleaved {
+  pxe_session session;
+  pxe_session_hot hot;
+} pxe_bench_interleaved;
+
+static u8* pxe_bench_flush_memory;
+
+static void pxe_bench_flush_cache(void) {
+  u64 sum = 0;
+
+  for (size_t i = 0; i < PXE_BENCH_FLUSH_SIZE; i += 64) {
+    pxe_bench_flush_memory[i] += 1;
+    sum += pxe_bench_flush_memory[i];
+  }
+
+  pxe_bench_consume(sum);
+}
+
+// The checks the tick and broadcast loops make before they touch the rest of
+// a session. Returns the number of players that would be sent an update.
+static inline u32 pxe_bench_scan_hot(pxe_session_hot* hot, float dt) {
+  if (hot->protocol_state != PXE_PROTOCOL_STATE_PLAY) return 0;
+
+  u32 updates = 0;
+
+  if (hot->health > 0 && hot->health < 20.0f) {
+    i32 prev_discrete_health = (i32)hot->health;
+
+    hot->health += hot->health_regen * dt;
+
+    if (hot->health > 20.0f) {
+      hot->health = 20.0f;
+    }
+
+    updates += (i32)hot->health > prev_discrete_health;
+  }
+
+  if (hot->x != hot->previous_x || hot->y != hot->previous_y ||
+      hot->z != hot->previous_z) {
+    hot->previous_x = hot->x;
+    hot->previous_y = hot->y;
+    hot->previous_z = hot->z;
+    ++updates;
+  }
+
+  return updates + (hot->chunks_remaining > 0);
+}
+
+static void pxe_bench_fill(pxe_session_hot* hot, u32 slot) {
+  memset(hot, 0, sizeof(*hot));
+
+  // Most sessions are playing and some are still logging in.
+  hot->protocol_state =
+      slot % 10 == 0 ? PXE_PROTOCOL_STATE_LOGIN : PXE_PROTOCOL_STATE_PLAY;
+  hot->entity_id = (i32)slot;
+  hot->x = (double)(slot % 7);
+  hot->health = (float)(slot % 21);
+  hot->health_regen = 0.5f;
+  hot->chunks_remaining = slot % 16 == 0 ? 4 : 0;
+}
+
+static int pxe_bench_compare(const void* a, const void* b) {
+  u64 x = *(const u64*)a;
+  u64 y = *(const u64*)b;
+
+  return x < y ? -1 : x > y;
+}
+
+// Runs scans of count sessions with each layout and prints the median times.
+// Returns 0 if the two layouts didn't come up with the same updates.
+static bool32 pxe_bench_run(u32 count, u32 scans) {
+  pxe_session_hot* hot_array = calloc(count, sizeof(pxe_session_hot));
+  pxe_bench_interleaved* interleaved =
+      calloc(count, sizeof(pxe_bench_interleaved));
+  u32* live = malloc(count * sizeof(u32));
+  u64* hot_times = malloc(scans * sizeof(u64));
+  u64* interleaved_times = malloc(scans * sizeof(u64));
+  u64 hot_updates = 0;
+  u64 interleaved_updates = 0;
+  float dt = 50.0f / 1000.0f;
+
+  for (u32 i = 0; i < count; ++i) {
+    pxe_bench_fill(hot_array + i, i);
+    pxe_bench_fill(&interleaved[i].hot, i);
+    interleaved[i].session.hot = &interleaved[i].hot;
+    live[i] = i;
+  }
+
+  srand(count);
+
+  for (u32 i = count - 1; i > 0; --i) {
+    u32 j = (u32)rand() % (i + 1);
+    u32 slot = live[i];
+
+    live[i] = live[j];
+    live[j] = slot;
+  }
+
+  for (u32 scan = 0; scan < scans; ++scan) {
+    // Positions change between ticks, which dirties the records again.
+    for (u32 i = 0; i < count; i += 3) {
+      hot_array[i].x += 1.0;
+      interleaved[i].hot.x += 1.0;
+    }
+
+    pxe_bench_flush_cache();
+
+    u64 start = pxe_bench_now_ns();
+
+    for (u32 i = 0; i < count; ++i) {
+      hot_updates += pxe_bench_scan_hot(hot_array + live[i], dt);
+    }
+
+    hot_times[scan] = pxe_bench_now_ns() - start;
+
+    pxe_bench_flush_cache();
+
+    start = pxe_bench_now_ns();
+
+    for (u32 i = 0; i < count; ++i) {
+      interleaved_updates +=
+          pxe_bench_scan_hot(interleaved[live[i]].session.hot, dt);
+    }
+
+    interleaved_times[scan] = pxe_bench_now_ns() - start;
+  }
+
+  qsort(hot_times, scans, sizeof(u64), pxe_bench_compare);
+  qsort(interleaved_times, scans, sizeof(u64), pxe_bench_compare);
+
+  printf("%10u %12.1f %14.1f\n", count, hot_times[scans / 2] / 1000.0,
+         interleaved_times[scans / 2] / 1000.0);
+
+  free(interleaved_times);
+  free(hot_times);
+  free(live);
+  free(interleaved);
+  free(hot_array);
+
+  return hot_updates == interleaved_updates;
+}
+
+int main(int argc, char* argv[]) {
+  u32 scans = argc > 1 ? (u32)atoi(argv[1]) : 200;
+  u32 counts[] = {1024, 4096};
+
+  if (scans == 0) scans = 1;
+
+  pxe_bench_flush_memory = calloc(1, PXE_BENCH_FLUSH_SIZE);
+
+  printf("Median of %u scans with %zu-byte hot records and %zu-byte "
+         "interleaved sessions.\n",
+         scans, sizeof(pxe_session_hot), sizeof(pxe_bench_interleaved));
+  printf("%10s %12s %14s\n", "sessions", "hot us", "interleaved us");
+
+  for (size_t i = 0; i < pxe_array_size(counts); ++i) {
+    if (!pxe_bench_run(counts[i], scans)) {
+      fprintf(stderr, "The layouts disagreed on the updates for %u sessions.\n",
+              counts[i]);
+      return 1;
+    }
+  }
+
+  free(pxe_bench_flush_memory);
+
+  return 0;
+}
@@ -0,0 +1,231 @@
+#include "pxe_bench.h"
+#include "pxe_varint.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Checks that the word at a time VarInt and VarLong codecs agree with the byte
+// at a time ones on random values and random bytes, then times both on a mix
+// of sizes like a server's traffic: 60% one byte, 25% two, 10% three and 5%
+// five.
+//
+//   bench/pxe_bench_varint [fuzz rounds]
+
+#define PXE_BENCH_VALUES 100000
+// Room past the last value, so every read can take the word path.
+#define PXE_BENCH_PADDING 16
+
+static u64 pxe_bench_random_state = 0x853C49E6748FEA9BULL;
+
+static u64 pxe_bench_random(void) {
+  u64 x = pxe_bench_random_state;
+
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  pxe_bench_random_state = x;
+
+  return x;
+}
+
+// Values of every length, with the lengths themselves spread evenly.
+static u64 pxe_bench_random_value(void) {
+  u32 bits = (u32)(pxe_bench_random() % 65);
+
+  if (bits == 0) return 0;
+
+  return pxe_bench_random() >> (64 - bits);
+}
+
+// Random bytes that keep their continuation bit for a random number of bytes,
+// so truncated, exact and overlong encodings all come up.
+static void pxe_bench_random_bytes(u8* out, size_t size) {
+  size_t continued = (size_t)(pxe_bench_random() % (size + 1));
+
+  for (size_t i = 0; i < size; ++i) {
+    u8 byte = (u8)pxe_bench_random();
+
+    out[i] = i < continued ? byte | 0x80 : byte & 0x7F;
+  }
+}
+
+static u64 pxe_bench_mismatches;
+
+static void pxe_bench_check(bool32 equal, const char* what, u64 value) {
+  if (equal) return;
+
+  if (++pxe_bench_mismatches <= 10) {
+    fprintf(stderr, "%s differs from the scalar version for %llx.\n", what,
+            (unsigned long long)value);
+  }
+}
+
+static void pxe_bench_fuzz(u32 rounds) {
+  for (u32 round = 0; round < rounds; ++round) {
+    u64 value = pxe_bench_random_value();
+    char word[PXE_BENCH_PADDING] = {0};
+    char scalar[PXE_BENCH_PADDING] = {0};
+
+    size_t size = pxe_varint_write((i32)value, word);
+    size_t scalar_size = pxe_varint_write_scalar((i32)value, scalar);
+
+    pxe_bench_check(size == scalar_size && !memcmp(word, scalar, size) &&
+                        size == pxe_varint_size((i32)value),
+                    "VarInt write", value);
+
+    size = pxe_varlong_write((i64)value, word);
+    scalar_size = pxe_varlong_write_scalar((i64)value, scalar);
+
+    pxe_bench_check(size == scalar_size && !memcmp(word, scalar, size) &&
+                        size == pxe_varlong_size((i64)value),
+                    "VarLong write", value);
+
+    // Any bytes at all, read with room for the word path and without.
+    u8 bytes[PXE_BENCH_PADDING];
+    size_t buf_size = (size_t)(pxe_bench_random() % (sizeof(bytes) + 1));
+    u64 first_bytes;
+
+    pxe_bench_random_bytes(bytes, sizeof(bytes));
+    memcpy(&first_bytes, bytes, sizeof(first_bytes));
+
+    i32 int_value;
+    i32 scalar_int_value;
+
+    size = pxe_varint_read((char*)bytes, buf_size, &int_value);
+    scalar_size =
+        pxe_varint_read_scalar((char*)bytes, buf_size, &scalar_int_value);
+
+    pxe_bench_check(size == scalar_size && int_value == scalar_int_value,
+                    "VarInt read", first_bytes);
+
+    i64 long_value;
+    i64 scalar_long_value;
+
+    size = pxe_varlong_read((char*)bytes, buf_size, &long_value);
+    scalar_size =
+        pxe_varlong_read_scalar((char*)bytes, buf_size, &scalar_long_value);
+
+    pxe_bench_check(size == scalar_size && long_value == scalar_long_value,
+                    "VarLong read", first_bytes);
+  }
+}
+
+// Returns a value that takes one, two, three or five bytes in the mix above.
+static i32 pxe_bench_mixed_value(void) {
+  u32 roll = (u32)(pxe_bench_random() % 100);
+  u32 bits = (u32)pxe_bench_random();
+
+  if (roll < 60) return (i32)(bits & 0x7F);
+  if (roll < 85) return (i32)(0x80 + bits % (0x4000 - 0x80));
+  if (roll < 95) return (i32)(0x4000 + bits % (0x200000 - 0x4000));
+
+  return (i32)(bits | 0x80000000);
+}
+
+typedef size_t (*pxe_bench_write_fn)(i32 value, char* buf);
+typedef size_t (*pxe_bench_read_fn)(char* buf, size_t buf_size, i32* value);
+
+// Returns the nanoseconds it took to write all of the values.
+static u64 pxe_bench_time_write(pxe_bench_write_fn write, i32* values,
+                                char* out) {
+  u64 start = pxe_bench_now_ns();
+  size_t size = 0;
+
+  for (u32 i = 0; i < PXE_BENCH_VALUES; ++i) {
+    size += write(values[i], out + size);
+  }
+
+  u64 elapsed = pxe_bench_now_ns() - start;
+
+  pxe_bench_consume(size);
+
+  return elapsed;
+}
+
+// Returns the nanoseconds it took to read every value back, or 0 if one of
+// them came out wrong.
+static u64 pxe_bench_time_read(pxe_bench_read_fn read, i32* values, char* data,
+                               size_t size) {
+  u64 start = pxe_bench_now_ns();
+  size_t offset = 0;
+  u64 sum = 0;
+
+  for (u32 i = 0; i < PXE_BENCH_VALUES; ++i) {
+    i32 value;
+
+    offset += read(data + offset, size - offset, &value);
+    sum += (u32)value;
+  }
+
+  u64 elapsed = pxe_bench_now_ns() - start;
+  u64 expected = 0;
+
+  for (u32 i = 0; i < PXE_BENCH_VALUES; ++i) {
+    expected += (u32)values[i];
+  }
+
+  if (offset != size - PXE_BENCH_PADDING || sum != expected) return 0;
+
+  return elapsed;
+}
+
+int main(int argc, char* argv[]) {
+  u32 rounds = argc > 1 ? (u32)atoi(argv[1]) : 1000000;
+
+  pxe_bench_fuzz(rounds);
+
+  if (pxe_bench_mismatches > 0) {
+    fprintf(stderr, "%llu mismatches in %u rounds.\n",
+            (unsigned long long)pxe_bench_mismatches, rounds);
+    return 1;
+  }
+
+  printf("%u fuzz rounds matched the scalar versions.\n", rounds);
+
+  i32* values = malloc(PXE_BENCH_VALUES * sizeof(i32));
+  char* data = calloc(1, PXE_BENCH_VALUES * 5 + PXE_BENCH_PADDING);
+  char* scratch = calloc(1, PXE_BENCH_VALUES * 5 + PXE_BENCH_PADDING);
+  size_t size = 0;
+
+  for (u32 i = 0; i < PXE_BENCH_VALUES; ++i) {
+    values[i] = pxe_bench_mixed_value();
+    size += pxe_varint_write_scalar(values[i], data + size);
+  }
+
+  size += PXE_BENCH_PADDING;
+
+  // The fastest of several passes of each, since a pass is short.
+  u64 times[4] = {~0ULL, ~0ULL, ~0ULL, ~0ULL};
+
+  for (u32 pass = 0; pass < 20; ++pass) {
+    u64 result[4] = {
+        pxe_bench_time_write(pxe_varint_write, values, scratch),
+        pxe_bench_time_write(pxe_varint_write_scalar, values, scratch),
+        pxe_bench_time_read(pxe_varint_read, values, data, size),
+        pxe_bench_time_read(pxe_varint_read_scalar, values, data, size),
+    };
+
+    for (u32 i = 0; i < 4; ++i) {
+      if (result[i] == 0) {
+        fprintf(stderr, "Values didn't read back the same.\n");
+        return 1;
+      }
+
+      if (result[i] < times[i]) times[i] = result[i];
+    }
+  }
+
+  printf("%u mixed VarInts, %zu bytes, ns per value\n", PXE_BENCH_VALUES,
+         size - PXE_BENCH_PADDING);
+  printf("%-8s %10s %10s\n", "", "word", "scalar");
+  printf("%-8s %10.2f %10.2f\n", "write", (double)times[0] / PXE_BENCH_VALUES,
+         (double)times[1] / PXE_BENCH_VALUES);
+  printf("%-8s %10.2f %10.2f\n", "read", (double)times[2] / PXE_BENCH_VALUES,
+         (double)times[3] / PXE_BENCH_VALUES);
+
+  free(scratch);
+  free(data);
+  free(values);
+
+  return 0;
+}
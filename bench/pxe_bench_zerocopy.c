@@ -0,0 +1,231 @@
+#include "pxe_alloc.h"
+#include "pxe_bench.h"
+#include "pxe_buffer.h"
+#include "pxe_socket.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <poll.h>
+#include <pthread.h>
+
+// Compares copied sends against MSG_ZEROCOPY sends of the same frame over a
+// loopback connection, through the same socket functions the sessions use.
+// The server never enables zero-copy for loopback peers, so SO_ZEROCOPY is
+// set directly here. Loopback still copies inside the kernel, which shows up
+// in the copied column, so the numbers are a lower bound for a real NIC.
+//
+//   bench/pxe_bench_zerocopy [megabytes per run]
+
+#define PXE_BENCH_ARENA_SIZE pxe_kilobytes(64)
+// Zero-copy sends that can be waiting on completion before sending stops to
+// wait for them, like PXE_SESSION_ZEROCOPY_SENDS.
+#define PXE_BENCH_MAX_PENDING 8
+
+typedef struct pxe_bench_receiver {
+  u16 port;
+  size_t expected;
+  size_t received;
+} pxe_bench_receiver;
+
+static void* pxe_bench_receive(void* arg) {
+  pxe_bench_receiver* receiver = arg;
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in address = {0};
+
+  address.sin_family = AF_INET;
+  address.sin_port = htons(receiver->port);
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  if (connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0) {
+    close(fd);
+    return NULL;
+  }
+
+  size_t size = pxe_megabytes(1);
+  char* data = malloc(size);
+
+  while (receiver->received < receiver->expected) {
+    ssize_t result = recv(fd, data, size, 0);
+
+    if (result <= 0) break;
+
+    receiver->received += (size_t)result;
+  }
+
+  free(data);
+  close(fd);
+
+  return NULL;
+}
+
+// Reads every completion that's ready and returns how many sends they cover.
+static u32 pxe_bench_complete(pxe_socket* socket, u32* copied) {
+  u32 first;
+  u32 last;
+  bool32 was_copied;
+  u32 completed = 0;
+
+  while (pxe_socket_read_zerocopy(socket, &first, &last, &was_copied)) {
+    completed += last - first + 1;
+
+    if (was_copied) {
+      *copied += last - first + 1;
+    }
+  }
+
+  return completed;
+}
+
+// Sends total bytes as back to back frames of frame_size and returns the
+// throughput in MB/s, or a negative value if the connection failed.
+static double pxe_bench_run(size_t frame_size, size_t total, bool32 zerocopy,
+                            u32* zerocopy_sends, u32* copied) {
+  int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in address = {0};
+  socklen_t address_size = sizeof(address);
+
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  if (bind(listen_fd, (struct sockaddr*)&address, sizeof(address)) != 0 ||
+      listen(listen_fd, 1) != 0 ||
+      getsockname(listen_fd, (struct sockaddr*)&address, &address_size) != 0) {
+    close(listen_fd);
+    return -1.0;
+  }
+
+  pxe_bench_receiver receiver = {ntohs(address.sin_port), total, 0};
+  pthread_t thread;
+
+  pthread_create(&thread, NULL, pxe_bench_receive, &receiver);
+
+  pxe_socket socket;
+
+  memset(&socket, 0, sizeof(socket));
+  socket.fd = accept(listen_fd, NULL, NULL);
+  socket.state = PXE_SOCKET_STATE_CONNECTED;
+  close(listen_fd);
+
+  // Sessions are set up the same way, and without nodelay small zero-copy
+  // sends sit behind delayed acks.
+  pxe_socket_set_block(&socket, 0);
+  pxe_socket_set_nodelay(&socket, 1);
+
+  if (zerocopy) {
+    int value = 1;
+
+    setsockopt(socket.fd, SOL_SOCKET, SO_ZEROCOPY, &value, sizeof(value));
+  }
+
+  // The frame never changes, so it can be sent again while the kernel may
+  // still be reading it from an earlier zero-copy send.
+  u8* data = malloc(frame_size);
+
+  memset(data, 0x5A, frame_size);
+
+  pxe_buffer buffer = {data, frame_size, frame_size, 0, NULL, NULL};
+  pxe_buffer_chain chain = {&buffer, NULL};
+  pxe_memory_arena arena;
+
+  pxe_arena_initialize(&arena, malloc(PXE_BENCH_ARENA_SIZE),
+                       PXE_BENCH_ARENA_SIZE);
+
+  size_t sent_total = 0;
+  size_t offset = 0;
+  u32 pending = 0;
+  u64 start = pxe_bench_now_ns();
+
+  while (sent_total < total && socket.state == PXE_SOCKET_STATE_CONNECTED) {
+    size_t sent = 0;
+
+    if (!zerocopy) {
+      sent = pxe_socket_send_chain(&socket, &arena, &chain, offset);
+    } else if (pending < PXE_BENCH_MAX_PENDING) {
+      bool32 zerocopied = 0;
+
+      sent = pxe_socket_send_chain_zerocopy(&socket, &arena, &chain, offset,
+                                            &zerocopied);
+
+      if (zerocopied) {
+        ++pending;
+        ++*zerocopy_sends;
+      }
+    }
+
+    pxe_arena_reset(&arena);
+
+    if (zerocopy) {
+      pending -= pxe_bench_complete(&socket, copied);
+    }
+
+    if (sent == 0) {
+      // Completions wake the wait as errors, so with every send still pending
+      // this only waits for them rather than spinning on POLLOUT.
+      short events = zerocopy && pending >= PXE_BENCH_MAX_PENDING ? 0 : POLLOUT;
+      struct pollfd poll_fd = {socket.fd, events, 0};
+
+      poll(&poll_fd, 1, 100);
+      continue;
+    }
+
+    sent_total += sent;
+    offset = (offset + sent) % frame_size;
+  }
+
+  while (pending > 0 && socket.state == PXE_SOCKET_STATE_CONNECTED) {
+    struct pollfd poll_fd = {socket.fd, 0, 0};
+
+    poll(&poll_fd, 1, 100);
+    pending -= pxe_bench_complete(&socket, copied);
+  }
+
+  pthread_join(thread, NULL);
+
+  u64 elapsed = pxe_bench_now_ns() - start;
+  bool32 failed = receiver.received != total;
+
+  close(socket.fd);
+  free(arena.base);
+  free(data);
+
+  if (failed) return -1.0;
+
+  return (double)total / (1024.0 * 1024.0) / ((double)elapsed / 1e9);
+}
+
+int main(int argc, char* argv[]) {
+  size_t total = pxe_megabytes(argc > 1 ? (size_t)atoi(argv[1]) : 256);
+  size_t frame_sizes[] = {pxe_kilobytes(4), pxe_kilobytes(16),
+                          pxe_kilobytes(64), pxe_kilobytes(256),
+                          pxe_megabytes(1)};
+
+  printf("%10s %12s %12s %10s %10s\n", "frame", "copy MB/s", "zc MB/s",
+         "zc sends", "copied");
+
+  for (size_t i = 0; i < pxe_array_size(frame_sizes); ++i) {
+    size_t frame_size = frame_sizes[i];
+    u32 sends = 0;
+    u32 copied = 0;
+    double copy = pxe_bench_run(frame_size, total, 0, &sends, &copied);
+    double zerocopy = pxe_bench_run(frame_size, total, 1, &sends, &copied);
+
+    if (copy < 0 || zerocopy < 0) {
+      fprintf(stderr, "Loopback connection failed at %zu byte frames.\n",
+              frame_size);
+      return 1;
+    }
+
+    printf("%10zu %12.0f %12.0f %10u %10u\n", frame_size, copy, zerocopy,
+           sends, copied);
+  }
+
+  return 0;
+}
+#else
+int main(void) {
+  fprintf(stderr, "Zero-copy sends are only supported on Linux.\n");
+  return 0;
+}
+#endif
@@ -99,6 +99,21 @@ struct pxe_buffer_chain* pxe_serialize_play_plugin_message(
   return writer.head;
 }
 
+struct pxe_buffer_chain* pxe_serialize_play_disconnect(struct pxe_pool* pool,
+                                                       char* reason) {
+  char data[512];
+
+  size_t data_len = sprintf_s(data, pxe_array_size(data),
+                              "{\"text\":\"%s\"}", reason);
+  pxe_buffer_writer writer = pxe_buffer_writer_create(pool);
+
+  if (pxe_buffer_write_length_string(&writer, data, data_len) == 0) {
+    return NULL;
+  }
+
+  return writer.head;
+}
+
 struct pxe_buffer_chain* pxe_serialize_play_entity_status(struct pxe_pool* pool,
                                                           pxe_entity_id eid,
                                                           u8 status) {
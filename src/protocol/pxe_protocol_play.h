@@ -42,7 +42,7 @@ typedef struct pxe_player_info {
   struct {
     union {
       struct {
-        char name[16];
+        char name[17];
         size_t property_count;
         pxe_player_info_add_property* properties;
         u8 gamemode;
@@ -78,6 +78,10 @@ struct pxe_buffer_chain* pxe_serialize_play_animation(
 struct pxe_buffer_chain* pxe_serialize_play_plugin_message(
     struct pxe_pool* pool, const char* channel, const u8* data, size_t size);
 
+// 0x1A
+struct pxe_buffer_chain* pxe_serialize_play_disconnect(struct pxe_pool* pool,
+                                                       char* reason);
+
 // 0x1B
 struct pxe_buffer_chain* pxe_serialize_play_entity_status(struct pxe_pool* pool,
                                                           pxe_entity_id eid,
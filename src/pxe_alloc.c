@@ -1,8 +1,17 @@
 #include "pxe_alloc.h"
 
 #include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include "pxe_buffer.h"
 
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
 void pxe_arena_initialize(pxe_memory_arena* arena, void* memory,
                           size_t max_size) {
   arena->base = memory;
@@ -41,54 +50,207 @@ void pxe_arena_reset(pxe_memory_arena* arena) {
   arena->size = 0;
 }
 
+void* pxe_page_alloc(size_t size) {
+#ifdef _WIN32
+  return VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+  void* memory = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+  return memory == MAP_FAILED ? NULL : memory;
+#endif
+}
+
+void pxe_page_free(void* memory, size_t size) {
+#ifdef _WIN32
+  VirtualFree(memory, 0, MEM_RELEASE);
+#else
+  munmap(memory, size);
+#endif
+}
+
+void pxe_page_trim(void* memory, size_t size) {
+#ifdef _WIN32
+  VirtualAlloc(memory, size, MEM_RESET, PAGE_READWRITE);
+#else
+  madvise(memory, size, MADV_DONTNEED);
+#endif
+}
+
+// The smallest class that holds size, or the largest class.
+static inline size_t pxe_pool_size_class(size_t size) {
+  size_t size_class = 0;
+
+  while (size_class < PXE_POOL_CLASS_COUNT - 1 &&
+         ((size_t)PXE_POOL_MIN_CLASS_SIZE << size_class) < size) {
+    ++size_class;
+  }
+
+  return size_class;
+}
+
 pxe_pool* pxe_pool_create(pxe_memory_arena* perm_arena, size_t element_size) {
   pxe_pool* pool = pxe_arena_push_type(perm_arena, pxe_pool);
 
+  assert(element_size <= PXE_POOL_MAX_CLASS_SIZE);
+
   pool->arena = perm_arena;
   pool->element_size = element_size;
-  pool->free = NULL;
+  pool->slabs = NULL;
   pool->allocated_count = 0;
 
+  for (size_t i = 0; i < pxe_array_size(pool->free); ++i) {
+    pool->free[i] = NULL;
+  }
+
+  for (size_t i = 0; i < pxe_array_size(pool->carving); ++i) {
+    pool->carving[i] = NULL;
+  }
+
   return pool;
 }
 
+static pxe_buffer_chain* pxe_pool_create_buffer(pxe_pool* pool, u8* data,
+                                                size_t size,
+                                                pxe_pool_slab* slab) {
+  pxe_buffer_chain* chain = pxe_arena_push_type(pool->arena, pxe_buffer_chain);
+  pxe_buffer* buffer = pxe_arena_push_type(pool->arena, pxe_buffer);
+
+  buffer->data = data;
+  buffer->size = 0;
+  buffer->max_size = size;
+  buffer->headroom = 0;
+  buffer->shared = NULL;
+  buffer->slab = slab;
+
+  chain->buffer = buffer;
+  chain->next = NULL;
+
+  ++pool->allocated_count;
+
+  return chain;
+}
+
+// Makes a new buffer out of the rest of the class's slab, or out of a new slab
+// once that one is used up. Running out of memory to map is fatal, the same as
+// running out of arena, so callers never see NULL.
+static pxe_buffer_chain* pxe_pool_carve(pxe_pool* pool, size_t size_class) {
+  size_t size = (size_t)PXE_POOL_MIN_CLASS_SIZE << size_class;
+  pxe_pool_slab* slab = pool->carving[size_class];
+
+  if (slab == NULL || (slab->carved + 1) * size > PXE_POOL_SLAB_SIZE) {
+    u8* data = pxe_page_alloc(PXE_POOL_SLAB_SIZE);
+
+    if (data == NULL) {
+      fprintf(stderr, "Failed to map a slab for %zu byte buffers.\n", size);
+      abort();
+    }
+
+    slab = pxe_arena_push_type(pool->arena, pxe_pool_slab);
+
+    slab->data = data;
+    slab->pool = pool;
+    slab->size_class = size_class;
+    slab->carved = 0;
+    slab->used = 0;
+    slab->next = pool->slabs;
+
+    pool->slabs = slab;
+    pool->carving[size_class] = slab;
+  }
+
+  u8* data = slab->data + slab->carved * size;
+
+  ++slab->carved;
+  ++slab->used;
+  slab->idle = 0;
+  slab->trimmed = 0;
+
+  return pxe_pool_create_buffer(pool, data, size, slab);
+}
+
 struct pxe_buffer_chain* pxe_pool_alloc(pxe_pool* pool) {
-  if (pool->free == NULL) {
-    pxe_buffer_chain* chain =
-        pxe_arena_push_type(pool->arena, pxe_buffer_chain);
-    pxe_buffer* buffer = pxe_arena_push_type(pool->arena, pxe_buffer);
-    u8* data = pxe_arena_alloc(pool->arena, pool->element_size);
+  if (pool->element_size > 0) {
+    return pxe_pool_alloc_size(pool, 0);
+  }
+
+  pxe_buffer_chain* free = pool->free[PXE_POOL_CLASS_COUNT];
 
-    buffer->data = data;
-    buffer->size = 0;
-    buffer->max_size = pool->element_size;
+  if (free == NULL) {
+    return pxe_pool_create_buffer(pool, NULL, 0, NULL);
+  }
 
-    chain->buffer = buffer;
-    chain->next = NULL;
+  pool->free[PXE_POOL_CLASS_COUNT] = free->next;
+  free->next = NULL;
+  free->buffer->size = 0;
 
-    ++pool->allocated_count;
+  return free;
+}
 
-    return chain;
+struct pxe_buffer_chain* pxe_pool_alloc_size(pxe_pool* pool, size_t size) {
+  if (size < pool->element_size) {
+    size = pool->element_size;
   }
 
-  pxe_buffer_chain* free = pool->free;
+  size_t size_class = pxe_pool_size_class(size);
+  pxe_buffer_chain* free = pool->free[size_class];
 
-  pool->free = free->next;
+  if (free == NULL) {
+    return pxe_pool_carve(pool, size_class);
+  }
+
+  pool->free[size_class] = free->next;
   free->next = NULL;
 
-  free->buffer->size = 0;
+  pxe_buffer* buffer = free->buffer;
+  pxe_pool_slab* slab = buffer->slab;
+
+  buffer->data -= buffer->headroom;
+  buffer->max_size += buffer->headroom;
+  buffer->headroom = 0;
+  buffer->size = 0;
+
+  // Only the thread that owns the slab keeps count of its buffers.
+  if (slab->pool == pool) {
+    ++slab->used;
+    slab->idle = 0;
+    slab->trimmed = 0;
+  }
 
   return free;
 }
 
+static inline void pxe_pool_push(pxe_pool* pool,
+                                 struct pxe_buffer_chain* chain) {
+  pxe_shared_frame* frame = chain->buffer->shared;
+
+  if (frame && frame->owner->pool == pool) {
+    pxe_shared_frame_unref(chain);
+    return;
+  }
+
+  pxe_pool_slab* slab = chain->buffer->slab;
+  size_t size_class = PXE_POOL_CLASS_COUNT;
+
+  if (slab) {
+    size_class = slab->size_class;
+
+    if (slab->pool == pool) {
+      --slab->used;
+    }
+  }
+
+  chain->next = pool->free[size_class];
+  pool->free[size_class] = chain;
+}
+
 struct pxe_buffer_chain* pxe_pool_free(pxe_pool* pool,
                                        struct pxe_buffer_chain* chain,
                                        bool32 free_chain) {
   if (!free_chain) {
     pxe_buffer_chain* next = chain->next;
 
-    chain->next = pool->free;
-    pool->free = chain;
+    pxe_pool_push(pool, chain);
 
     return next;
   }
@@ -96,11 +258,54 @@ struct pxe_buffer_chain* pxe_pool_free(pxe_pool* pool,
   while (chain) {
     pxe_buffer_chain* next = chain->next;
 
-    chain->next = pool->free;
-    pool->free = chain;
+    pxe_pool_push(pool, chain);
 
     chain = next;
   }
 
   return NULL;
 }
+
+struct pxe_buffer_chain* pxe_pool_take(pxe_pool* pool) {
+  pxe_buffer_chain* head = NULL;
+
+  for (size_t i = 0; i < pxe_array_size(pool->free); ++i) {
+    pxe_buffer_chain* chain = pool->free[i];
+
+    if (chain == NULL) continue;
+
+    pxe_buffer_chain* last = chain;
+
+    while (last->next) {
+      last = last->next;
+    }
+
+    last->next = head;
+    head = chain;
+    pool->free[i] = NULL;
+  }
+
+  return head;
+}
+
+size_t pxe_pool_trim(pxe_pool* pool) {
+  size_t trimmed = 0;
+
+  for (pxe_pool_slab* slab = pool->slabs; slab; slab = slab->next) {
+    if (slab->used > 0) {
+      slab->idle = 0;
+      continue;
+    }
+
+    if (slab->idle && !slab->trimmed) {
+      pxe_page_trim(slab->data, PXE_POOL_SLAB_SIZE);
+
+      slab->trimmed = 1;
+      trimmed += PXE_POOL_SLAB_SIZE;
+    }
+
+    slab->idle = 1;
+  }
+
+  return trimmed;
+}
@@ -13,9 +13,41 @@ typedef struct pxe_memory_arena {
 struct pxe_buffer;
 struct pxe_buffer_chain;
 
+// Buffer data comes in power of two size classes from 64 bytes to 64
+// kilobytes. Pools hand out their element size rounded up to a class unless a
+// size is asked for, and keep a free list for each class.
+#define PXE_POOL_MIN_CLASS_SIZE 64
+#define PXE_POOL_CLASS_COUNT 11
+#define PXE_POOL_MAX_CLASS_SIZE \
+  (PXE_POOL_MIN_CLASS_SIZE << (PXE_POOL_CLASS_COUNT - 1))
+// Each class carves its buffers out of slabs of this size that are mapped
+// directly from the OS, so the pages of slabs that sit unused can be given
+// back. Must be a multiple of the page size and at least the largest class.
+#define PXE_POOL_SLAB_SIZE PXE_POOL_MAX_CLASS_SIZE
+
+typedef struct pxe_pool_slab {
+  u8* data;
+  struct pxe_pool* pool;
+  size_t size_class;
+  // Buffers carved out of the slab so far.
+  size_t carved;
+  // Buffers that aren't in the pool's free lists. Buffers that were freed to
+  // another thread's pool on their way back still count.
+  size_t used;
+  // Set by a trim that found the slab unused. Its pages are given back if it's
+  // still unused at the next one.
+  bool32 idle;
+  bool32 trimmed;
+  struct pxe_pool_slab* next;
+} pxe_pool_slab;
+
 typedef struct pxe_pool {
   pxe_memory_arena* arena;
-  struct pxe_buffer_chain* free;
+  // A free list for each class and a last one for buffers without data.
+  struct pxe_buffer_chain* free[PXE_POOL_CLASS_COUNT + 1];
+  // The slab each class carves new buffers out of once its list is empty.
+  pxe_pool_slab* carving[PXE_POOL_CLASS_COUNT];
+  pxe_pool_slab* slabs;
   size_t element_size;
   size_t allocated_count;
 } pxe_pool;
@@ -36,10 +68,33 @@ void pxe_arena_reset(pxe_memory_arena* arena);
 #define pxe_megabytes(n) ((n)*pxe_kilobytes(1024))
 #define pxe_gigabytes(n) ((n)*pxe_megabytes(1024))
 
+// Maps zeroed memory directly from the OS, so pxe_page_free returns it rather
+// than leaving it with the allocator. Returns NULL on failure.
+void* pxe_page_alloc(size_t size);
+void pxe_page_free(void* memory, size_t size);
+// Lets the OS take back the pages while keeping them mapped. Their contents
+// are lost.
+void pxe_page_trim(void* memory, size_t size);
+
+// The element size can't be larger than PXE_POOL_MAX_CLASS_SIZE. Pools with
+// an element size of 0 hand out buffers without any data, which are used to
+// point at data that belongs to something else.
 pxe_pool* pxe_pool_create(pxe_memory_arena* perm_arena, size_t element_size);
+// Allocations never return NULL. The process aborts if a new slab can't be
+// mapped.
 struct pxe_buffer_chain* pxe_pool_alloc(pxe_pool* pool);
+// Returns a buffer of at least size bytes and at least the element size, or
+// of the largest class if size is larger than that.
+struct pxe_buffer_chain* pxe_pool_alloc_size(pxe_pool* pool, size_t size);
 struct pxe_buffer_chain* pxe_pool_free(pxe_pool* pool,
                                        struct pxe_buffer_chain* chain,
                                        bool32 free_chain);
+// Takes every free buffer out of the pool as one chain. This is for pools that
+// only collect buffers to hand back to the thread that owns them.
+struct pxe_buffer_chain* pxe_pool_take(pxe_pool* pool);
+// Gives back the pages of slabs that have been unused since the previous trim.
+// Their buffers stay in the free lists and the pages are mapped again when
+// they're used. Returns the number of bytes given back.
+size_t pxe_pool_trim(pxe_pool* pool);
 
 #endif
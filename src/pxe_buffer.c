@@ -1,6 +1,7 @@
 #include "pxe_buffer.h"
 
 #include "pxe_alloc.h"
+#include "pxe_compress.h"
 #include "pxe_varint.h"
 
 #include <stdlib.h>
@@ -8,8 +9,19 @@
 
 // TODO: Endianness
 
-inline bool32 pxe_buffer_writer_alloc(pxe_buffer_writer* writer) {
-  pxe_buffer_chain* new_chain = pxe_pool_alloc(writer->pool);
+// Adds a buffer to the end of the writer's chain that holds at least size
+// bytes, and more if the size hint or the pool's element size calls for it.
+inline bool32 pxe_buffer_writer_alloc(pxe_buffer_writer* writer,
+                                      size_t size) {
+  if (size < writer->size_hint) {
+    size = writer->size_hint;
+  }
+
+  if (writer->head == NULL) {
+    size += PXE_BUFFER_HEADROOM;
+  }
+
+  pxe_buffer_chain* new_chain = pxe_pool_alloc_size(writer->pool, size);
 
   if (new_chain == NULL) {
     return 0;
@@ -17,7 +29,15 @@ inline bool32 pxe_buffer_writer_alloc(pxe_buffer_writer* writer) {
 
   new_chain->next = NULL;
 
+  pxe_buffer* buffer = new_chain->buffer;
+
   if (writer->head == NULL) {
+    if (buffer->max_size > PXE_BUFFER_HEADROOM) {
+      buffer->data += PXE_BUFFER_HEADROOM;
+      buffer->max_size -= PXE_BUFFER_HEADROOM;
+      buffer->headroom = PXE_BUFFER_HEADROOM;
+    }
+
     writer->head = new_chain;
     writer->current = new_chain;
     writer->last = new_chain;
@@ -26,44 +46,29 @@ inline bool32 pxe_buffer_writer_alloc(pxe_buffer_writer* writer) {
     writer->last = new_chain;
   }
 
-  return 1;
-}
-
-inline size_t pxe_buffer_allocated_size(pxe_buffer_chain* chain) {
-  if (chain == NULL) return 0;
-
-  size_t size = 0;
-
-  do {
-    size += chain->buffer->max_size;
+  writer->capacity += buffer->max_size;
+  writer->size_hint = writer->size_hint > buffer->max_size
+                          ? writer->size_hint - buffer->max_size
+                          : 0;
 
-    chain = chain->next;
-  } while (chain);
-
-  return size;
+  return 1;
 }
 
 // Reserves space in the buffer writer by allocating if the size would go over
 // the currently allocated space.
 inline bool32 pxe_buffer_writer_reserve(pxe_buffer_writer* writer,
                                         size_t size) {
-#if 0
-  if (writer->head == NULL || (writer->relative_write_pos + size > writer->pool->element_size)) {
-#else
-  while (writer->head == NULL || pxe_buffer_allocated_size(writer->current) -
-                                         writer->relative_write_pos <
-                                     size) {
-#endif
-  if (!pxe_buffer_writer_alloc(writer)) {
-    return 0;
+  while (writer->head == NULL || writer->capacity < size) {
+    if (!pxe_buffer_writer_alloc(writer, size - writer->capacity)) {
+      return 0;
+    }
   }
-}
 
-return 1;
+  return 1;
 }
 
 inline size_t pxe_buffer_writer_remaining(pxe_buffer_writer* writer) {
-  return writer->pool->element_size - writer->relative_write_pos;
+  return writer->current->buffer->max_size - writer->relative_write_pos;
 }
 
 // Returns 1 if the current buffer chain has enough room for 'size'.
@@ -86,407 +91,273 @@ size_t pxe_buffer_size(pxe_buffer_chain* chain) {
   return size;
 }
 
-// Returns the current buffer_chain that falls in the reader's read_pos and its
-// base position.
-bool32 pxe_buffer_get_pos_and_chain(pxe_buffer_reader* reader,
-                                    pxe_buffer_chain** base, size_t* base_pos) {
-  pxe_buffer_chain* current = reader->chain;
-  pxe_buffer_chain* prev = current;
-
-  if (current == NULL) return 0;
-
-  size_t pos = 0;
-
-  do {
-    pos += current->buffer->size;
-    prev = current;
-    current = current->next;
-  } while (pos <= reader->read_pos && current);
-
-  if (prev == NULL || (current == NULL && pos <= reader->read_pos)) {
-    return 0;
-  }
-
-  *base = prev;
-  *base_pos = pos - prev->buffer->size;
-
-  return 1;
+void pxe_buffer_reader_reset(pxe_buffer_reader* reader, pxe_buffer_chain* chain,
+                             size_t read_pos) {
+  reader->read_pos = read_pos;
+  reader->chain = chain;
+  reader->current = chain;
+  reader->current_pos = 0;
 }
 
-bool32 pxe_buffer_read_u8(pxe_buffer_reader* reader, u8* out) {
-  pxe_buffer_chain* current = NULL;
-  size_t base_pos = 0;
+// Moves the cursor forward to the buffer that holds read_pos. It goes back to
+// the start of the chain only if read_pos was moved back past it. Returns 0 if
+// read_pos is at or past the end of the chain.
+static inline bool32 pxe_buffer_reader_seek(pxe_buffer_reader* reader) {
+  if (reader->current == NULL || reader->current_pos > reader->read_pos) {
+    reader->current = reader->chain;
+    reader->current_pos = 0;
 
-  if (pxe_buffer_get_pos_and_chain(reader, &current, &base_pos) == 0) {
-    return 0;
+    if (reader->current == NULL) return 0;
   }
 
-  size_t read_index = reader->read_pos - base_pos;
+  pxe_buffer_chain* current = reader->current;
 
-  *out = current->buffer->data[read_index];
+  while (reader->read_pos - reader->current_pos >= current->buffer->size) {
+    if (current->next == NULL) return 0;
 
-  reader->read_pos++;
+    reader->current_pos += current->buffer->size;
+    current = current->next;
+    reader->current = current;
+  }
 
   return 1;
 }
 
-bool32 pxe_buffer_read_u16(pxe_buffer_reader* reader, u16* out) {
-  pxe_buffer_chain* current = NULL;
-  size_t base_pos = 0;
-
-  if (pxe_buffer_get_pos_and_chain(reader, &current, &base_pos) == 0) {
-    return 0;
-  }
+// Copies up to size bytes starting at read_pos without moving it. Returns the
+// number of bytes copied, which is less than size at the end of the chain.
+static size_t pxe_buffer_reader_peek(pxe_buffer_reader* reader, u8* out,
+                                     size_t size) {
+  if (size == 0 || !pxe_buffer_reader_seek(reader)) return 0;
 
-  size_t read_index = reader->read_pos - base_pos;
+  pxe_buffer_chain* current = reader->current;
+  size_t index = reader->read_pos - reader->current_pos;
+  size_t copied = 0;
 
-  u16 data = 0;
+  while (current && copied < size) {
+    size_t available = current->buffer->size - index;
 
-  // This lies right on the boundary of the two chains
-  if (read_index + sizeof(u16) > current->buffer->size) {
-    if (current->next == NULL) {
-      // There's not enough data to read the u16 if there's no next chain.
-      return 0;
+    if (available > size - copied) {
+      available = size - copied;
     }
 
-    char buf[4] = {0};
-
-    size_t first_len = current->buffer->size - read_index;
-    size_t second_len = sizeof(data) - first_len;
-
-    for (size_t i = 0; i < first_len; ++i) {
-      buf[i] = (char)current->buffer->data[read_index + i];
-    }
+    memcpy(out + copied, current->buffer->data + index, available);
 
+    copied += available;
     current = current->next;
-
-    for (size_t i = 0; i < second_len; ++i) {
-      buf[i + first_len] = (char)current->buffer->data[i];
-    }
-
-    data = *(u16*)buf;
-  } else {
-    data = *(u16*)&current->buffer->data[read_index];
+    index = 0;
   }
 
-  *out = bswap_16(data);
-
-  reader->read_pos += sizeof(u16);
-
-  return 1;
+  return copied;
 }
 
-bool32 pxe_buffer_read_u32(pxe_buffer_reader* reader, u32* out) {
-  pxe_buffer_chain* current = NULL;
-  size_t base_pos = 0;
+// Reads size bytes into out. Nothing is read if the chain is too short.
+static inline bool32 pxe_buffer_reader_copy(pxe_buffer_reader* reader,
+                                            void* out, size_t size) {
+  if (size == 0) return 1;
+  if (!pxe_buffer_reader_seek(reader)) return 0;
+
+  pxe_buffer* buffer = reader->current->buffer;
+  size_t index = reader->read_pos - reader->current_pos;
 
-  if (pxe_buffer_get_pos_and_chain(reader, &current, &base_pos) == 0) {
+  // Most fields are inside a single buffer.
+  if (buffer->size - index >= size) {
+    memcpy(out, buffer->data + index, size);
+  } else if (pxe_buffer_reader_peek(reader, out, size) < size) {
     return 0;
   }
 
-  size_t read_index = reader->read_pos - base_pos;
+  reader->read_pos += size;
 
-  u32 data = 0;
+  return 1;
+}
 
-  // This lies right on the boundary of the two chains
-  if (read_index + sizeof(u32) > current->buffer->size) {
-    if (current->next == NULL) {
-      // There's not enough data to read the u32 if there's no next chain.
-      return 0;
-    }
+bool32 pxe_buffer_reader_skip(pxe_buffer_reader* reader, size_t size) {
+  if (size == 0) return 1;
+  if (!pxe_buffer_reader_seek(reader)) return 0;
 
-    char buf[4] = {0};
+  pxe_buffer_chain* current = reader->current;
+  size_t current_pos = reader->current_pos;
+  size_t end = reader->read_pos + size;
 
-    size_t first_len = current->buffer->size - read_index;
-    size_t second_len = pxe_array_size(buf) - first_len;
-
-    for (size_t i = 0; i < first_len; ++i) {
-      buf[i] = (char)current->buffer->data[read_index + i];
-    }
+  while (end > current_pos + current->buffer->size) {
+    if (current->next == NULL) return 0;
 
+    current_pos += current->buffer->size;
     current = current->next;
-
-    for (size_t i = 0; i < second_len; ++i) {
-      buf[i + first_len] = (char)current->buffer->data[i];
-    }
-
-    data = *(u32*)buf;
-  } else {
-    data = *(u32*)&current->buffer->data[read_index];
   }
 
-  *out = bswap_32(data);
-
-  reader->read_pos += sizeof(u32);
+  reader->current = current;
+  reader->current_pos = current_pos;
+  reader->read_pos = end;
 
   return 1;
 }
 
-bool32 pxe_buffer_read_u64(pxe_buffer_reader* reader, u64* out) {
-  pxe_buffer_chain* current = NULL;
-  size_t base_pos = 0;
+u8* pxe_buffer_read_contiguous(pxe_buffer_reader* reader, size_t size,
+                               pxe_memory_arena* arena) {
+  if (size == 0 || !pxe_buffer_reader_seek(reader)) return NULL;
 
-  if (pxe_buffer_get_pos_and_chain(reader, &current, &base_pos) == 0) {
-    return 0;
-  }
-
-  size_t read_index = reader->read_pos - base_pos;
-
-  u64 data = 0;
-
-  // This lies right on the boundary of the two chains
-  if (read_index + sizeof(u64) > current->buffer->size) {
-    if (current->next == NULL) {
-      // There's not enough data to read the u64 if there's no next chain.
-      return 0;
-    }
-
-    char buf[8] = {0};
+  pxe_buffer_chain* current = reader->current;
+  size_t index = reader->read_pos - reader->current_pos;
+  size_t available = current->buffer->size - index;
+  u8* data;
 
-    size_t first_len = current->buffer->size - read_index;
-    size_t second_len = pxe_array_size(buf) - first_len;
-
-    for (size_t i = 0; i < first_len; ++i) {
-      buf[i] = (char)current->buffer->data[read_index + i];
+  if (available >= size) {
+    data = current->buffer->data + index;
+  } else {
+    // Only the buffer sizes are looked at until the whole range is there.
+    for (pxe_buffer_chain* chain = current->next; chain && available < size;
+         chain = chain->next) {
+      available += chain->buffer->size;
     }
 
-    current = current->next;
-
-    for (size_t i = 0; i < second_len; ++i) {
-      buf[i + first_len] = (char)current->buffer->data[i];
-    }
+    if (available < size) return NULL;
 
-    data = *(u64*)buf;
-  } else {
-    data = *(u64*)&current->buffer->data[read_index];
+    data = pxe_arena_alloc(arena, size);
+    pxe_buffer_reader_peek(reader, data, size);
   }
 
-  *out = bswap_64(data);
-
-  reader->read_pos += sizeof(u64);
+  reader->read_pos += size;
 
-  return 1;
+  return data;
 }
 
-bool32 pxe_buffer_read_varint(pxe_buffer_reader* reader, i32* value) {
-  pxe_buffer_chain* current = NULL;
-  size_t base_pos = 0;
-
-  if (pxe_buffer_get_pos_and_chain(reader, &current, &base_pos) == 0) {
-    return 0;
-  }
-
-  size_t read_index = reader->read_pos - base_pos;
-  int shift = 0;
-  size_t i = 0;
-
-  *value = 0;
-
-  do {
-    if (read_index >= current->buffer->size) {
-      if (current->next == NULL) {
-        // The buffer doesn't have enough data to fully read this VarInt.
-        *value = 0;
-        return 0;
-      }
-
-      read_index = 0;
-      current = current->next;
-    }
+bool32 pxe_buffer_read_u8(pxe_buffer_reader* reader, u8* out) {
+  if (!pxe_buffer_reader_seek(reader)) return 0;
 
-    *value |= (i32)(current->buffer->data[read_index] & 0x7F) << shift;
-    shift += 7;
-    ++i;
-  } while ((current->buffer->data[read_index++] & 0x80) != 0);
+  *out = reader->current->buffer
+             ->data[reader->read_pos - reader->current_pos];
 
-  reader->read_pos += i;
+  reader->read_pos++;
 
   return 1;
 }
 
-bool32 pxe_buffer_read_varlong(pxe_buffer_reader* reader, i64* value) {
-  pxe_buffer_chain* current = NULL;
-  size_t base_pos = 0;
+bool32 pxe_buffer_read_u16(pxe_buffer_reader* reader, u16* out) {
+  u16 data;
 
-  if (pxe_buffer_get_pos_and_chain(reader, &current, &base_pos) == 0) {
-    return 0;
-  }
+  if (!pxe_buffer_reader_copy(reader, &data, sizeof(data))) return 0;
 
-  size_t read_index = reader->read_pos - base_pos;
-  int shift = 0;
-  size_t i = 0;
+  *out = bswap_16(data);
 
-  *value = 0;
+  return 1;
+}
 
-  do {
-    if (read_index + i >= current->buffer->size) {
-      if (current->next == NULL) {
-        // The buffer doesn't have enough data to fully read this VarInt.
-        *value = 0;
-        return 0;
-      }
-
-      read_index = 0;
-      current = current->next;
-    }
+bool32 pxe_buffer_read_u32(pxe_buffer_reader* reader, u32* out) {
+  u32 data;
 
-    *value |= (i64)(current->buffer->data[read_index] & 0x7F) << shift;
-    shift += 7;
-    ++i;
-  } while ((current->buffer->data[read_index++] & 0x80) != 0);
+  if (!pxe_buffer_reader_copy(reader, &data, sizeof(data))) return 0;
 
-  reader->read_pos += i;
+  *out = bswap_32(data);
 
   return 1;
 }
 
-bool32 pxe_buffer_read_float(pxe_buffer_reader* reader, float* out) {
-  pxe_buffer_chain* current = NULL;
-  size_t base_pos = 0;
-
-  if (pxe_buffer_get_pos_and_chain(reader, &current, &base_pos) == 0) {
-    return 0;
-  }
-
-  size_t read_index = reader->read_pos - base_pos;
+bool32 pxe_buffer_read_u64(pxe_buffer_reader* reader, u64* out) {
+  u64 data;
 
-  float data = 0.0f;
+  if (!pxe_buffer_reader_copy(reader, &data, sizeof(data))) return 0;
 
-  // This lies right on the boundary of the two chains
-  if (read_index + sizeof(float) > current->buffer->size) {
-    if (current->next == NULL) {
-      // There's not enough data to read the float if there's no next chain.
-      return 0;
-    }
+  *out = bswap_64(data);
 
-    char buf[4] = {0};
+  return 1;
+}
 
-    size_t first_len = current->buffer->size - read_index;
-    size_t second_len = pxe_array_size(buf) - first_len;
+bool32 pxe_buffer_read_varint(pxe_buffer_reader* reader, i32* value) {
+  u8 bytes[5];
 
-    for (size_t i = 0; i < first_len; ++i) {
-      buf[i] = (char)current->buffer->data[read_index + i];
-    }
+  *value = 0;
 
-    current = current->next;
+  if (!pxe_buffer_reader_seek(reader)) return 0;
 
-    for (size_t i = 0; i < second_len; ++i) {
-      buf[i + first_len] = (char)current->buffer->data[i];
-    }
+  pxe_buffer* buffer = reader->current->buffer;
+  size_t index = reader->read_pos - reader->current_pos;
+  u8* data = buffer->data + index;
+  size_t available = buffer->size - index;
 
-    data = *(float*)buf;
-  } else {
-    data = *(float*)&current->buffer->data[read_index];
+  // Only a VarInt that might continue into the next buffer is copied out. The
+  // rest of the buffer is passed along so it can be read with one load.
+  if (available < sizeof(bytes)) {
+    available = pxe_buffer_reader_peek(reader, bytes, sizeof(bytes));
+    data = bytes;
   }
 
-  u32 int_rep = *(u32*)&data;
-  int_rep = bswap_32(int_rep);
-  data = *(float*)&int_rep;
+  size_t size = pxe_varint_read((char*)data, available, value);
 
-  *out = data;
-
-  reader->read_pos += sizeof(float);
+  reader->read_pos += size;
 
-  return 1;
+  return size > 0;
 }
 
-bool32 pxe_buffer_read_double(pxe_buffer_reader* reader, double* out) {
-  pxe_buffer_chain* current = NULL;
-  size_t base_pos = 0;
+bool32 pxe_buffer_read_varlong(pxe_buffer_reader* reader, i64* value) {
+  u8 bytes[10];
 
-  if (pxe_buffer_get_pos_and_chain(reader, &current, &base_pos) == 0) {
-    return 0;
-  }
+  *value = 0;
 
-  size_t read_index = reader->read_pos - base_pos;
+  if (!pxe_buffer_reader_seek(reader)) return 0;
 
-  double data = 0.0;
+  pxe_buffer* buffer = reader->current->buffer;
+  size_t index = reader->read_pos - reader->current_pos;
+  u8* data = buffer->data + index;
+  size_t available = buffer->size - index;
 
-  // This lies right on the boundary of the two chains
-  if (read_index + sizeof(double) > current->buffer->size) {
-    if (current->next == NULL) {
-      // There's not enough data to read the double if there's no next chain.
-      return 0;
-    }
+  if (available < sizeof(bytes)) {
+    available = pxe_buffer_reader_peek(reader, bytes, sizeof(bytes));
+    data = bytes;
+  }
 
-    char buf[8] = {0};
+  size_t size = pxe_varlong_read((char*)data, available, value);
 
-    size_t first_len = current->buffer->size - read_index;
-    size_t second_len = pxe_array_size(buf) - first_len;
+  reader->read_pos += size;
 
-    for (size_t i = 0; i < first_len; ++i) {
-      buf[i] = (char)current->buffer->data[read_index + i];
-    }
+  return size > 0;
+}
 
-    current = current->next;
+bool32 pxe_buffer_read_float(pxe_buffer_reader* reader, float* out) {
+  u32 int_rep;
 
-    for (size_t i = 0; i < second_len; ++i) {
-      buf[i + first_len] = (char)current->buffer->data[i];
-    }
+  if (!pxe_buffer_read_u32(reader, &int_rep)) return 0;
 
-    data = *(double*)buf;
-  } else {
-    data = *(double*)&current->buffer->data[read_index];
-  }
+  memcpy(out, &int_rep, sizeof(*out));
 
-  u64 int_rep = *(u64*)&data;
-  int_rep = bswap_64(int_rep);
-  data = *(double*)&int_rep;
+  return 1;
+}
 
-  *out = data;
+bool32 pxe_buffer_read_double(pxe_buffer_reader* reader, double* out) {
+  u64 int_rep;
+
+  if (!pxe_buffer_read_u64(reader, &int_rep)) return 0;
 
-  reader->read_pos += sizeof(double);
+  memcpy(out, &int_rep, sizeof(*out));
 
   return 1;
 }
 
 bool32 pxe_buffer_read_length_string(pxe_buffer_reader* reader, char* out,
                                      size_t* size) {
+  pxe_buffer_reader_snapshot snapshot = pxe_buffer_reader_save(reader);
   i32 str_len;
 
-  size_t pos_snapshot = reader->read_pos;
-
   if (pxe_buffer_read_varint(reader, &str_len) == 0) {
     return 0;
   }
 
+  if (str_len < 0) {
+    pxe_buffer_reader_rewind(reader, &snapshot);
+    return 0;
+  }
+
   if (out == NULL) {
-    reader->read_pos = pos_snapshot;
+    pxe_buffer_reader_rewind(reader, &snapshot);
     *size = str_len;
     return 1;
   }
 
-  pxe_buffer_chain* current = NULL;
-  size_t base_pos = 0;
-
-  if (pxe_buffer_get_pos_and_chain(reader, &current, &base_pos) == 0) {
-    reader->read_pos = pos_snapshot;
+  if (!pxe_buffer_reader_copy(reader, out, (size_t)str_len)) {
+    pxe_buffer_reader_rewind(reader, &snapshot);
     return 0;
   }
 
-  size_t read_index = reader->read_pos - base_pos;
-
-  for (size_t i = 0; i < (size_t)str_len;) {
-    out[i] = (char)current->buffer->data[read_index];
-
-    ++read_index;
-
-    if (read_index > current->buffer->size) {
-      if (current->next == NULL) {
-        reader->read_pos = pos_snapshot;
-        return 0;
-      }
-
-      current = current->next;
-      read_index = 0;
-      continue;
-    }
-
-    ++i;
-  }
-
-  reader->read_pos += str_len;
-
   if (size) {
     *size = str_len;
   }
@@ -496,41 +367,14 @@ bool32 pxe_buffer_read_length_string(pxe_buffer_reader* reader, char* out,
 
 bool32 pxe_buffer_read_raw_string(pxe_buffer_reader* reader, char* out,
                                   size_t size) {
-  pxe_buffer_chain* current = NULL;
-  size_t base_pos = 0;
-
-  if (pxe_buffer_get_pos_and_chain(reader, &current, &base_pos) == 0) {
-    return 0;
-  }
-
-  size_t read_index = reader->read_pos - base_pos;
-
-  for (size_t i = 0; i < (size_t)size;) {
-    out[i] = (char)current->buffer->data[read_index];
-
-    ++read_index;
-
-    if (read_index > current->buffer->size) {
-      if (current->next == NULL) {
-        return 0;
-      }
-
-      current = current->next;
-      read_index = 0;
-      continue;
-    }
-
-    ++i;
-  }
-
-  reader->read_pos += size;
-
-  return 1;
+  return pxe_buffer_reader_copy(reader, out, size);
 }
 
 bool32 pxe_buffer_write_u8(pxe_buffer_writer* writer, u8 data) {
   if (!pxe_buffer_writer_reserve(writer, sizeof(data))) return 0;
 
+  writer->capacity -= sizeof(data);
+
   pxe_buffer* buffer = writer->current->buffer;
 
   buffer->data[writer->relative_write_pos++] = data;
@@ -544,6 +388,8 @@ bool32 pxe_buffer_write_u16(pxe_buffer_writer* writer, u16 data) {
 
   if (!pxe_buffer_writer_reserve(writer, size)) return 0;
 
+  writer->capacity -= size;
+
   data = bswap_16(data);
 
   if (pxe_buffer_writer_available(writer, size)) {
@@ -583,6 +429,8 @@ bool32 pxe_buffer_write_u32(pxe_buffer_writer* writer, u32 data) {
 
   if (!pxe_buffer_writer_reserve(writer, size)) return 0;
 
+  writer->capacity -= size;
+
   data = bswap_32(data);
 
   if (pxe_buffer_writer_available(writer, size)) {
@@ -621,6 +469,8 @@ bool32 pxe_buffer_write_u64(pxe_buffer_writer* writer, u64 data) {
 
   if (!pxe_buffer_writer_reserve(writer, size)) return 0;
 
+  writer->capacity -= size;
+
   data = bswap_64(data);
 
   if (pxe_buffer_writer_available(writer, size)) {
@@ -659,6 +509,8 @@ bool32 pxe_buffer_write_float(pxe_buffer_writer* writer, float data) {
 
   if (!pxe_buffer_writer_reserve(writer, size)) return 0;
 
+  writer->capacity -= size;
+
   u32 int_rep = *(u32*)&data;
   int_rep = bswap_32(int_rep);
   data = *(float*)&int_rep;
@@ -699,6 +551,8 @@ bool32 pxe_buffer_write_double(pxe_buffer_writer* writer, double data) {
 
   if (!pxe_buffer_writer_reserve(writer, size)) return 0;
 
+  writer->capacity -= size;
+
   u64 int_rep = *(u64*)&data;
   int_rep = bswap_64(int_rep);
   data = *(double*)&int_rep;
@@ -747,14 +601,27 @@ bool32 pxe_buffer_write_raw_string(pxe_buffer_writer* writer, const char* data,
                                    size_t length) {
   if (!pxe_buffer_writer_reserve(writer, length)) return 0;
 
-  for (size_t i = 0; i < length; ++i) {
+  writer->capacity -= length;
+
+  while (length > 0) {
     if (!pxe_buffer_writer_available(writer, 1)) {
       writer->current = writer->current->next;
       writer->relative_write_pos = 0;
     }
 
-    writer->current->buffer->data[writer->relative_write_pos++] = data[i];
-    ++writer->current->buffer->size;
+    pxe_buffer* buffer = writer->current->buffer;
+    size_t size = pxe_buffer_writer_remaining(writer);
+
+    if (size > length) {
+      size = length;
+    }
+
+    memcpy(buffer->data + writer->relative_write_pos, data, size);
+
+    writer->relative_write_pos += size;
+    buffer->size += size;
+    data += size;
+    length -= size;
   }
 
   return 1;
@@ -762,6 +629,21 @@ bool32 pxe_buffer_write_raw_string(pxe_buffer_writer* writer, const char* data,
 
 bool32 pxe_buffer_write_varint(pxe_buffer_writer* writer, i32 data) {
   size_t size = pxe_varint_size(data);
+
+  if (!pxe_buffer_writer_reserve(writer, size)) return 0;
+
+  if (pxe_buffer_writer_available(writer, size)) {
+    pxe_buffer* buffer = writer->current->buffer;
+
+    pxe_varint_write(data, (char*)buffer->data + writer->relative_write_pos);
+
+    writer->relative_write_pos += size;
+    writer->capacity -= size;
+    buffer->size += size;
+
+    return 1;
+  }
+
   char buf[5];
 
   pxe_varint_write(data, buf);
@@ -771,6 +653,21 @@ bool32 pxe_buffer_write_varint(pxe_buffer_writer* writer, i32 data) {
 
 bool32 pxe_buffer_write_varlong(pxe_buffer_writer* writer, i64 data) {
   size_t size = pxe_varlong_size(data);
+
+  if (!pxe_buffer_writer_reserve(writer, size)) return 0;
+
+  if (pxe_buffer_writer_available(writer, size)) {
+    pxe_buffer* buffer = writer->current->buffer;
+
+    pxe_varlong_write(data, (char*)buffer->data + writer->relative_write_pos);
+
+    writer->relative_write_pos += size;
+    writer->capacity -= size;
+    buffer->size += size;
+
+    return 1;
+  }
+
   char buf[10];
 
   pxe_varlong_write(data, buf);
@@ -786,6 +683,200 @@ pxe_buffer_writer pxe_buffer_writer_create(pxe_pool* pool) {
   writer.head = NULL;
   writer.last = NULL;
   writer.relative_write_pos = 0;
+  writer.capacity = 0;
+  writer.size_hint = 0;
+
+  return writer;
+}
+
+pxe_buffer_writer pxe_buffer_writer_create_sized(pxe_pool* pool,
+                                                 size_t size_hint) {
+  pxe_buffer_writer writer = pxe_buffer_writer_create(pool);
+
+  writer.size_hint = size_hint;
 
   return writer;
 }
+
+u8* pxe_buffer_writer_span(pxe_buffer_writer* writer, size_t* size) {
+  if (!pxe_buffer_writer_reserve(writer, 1)) return NULL;
+
+  if (!pxe_buffer_writer_available(writer, 1)) {
+    writer->current = writer->current->next;
+    writer->relative_write_pos = 0;
+  }
+
+  *size = pxe_buffer_writer_remaining(writer);
+
+  return writer->current->buffer->data + writer->relative_write_pos;
+}
+
+void pxe_buffer_writer_commit(pxe_buffer_writer* writer, size_t size) {
+  writer->relative_write_pos += size;
+  writer->current->buffer->size += size;
+  writer->capacity -= size;
+}
+
+bool32 pxe_buffer_prepend(pxe_buffer_chain* chain, const u8* data,
+                          size_t size) {
+  pxe_buffer* buffer = chain->buffer;
+
+  if (buffer->headroom < size) return 0;
+
+  buffer->data -= size;
+  buffer->size += size;
+  buffer->max_size += size;
+  buffer->headroom -= size;
+
+  memcpy(buffer->data, data, size);
+
+  return 1;
+}
+
+bool32 pxe_buffer_prepend_header(pxe_buffer_chain* chain, i32 packet_id,
+                                 bool32 compressed) {
+  i32 length = (i32)(pxe_varint_size(packet_id) + pxe_buffer_size(chain) +
+                     (compressed ? 1 : 0));
+  u8 header[11];
+  size_t size = pxe_varint_write(length, (char*)header);
+
+  if (compressed) {
+    header[size++] = 0;
+  }
+
+  size += pxe_varint_write(packet_id, (char*)header + size);
+
+  return pxe_buffer_prepend(chain, header, size);
+}
+
+pxe_shared_pool* pxe_shared_pool_create(pxe_memory_arena* perm_arena,
+                                        pxe_pool* pool) {
+  pxe_shared_pool* shared = pxe_arena_push_type(perm_arena, pxe_shared_pool);
+
+  shared->pool = pool;
+  shared->refs = pxe_pool_create(perm_arena, 0);
+  shared->arena = perm_arena;
+  shared->free = NULL;
+
+  return shared;
+}
+
+pxe_shared_frame* pxe_shared_frame_create(pxe_shared_pool* pool, i32 packet_id,
+                                          pxe_buffer_chain* payload) {
+  size_t payload_size = pxe_buffer_size(payload);
+  i32 length = (i32)(pxe_varint_size(packet_id) + payload_size);
+  pxe_buffer_chain* chain = payload;
+
+  if (payload == NULL || !pxe_buffer_prepend_header(payload, packet_id, 0)) {
+    pxe_buffer_writer writer = pxe_buffer_writer_create_sized(
+        pool->pool, pxe_varint_size(length) + (size_t)length);
+    bool32 written = pxe_buffer_write_varint(&writer, length) &&
+                     pxe_buffer_write_varint(&writer, packet_id);
+
+    for (pxe_buffer_chain* current = payload; current && written;
+         current = current->next) {
+      written = pxe_buffer_write_raw_string(
+          &writer, (char*)current->buffer->data, current->buffer->size);
+    }
+
+    pxe_pool_free(pool->pool, payload, 1);
+
+    if (!written) {
+      pxe_pool_free(pool->pool, writer.head, 1);
+      return NULL;
+    }
+
+    // The writer can reserve buffers past the end that never get written to.
+    pxe_pool_free(pool->pool, writer.current->next, 1);
+    writer.current->next = NULL;
+
+    chain = writer.head;
+  }
+
+  pxe_shared_frame* frame = pool->free;
+
+  if (frame) {
+    pool->free = frame->next;
+  } else {
+    frame = pxe_arena_push_type(pool->arena, pxe_shared_frame);
+  }
+
+  frame->chain = chain;
+  frame->size = pxe_varint_size(length) + length;
+  frame->compressed = NULL;
+  frame->compressed_size = 0;
+  frame->packet_id = packet_id;
+  frame->header_size = frame->size - payload_size;
+  frame->refs = 1;
+  frame->owner = pool;
+  frame->next = NULL;
+
+  return frame;
+}
+
+bool32 pxe_shared_frame_compress(pxe_shared_frame* frame) {
+  if (frame->compressed) return 1;
+
+  frame->compressed = pxe_compress_frame(frame->owner->pool, frame->packet_id,
+                                         frame->chain, frame->header_size);
+
+  if (frame->compressed == NULL) return 0;
+
+  frame->compressed_size = pxe_buffer_size(frame->compressed);
+
+  return 1;
+}
+
+pxe_buffer_chain* pxe_shared_frame_ref(pxe_shared_frame* frame,
+                                       bool32 compressed) {
+  pxe_pool* refs = frame->owner->refs;
+  pxe_buffer_chain* head = NULL;
+  pxe_buffer_chain* last = NULL;
+  pxe_buffer_chain* first = compressed ? frame->compressed : frame->chain;
+
+  for (pxe_buffer_chain* chain = first; chain; chain = chain->next) {
+    pxe_buffer_chain* ref = pxe_pool_alloc(refs);
+    pxe_buffer* buffer = ref->buffer;
+
+    buffer->data = chain->buffer->data;
+    buffer->size = chain->buffer->size;
+    buffer->max_size = buffer->size;
+    buffer->headroom = 0;
+    buffer->shared = frame;
+
+    ++frame->refs;
+
+    if (last) {
+      last->next = ref;
+    } else {
+      head = ref;
+    }
+
+    last = ref;
+  }
+
+  return head;
+}
+
+void pxe_shared_frame_unref(pxe_buffer_chain* ref) {
+  pxe_shared_frame* frame = ref->buffer->shared;
+
+  ref->next = NULL;
+  pxe_pool_free(frame->owner->refs, ref, 0);
+
+  pxe_shared_frame_release(frame);
+}
+
+void pxe_shared_frame_release(pxe_shared_frame* frame) {
+  if (frame == NULL || --frame->refs > 0) return;
+
+  pxe_shared_pool* owner = frame->owner;
+
+  pxe_pool_free(owner->pool, frame->chain, 1);
+  pxe_pool_free(owner->pool, frame->compressed, 1);
+
+  frame->chain = NULL;
+  frame->compressed = NULL;
+  frame->next = owner->free;
+  owner->free = frame;
+}
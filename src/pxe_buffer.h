@@ -7,10 +7,24 @@
 
 struct pxe_memory_arena;
 
+// Writers leave this much room in front of their first buffer, so a packet's
+// length and id can be put in front of the payload once its size is known.
+// It fits both as VarInts.
+#define PXE_BUFFER_HEADROOM 10
+
 typedef struct pxe_buffer {
   u8* data;
   size_t size;
   size_t max_size;
+  // Room in front of data that isn't counted in max_size. The pool gives it
+  // back when the buffer is reused.
+  size_t headroom;
+  // Set when the data belongs to a shared frame and this is one reference to
+  // it. The buffer is always full so nothing gets appended to it.
+  struct pxe_shared_frame* shared;
+  // The slab the data was carved out of. NULL for buffers without data of
+  // their own.
+  struct pxe_pool_slab* slab;
 } pxe_buffer;
 
 typedef struct pxe_buffer_chain {
@@ -18,16 +32,69 @@ typedef struct pxe_buffer_chain {
   struct pxe_buffer_chain* next;
 } pxe_buffer_chain;
 
+// A packet that's framed once and then queued for any number of sessions.
+// Each session gets its own chain of references to the frame's buffers
+// instead of a copy, and the buffers go back to the pool once the creator and
+// every reference have released them. References are only released when
+// they're freed to the pool the frame came from. Freeing them to any other
+// pool just moves them, like the reactors do before handing sent buffers
+// back, so the count is only ever touched by the thread that owns the pool.
+typedef struct pxe_shared_frame {
+  pxe_buffer_chain* chain;
+  size_t size;
+  // The same packet framed for sessions that use compression. It's made the
+  // first time one of them is sent the frame, so the frame is only ever
+  // deflated once. NULL until then.
+  pxe_buffer_chain* compressed;
+  size_t compressed_size;
+  i32 packet_id;
+  // Bytes of the length and id in front of the payload in chain.
+  size_t header_size;
+  u32 refs;
+  struct pxe_shared_pool* owner;
+  struct pxe_shared_frame* next;
+} pxe_shared_frame;
+
+typedef struct pxe_shared_pool {
+  // Holds the frames' data.
+  pxe_pool* pool;
+  // Buffers without any data of their own that are used as references.
+  pxe_pool* refs;
+  struct pxe_memory_arena* arena;
+  pxe_shared_frame* free;
+} pxe_shared_pool;
+
+// Reads from a chain of buffers. read_pos counts from the start of chain and
+// can be moved directly, but the reader also remembers the buffer it was last
+// in so reads continue from there instead of walking the chain from the start.
+// Use pxe_buffer_reader_reset whenever chain changes.
 typedef struct pxe_buffer_reader {
   size_t read_pos;
   pxe_buffer_chain* chain;
+  // A buffer at or before read_pos and its position in the chain.
+  pxe_buffer_chain* current;
+  size_t current_pos;
 } pxe_buffer_reader;
 
+// A position to go back to when what was being read turns out to be
+// incomplete.
+typedef struct pxe_buffer_reader_snapshot {
+  size_t read_pos;
+  pxe_buffer_chain* current;
+  size_t current_pos;
+} pxe_buffer_reader_snapshot;
+
 typedef struct pxe_buffer_writer {
   pxe_buffer_chain* head;
   pxe_buffer_chain* last;
   pxe_buffer_chain* current;
   size_t relative_write_pos;
+  // Room left from the write position to the end of last, so reserving doesn't
+  // have to walk the chain.
+  size_t capacity;
+  // Bytes that are still expected to be written. New buffers are made large
+  // enough to hold them, up to the largest size class.
+  size_t size_hint;
   pxe_pool* pool;
 } pxe_buffer_writer;
 
@@ -37,6 +104,34 @@ pxe_buffer_chain* pxe_chain_insert(struct pxe_memory_arena* arena,
 
 size_t pxe_buffer_size(pxe_buffer_chain* chain);
 
+void pxe_buffer_reader_reset(pxe_buffer_reader* reader, pxe_buffer_chain* chain,
+                             size_t read_pos);
+
+static inline pxe_buffer_reader_snapshot pxe_buffer_reader_save(
+    pxe_buffer_reader* reader) {
+  pxe_buffer_reader_snapshot snapshot = {reader->read_pos, reader->current,
+                                         reader->current_pos};
+
+  return snapshot;
+}
+
+// The snapshot has to be from the same chain, and the buffers it was taken in
+// can't have been released since.
+static inline void pxe_buffer_reader_rewind(
+    pxe_buffer_reader* reader, pxe_buffer_reader_snapshot* snapshot) {
+  reader->read_pos = snapshot->read_pos;
+  reader->current = snapshot->current;
+  reader->current_pos = snapshot->current_pos;
+}
+
+// Moves past size bytes. Returns 0 without moving if the chain is too short.
+bool32 pxe_buffer_reader_skip(pxe_buffer_reader* reader, size_t size);
+// Returns the next size bytes in contiguous memory and moves past them. They're
+// read in place when they're all in one buffer and copied into arena
+// otherwise. Returns NULL without moving if the chain is too short.
+u8* pxe_buffer_read_contiguous(pxe_buffer_reader* reader, size_t size,
+                               struct pxe_memory_arena* arena);
+
 bool32 pxe_buffer_read_u8(pxe_buffer_reader* reader, u8* out);
 bool32 pxe_buffer_read_u16(pxe_buffer_reader* reader, u16* out);
 bool32 pxe_buffer_read_u32(pxe_buffer_reader* reader, u32* out);
@@ -66,6 +161,45 @@ bool32 pxe_buffer_write_raw_string(pxe_buffer_writer* writer, const char* data,
                                    size_t length);
 
 pxe_buffer_writer pxe_buffer_writer_create(pxe_pool* pool);
+// For writers that know about how much they're going to write, so it goes
+// into as few buffers as possible.
+pxe_buffer_writer pxe_buffer_writer_create_sized(pxe_pool* pool,
+                                                 size_t size_hint);
+// Returns the room left in the writer's current buffer, with at least a byte
+// of it, so it can be written into directly. Nothing counts as written until
+// it's committed. Returns NULL if the pool runs out.
+u8* pxe_buffer_writer_span(pxe_buffer_writer* writer, size_t* size);
+void pxe_buffer_writer_commit(pxe_buffer_writer* writer, size_t size);
+// Puts size bytes into the headroom of the chain's first buffer. Returns 0 and
+// leaves the chain alone if there isn't enough room.
+bool32 pxe_buffer_prepend(pxe_buffer_chain* chain, const u8* data,
+                          size_t size);
+// Writes the packet's length and id into the headroom, turning the payload
+// into a whole frame without another buffer. With compressed set, it's framed
+// as an uncompressed packet of a session that uses compression, which has a
+// Data Length of 0 between the two.
+bool32 pxe_buffer_prepend_header(pxe_buffer_chain* chain, i32 packet_id,
+                                 bool32 compressed);
+
+pxe_shared_pool* pxe_shared_pool_create(struct pxe_memory_arena* perm_arena,
+                                        pxe_pool* pool);
+// Frames the payload with its length and id and takes it over. The header goes
+// in the payload's headroom when there is some, and the payload is only
+// copied if not. Returns NULL if the pool runs out.
+pxe_shared_frame* pxe_shared_frame_create(pxe_shared_pool* pool, i32 packet_id,
+                                          pxe_buffer_chain* payload);
+// Makes the frame's compressed variant if it doesn't have one yet. Returns 0
+// if that fails.
+bool32 pxe_shared_frame_compress(pxe_shared_frame* frame);
+// Returns a new chain of references to the frame for a single send, to its
+// compressed variant if compressed is set.
+pxe_buffer_chain* pxe_shared_frame_ref(pxe_shared_frame* frame,
+                                       bool32 compressed);
+// Drops a single reference, which pxe_pool_free does for each one freed to
+// the frame's pool.
+void pxe_shared_frame_unref(pxe_buffer_chain* ref);
+// Drops the creator's hold on the frame. NULL is ignored.
+void pxe_shared_frame_release(pxe_shared_frame* frame);
 
 inline size_t pxe_buffer_chain_count(pxe_buffer_chain* chain) {
   size_t count = 0;
@@ -0,0 +1,205 @@
+#include "pxe_compress.h"
+
+#include "pxe_varint.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#ifdef _MSC_VER
+#define PXE_THREAD_LOCAL __declspec(thread)
+#else
+#define PXE_THREAD_LOCAL _Thread_local
+#endif
+
+// zlib's streams are expensive to set up, so each thread keeps one of each
+// for as long as it runs and resets them between packets.
+typedef struct pxe_compressor {
+  z_stream deflate;
+  z_stream inflate;
+  bool32 deflate_ready;
+  bool32 inflate_ready;
+  // Where packets are inflated to. It grows to the largest packet inflated so
+  // far.
+  u8* inflated;
+  size_t inflated_size;
+} pxe_compressor;
+
+static PXE_THREAD_LOCAL pxe_compressor pxe_thread_compressor;
+
+static z_stream* pxe_compress_deflate_stream(void) {
+  pxe_compressor* compressor = &pxe_thread_compressor;
+
+  if (compressor->deflate_ready) {
+    deflateReset(&compressor->deflate);
+  } else {
+    memset(&compressor->deflate, 0, sizeof(compressor->deflate));
+
+    if (deflateInit(&compressor->deflate, PXE_COMPRESSION_LEVEL) != Z_OK) {
+      fprintf(stderr, "Failed to create deflate stream.\n");
+      return NULL;
+    }
+
+    compressor->deflate_ready = 1;
+  }
+
+  return &compressor->deflate;
+}
+
+static z_stream* pxe_compress_inflate_stream(void) {
+  pxe_compressor* compressor = &pxe_thread_compressor;
+
+  if (compressor->inflate_ready) {
+    inflateReset(&compressor->inflate);
+  } else {
+    memset(&compressor->inflate, 0, sizeof(compressor->inflate));
+
+    if (inflateInit(&compressor->inflate) != Z_OK) {
+      fprintf(stderr, "Failed to create inflate stream.\n");
+      return NULL;
+    }
+
+    compressor->inflate_ready = 1;
+  }
+
+  return &compressor->inflate;
+}
+
+// Feeds size bytes to the stream and writes out whatever it produces. The last
+// input finishes the stream.
+static bool32 pxe_compress_deflate(z_stream* stream, pxe_buffer_writer* writer,
+                                   const u8* data, size_t size, bool32 last) {
+  int flush = last ? Z_FINISH : Z_NO_FLUSH;
+
+  stream->next_in = (Bytef*)data;
+  stream->avail_in = (uInt)size;
+
+  while (1) {
+    size_t room;
+    u8* out = pxe_buffer_writer_span(writer, &room);
+
+    if (out == NULL) return 0;
+
+    stream->next_out = out;
+    stream->avail_out = (uInt)room;
+
+    int result = deflate(stream, flush);
+
+    if (result == Z_STREAM_ERROR) return 0;
+
+    pxe_buffer_writer_commit(writer, room - stream->avail_out);
+
+    if (last ? result == Z_STREAM_END : stream->avail_out > 0) break;
+  }
+
+  return 1;
+}
+
+pxe_buffer_chain* pxe_compress_frame(pxe_pool* pool, i32 packet_id,
+                                     pxe_buffer_chain* payload, size_t offset) {
+  u8 id[5];
+  size_t id_size = pxe_varint_write(packet_id, (char*)id);
+  size_t size = id_size + pxe_buffer_size(payload) - offset;
+
+  if ((i64)size < PXE_COMPRESSION_THRESHOLD) {
+    pxe_buffer_writer writer = pxe_buffer_writer_create_sized(pool, size + 4);
+    bool32 written = pxe_buffer_write_varint(&writer, (i32)size + 1) &&
+                     pxe_buffer_write_u8(&writer, 0) &&
+                     pxe_buffer_write_raw_string(&writer, (char*)id, id_size);
+
+    for (pxe_buffer_chain* chain = payload; chain && written;
+         chain = chain->next) {
+      pxe_buffer* buffer = chain->buffer;
+
+      if (offset >= buffer->size) {
+        offset -= buffer->size;
+        continue;
+      }
+
+      written = pxe_buffer_write_raw_string(
+          &writer, (char*)buffer->data + offset, buffer->size - offset);
+      offset = 0;
+    }
+
+    if (!written) {
+      pxe_pool_free(pool, writer.head, 1);
+      return NULL;
+    }
+
+    return writer.head;
+  }
+
+  z_stream* stream = pxe_compress_deflate_stream();
+
+  if (stream == NULL) return NULL;
+
+  // Chunk data deflates to a small fraction of its size. Packets that don't
+  // shrink as much just go on into more buffers.
+  pxe_buffer_writer writer =
+      pxe_buffer_writer_create_sized(pool, size / 8 + 64);
+  bool32 written = pxe_compress_deflate(stream, &writer, id, id_size, 0);
+
+  for (pxe_buffer_chain* chain = payload; chain && written;
+       chain = chain->next) {
+    pxe_buffer* buffer = chain->buffer;
+
+    if (offset >= buffer->size) {
+      offset -= buffer->size;
+      continue;
+    }
+
+    written = pxe_compress_deflate(stream, &writer, buffer->data + offset,
+                                   buffer->size - offset, 0);
+    offset = 0;
+  }
+
+  written = written && pxe_compress_deflate(stream, &writer, NULL, 0, 1);
+
+  // The header goes in the headroom the writer left in front, since the
+  // length isn't known until everything is deflated.
+  u8 header[10];
+  size_t header_size =
+      pxe_varint_write((i32)(pxe_varint_size((i32)size) + stream->total_out),
+                       (char*)header);
+
+  header_size += pxe_varint_write((i32)size, (char*)header + header_size);
+
+  if (!written || !pxe_buffer_prepend(writer.head, header, header_size)) {
+    fprintf(stderr, "Failed to compress packet %d.\n", packet_id);
+    pxe_pool_free(pool, writer.head, 1);
+    return NULL;
+  }
+
+  return writer.head;
+}
+
+u8* pxe_compress_inflate(const u8* data, size_t size, size_t inflated_size) {
+  pxe_compressor* compressor = &pxe_thread_compressor;
+
+  if (inflated_size > compressor->inflated_size) {
+    u8* inflated = realloc(compressor->inflated, inflated_size);
+
+    if (inflated == NULL) return NULL;
+
+    compressor->inflated = inflated;
+    compressor->inflated_size = inflated_size;
+  }
+
+  z_stream* stream = pxe_compress_inflate_stream();
+
+  if (stream == NULL) return NULL;
+
+  stream->next_in = (Bytef*)data;
+  stream->avail_in = (uInt)size;
+  stream->next_out = compressor->inflated;
+  stream->avail_out = (uInt)inflated_size;
+
+  // Anything that doesn't end exactly at inflated_size is rejected, including
+  // data that would inflate past it.
+  if (inflate(stream, Z_FINISH) != Z_STREAM_END || stream->avail_out != 0) {
+    return NULL;
+  }
+
+  return compressor->inflated;
+}
@@ -0,0 +1,37 @@
+#ifndef PIXIE_COMPRESS_H_
+#define PIXIE_COMPRESS_H_
+
+#include "pixie.h"
+#include "pxe_alloc.h"
+#include "pxe_buffer.h"
+
+// Packets whose id and data come to at least this many bytes are deflated
+// once a session is told to use compression. The login sends it to every
+// player unless it's negative, which leaves compression off.
+#ifndef PXE_COMPRESSION_THRESHOLD
+#define PXE_COMPRESSION_THRESHOLD 256
+#endif
+
+// zlib level from 1 to 9, where 6 is zlib's default. Chunk data is the bulk
+// of what's deflated and it's only deflated once, so a higher level mostly
+// costs on the packets that are built for each session.
+#ifndef PXE_COMPRESSION_LEVEL
+#define PXE_COMPRESSION_LEVEL 6
+#endif
+
+// Largest a received packet can inflate to, which is the vanilla limit too.
+#define PXE_COMPRESSION_MAX_INFLATED_SIZE pxe_megabytes(2)
+
+// Frames a packet the way it's sent once compression is on. Packets of at
+// least the threshold are deflated and smaller ones only get a Data Length of
+// 0 in front of their id. The payload is read from offset in the chain and
+// left alone. Returns NULL if the pool runs out or zlib fails.
+pxe_buffer_chain* pxe_compress_frame(pxe_pool* pool, i32 packet_id,
+                                     pxe_buffer_chain* payload, size_t offset);
+
+// Inflates a received packet that has to come out at exactly inflated_size
+// bytes. The result is in memory that belongs to the calling thread and is
+// reused by its next inflate. Returns NULL if the data isn't valid.
+u8* pxe_compress_inflate(const u8* data, size_t size, size_t inflated_size);
+
+#endif
@@ -0,0 +1,59 @@
+#include "pxe_frame.h"
+
+#include "pxe_varint.h"
+
+i32 pxe_frame_read_varint(pxe_frame* frame) {
+  size_t available = pxe_frame_remaining(frame);
+  i32 value;
+
+  size_t size =
+      pxe_varint_read((char*)frame->data + frame->pos, available, &value);
+
+  if (size == 0) {
+    frame->pos = frame->size;
+    frame->overflow = 1;
+    return 0;
+  }
+
+  frame->pos += size;
+
+  return value;
+}
+
+i64 pxe_frame_read_varlong(pxe_frame* frame) {
+  size_t available = pxe_frame_remaining(frame);
+  i64 value;
+
+  size_t size =
+      pxe_varlong_read((char*)frame->data + frame->pos, available, &value);
+
+  if (size == 0) {
+    frame->pos = frame->size;
+    frame->overflow = 1;
+    return 0;
+  }
+
+  frame->pos += size;
+
+  return value;
+}
+
+pxe_string_view pxe_frame_read_string(pxe_frame* frame, size_t max_size) {
+  i32 length = pxe_frame_read_varint(frame);
+  pxe_string_view view = {"", 0};
+
+  if (length < 0 || (size_t)length > max_size) {
+    frame->pos = frame->size;
+    frame->overflow = 1;
+    return view;
+  }
+
+  const u8* data = pxe_frame_take(frame, (size_t)length);
+
+  if (data) {
+    view.data = (const char*)data;
+    view.size = (size_t)length;
+  }
+
+  return view;
+}
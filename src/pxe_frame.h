@@ -0,0 +1,120 @@
+#ifndef PIXIE_FRAME_H_
+#define PIXIE_FRAME_H_
+
+#include "pixie.h"
+
+#include <string.h>
+
+// Reads the fields of a packet that's entirely in contiguous memory. Reading
+// past the end returns zeros and sets overflow instead of failing, so a
+// handler can read all of its fields and check overflow once at the end.
+typedef struct pxe_frame {
+  const u8* data;
+  size_t size;
+  size_t pos;
+  bool32 overflow;
+} pxe_frame;
+
+static inline pxe_frame pxe_frame_create(const u8* data, size_t size) {
+  pxe_frame frame = {data, size, 0, 0};
+
+  return frame;
+}
+
+static inline size_t pxe_frame_remaining(pxe_frame* frame) {
+  return frame->size - frame->pos;
+}
+
+// Returns a pointer to the next size bytes and moves past them. Returns NULL
+// and sets overflow if there aren't that many left.
+static inline const u8* pxe_frame_take(pxe_frame* frame, size_t size) {
+  if (pxe_frame_remaining(frame) < size) {
+    frame->pos = frame->size;
+    frame->overflow = 1;
+    return NULL;
+  }
+
+  const u8* data = frame->data + frame->pos;
+
+  frame->pos += size;
+
+  return data;
+}
+
+// Moves past a fixed-size field that isn't used. It still overflows the frame
+// if there aren't that many bytes left.
+static inline void pxe_frame_skip(pxe_frame* frame, size_t size) {
+  pxe_frame_take(frame, size);
+}
+
+static inline u8 pxe_frame_read_u8(pxe_frame* frame) {
+  const u8* data = pxe_frame_take(frame, sizeof(u8));
+
+  return data ? *data : 0;
+}
+
+static inline u16 pxe_frame_read_u16(pxe_frame* frame) {
+  const u8* data = pxe_frame_take(frame, sizeof(u16));
+  u16 value = 0;
+
+  if (data) {
+    memcpy(&value, data, sizeof(value));
+  }
+
+  return bswap_16(value);
+}
+
+static inline u32 pxe_frame_read_u32(pxe_frame* frame) {
+  const u8* data = pxe_frame_take(frame, sizeof(u32));
+  u32 value = 0;
+
+  if (data) {
+    memcpy(&value, data, sizeof(value));
+  }
+
+  return bswap_32(value);
+}
+
+static inline u64 pxe_frame_read_u64(pxe_frame* frame) {
+  const u8* data = pxe_frame_take(frame, sizeof(u64));
+  u64 value = 0;
+
+  if (data) {
+    memcpy(&value, data, sizeof(value));
+  }
+
+  return bswap_64(value);
+}
+
+static inline float pxe_frame_read_float(pxe_frame* frame) {
+  u32 int_rep = pxe_frame_read_u32(frame);
+  float value;
+
+  memcpy(&value, &int_rep, sizeof(value));
+
+  return value;
+}
+
+static inline double pxe_frame_read_double(pxe_frame* frame) {
+  u64 int_rep = pxe_frame_read_u64(frame);
+  double value;
+
+  memcpy(&value, &int_rep, sizeof(value));
+
+  return value;
+}
+
+// Points into the frame, so it's only valid as long as the packet is and it
+// isn't null-terminated.
+typedef struct pxe_string_view {
+  const char* data;
+  size_t size;
+} pxe_string_view;
+
+i32 pxe_frame_read_varint(pxe_frame* frame);
+i64 pxe_frame_read_varlong(pxe_frame* frame);
+// Reads a length-prefixed string without copying it. Strings longer than
+// max_size overflow the frame and come back empty.
+pxe_string_view pxe_frame_read_string(pxe_frame* frame, size_t max_size);
+
+#endif
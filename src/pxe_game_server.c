@@ -3,7 +3,12 @@
 #include "protocol/pxe_protocol_play.h"
 #include "pxe_alloc.h"
 #include "pxe_buffer.h"
+#include "pxe_compress.h"
+#include "pxe_frame.h"
+#include "pxe_handoff.h"
+#include "pxe_io_uring.h"
 #include "pxe_nbt.h"
+#include "pxe_reactor.h"
 #include "pxe_varint.h"
 
 #include <math.h>
@@ -15,11 +20,14 @@
 #include <time.h>
 #endif
 
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
 // Must be at least 8
 #define PXE_READ_BUFFER_SIZE 64
 #define PXE_WRITE_BUFFER_SIZE 512
 #define PXE_OUTPUT_CONNECTIONS 0
-#define PXE_BUFFER_CHAIN_PACKET 0
 
 //#define PXE_TEST_CHUNK_PALETTE
 
@@ -29,11 +37,12 @@ typedef enum {
   PXE_PROCESS_RESULT_DESTROY,
 } pxe_process_result;
 
-static const char pxe_ping_response[] =
-    "{\"version\": { \"name\": \"1.14.4\", \"protocol\": 498 }, \"players\": "
-    "{\"max\": 420, \"online\": 69, \"sample\": [{\"name\": \"plushmonkey\", "
-    "\"id\": \"e812180e-a8aa-4c9f-a8b3-07f591b8de20\"}]}, \"description\": "
-    "{\"text\": \"pixie server\"}}";
+// The players object goes between these two.
+static const char pxe_status_response_start[] =
+    "{\"version\": { \"name\": \"1.14.4\", \"protocol\": 498 }, "
+    "\"players\": ";
+static const char pxe_status_response_end[] =
+    ", \"description\": {\"text\": \"pixie server\"}}";
 static const char pxe_login_response[] =
     "{\"text\": \"pixie server has no implemented game server.\"}";
 static const char pxe_server_brand[] = "pixie";
@@ -48,92 +57,99 @@ static const u32 pxe_chunk_palette[] = {0, 33, 132, 126, 141};
 static const u32 pxe_chunk_palette[4096];
 #endif
 
-void pxe_send_packet_chain(pxe_socket* socket, pxe_memory_arena* arena, pxe_pool* pool,
-                           i32 packet_id, pxe_buffer_chain* chain, bool32 free) {
-  pxe_buffer_writer writer = pxe_buffer_writer_create(pool);
-
+void pxe_send_packet_chain(pxe_session* session, pxe_memory_arena* arena,
+                           pxe_pool* pool, i32 packet_id,
+                           pxe_buffer_chain* chain, bool32 free) {
+  bool32 compressed = session->compressed;
   size_t payload_size = pxe_buffer_size(chain);
 
-  // Write total length of payload plus the varint that encodes it.
+  // Total length of id and payload, which is what gets deflated.
   i32 length = (i32)(pxe_varint_size(packet_id) + payload_size);
 
-  pxe_buffer_write_varint(&writer, length);
+  if (compressed && length >= PXE_COMPRESSION_THRESHOLD) {
+    pxe_buffer_chain* frame = pxe_compress_frame(pool, packet_id, chain, 0);
+
+    if (free) {
+      pxe_pool_free(pool, chain, 1);
+    }
+
+    if (frame) {
+      pxe_session_send_chain(session, arena, pool, frame, 1);
+    } else {
+      // The client can't make sense of anything sent after a missing packet.
+      pxe_session_fail(session);
+    }
+    return;
+  }
+
+  if (free && chain &&
+      pxe_buffer_prepend_header(chain, packet_id, compressed)) {
+    // The header fit in front of the payload, so it's already a whole frame.
+    pxe_session_send_chain(session, arena, pool, chain, 1);
+    return;
+  }
+
+  pxe_buffer_writer writer = pxe_buffer_writer_create(pool);
+
+  if (compressed) {
+    // A Data Length of 0 marks the packet as not compressed.
+    pxe_buffer_write_varint(&writer, length + 1);
+    pxe_buffer_write_u8(&writer, 0);
+  } else {
+    pxe_buffer_write_varint(&writer, length);
+  }
+
   pxe_buffer_write_varint(&writer, packet_id);
 
   pxe_buffer_chain* last = writer.last;
   writer.last->next = chain;
 
-  pxe_socket_send_chain(socket, arena, writer.head);
-
   if (free) {
-    // Free the entire chain including header/payload.
-    pxe_pool_free(pool, writer.head, 1);
+    // The session takes the entire chain including header/payload.
+    pxe_session_send_chain(session, arena, pool, writer.head, 1);
   } else {
+    pxe_session_send_chain(session, arena, pool, writer.head, 0);
+
     last->next = NULL;
     // Free just the header.
     pxe_pool_free(pool, writer.head, 1);
   }
 }
 
-void pxe_send_packet(pxe_socket* socket, pxe_memory_arena* arena, i32 packet_id,
-                     pxe_buffer* buffer) {
+void pxe_send_packet(pxe_session* session, pxe_memory_arena* arena,
+                     pxe_pool* pool, i32 packet_id, pxe_buffer* buffer) {
   if (buffer == NULL) {
     fprintf(stderr, "Packet %d was null when sending.\n", packet_id);
     return;
   }
 
-#if PXE_BUFFER_CHAIN_PACKET
-  pxe_buffer_writer writer = pxe_buffer_writer_create(arena, 0);
-
-  // Write total length of payload plus the varint that encodes it.
-  i32 length = (i32)(pxe_varint_size(packet_id) + buffer->size);
-
-  pxe_buffer_push_varint(&writer, length, arena);
-  pxe_buffer_push_varint(&writer, packet_id, arena);
-
-  pxe_buffer_chain header;
-  pxe_buffer_chain payload;
-
-  header.buffer = writer.buffer;
-  header.next = &payload;
-
-  payload.next = NULL;
-  payload.buffer = buffer;
-
-  pxe_socket_send_chain(socket, arena, &header);
-
-#else
-  size_t size = buffer->size;
-  size_t id_size = pxe_varint_size(packet_id);
-  size_t length_size = pxe_varint_size((i32)(size + id_size));
-  char* pkt = pxe_arena_alloc(arena, length_size + id_size + size);
-
-  size_t index = 0;
-
-  index += pxe_varint_write((i32)(size + id_size), pkt + index);
-  index += pxe_varint_write(packet_id, pkt + index);
-
-  char* payload = pkt + index;
-
-  for (size_t i = 0; i < size; ++i) {
-    payload[i] = buffer->data[i];
-  }
-
-  index += size;
+  pxe_buffer_chain packet_chain;
+  packet_chain.buffer = buffer;
+  packet_chain.next = NULL;
 
-  pxe_socket_send(socket, pkt, index);
-#endif
+  // The buffer isn't taken over, so anything unsent gets copied to the pool.
+  pxe_send_packet_chain(session, arena, pool, packet_id, &packet_chain, 0);
 }
 
 void pxe_game_server_wsa_poll(pxe_game_server* game_server,
                               pxe_socket* listen_socket,
                               pxe_memory_arena* perm_arena,
-                              pxe_memory_arena* trans_arena);
+                              pxe_memory_arena* trans_arena, i32 timeout_ms);
 
 void pxe_game_server_epoll(pxe_game_server* game_server,
                            pxe_socket* listen_socket,
                            pxe_memory_arena* perm_arena,
-                           pxe_memory_arena* trans_arena);
+                           pxe_memory_arena* trans_arena, i32 timeout_ms);
+
+void pxe_game_server_io_uring(pxe_game_server* game_server,
+                              pxe_memory_arena* perm_arena,
+                              pxe_memory_arena* trans_arena, i32 timeout_ms);
+
+void pxe_game_server_poll_reactors(pxe_game_server* game_server,
+                                   pxe_memory_arena* perm_arena,
+                                   pxe_memory_arena* trans_arena,
+                                   i32 timeout_ms);
+
 i64 pxe_get_time_ms() {
 #ifdef _WIN32
   return GetTickCount64();
@@ -145,6 +161,28 @@ i64 pxe_get_time_ms() {
 #endif
 }
 
+i64 pxe_get_time_us() {
+#ifdef _WIN32
+  LARGE_INTEGER frequency, counter;
+
+  QueryPerformanceFrequency(&frequency);
+  QueryPerformanceCounter(&counter);
+
+  return (i64)(counter.QuadPart * 1000000 / frequency.QuadPart);
+#else
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+
+  return time.tv_sec * 1000000LL + time.tv_nsec / 1000;
+#endif
+}
+
+// Adds the time since wait_start to the idle time.
+void pxe_game_server_record_wait(pxe_game_server* server, i64 wait_start) {
+  ++server->stats.wakeups;
+  server->stats.idle_us += (u64)(pxe_get_time_us() - wait_start);
+}
+
 void pxe_strcpy(char* dest, char* src) {
   while (*src) {
     *dest++ = *src++;
@@ -152,38 +190,146 @@ void pxe_strcpy(char* dest, char* src) {
   *dest = *src;
 }
 
-bool32 pxe_game_broadcast(pxe_game_server* server, int pkt_id,
-                          pxe_buffer_chain* buffer, pxe_memory_arena* trans_arena) {
-  for (size_t i = 0; i < server->session_count; ++i) {
-    pxe_session* session = server->sessions + i;
+// Frames a packet that goes to many sessions and takes over the payload.
+static pxe_shared_frame* pxe_game_frame_broadcast(pxe_game_server* server,
+                                                  int pkt_id,
+                                                  pxe_buffer_chain* buffer) {
+  pxe_shared_frame* frame =
+      pxe_shared_frame_create(server->shared_pool, pkt_id, buffer);
+
+  if (frame == NULL) {
+    fprintf(stderr, "Failed to frame broadcast packet %d.\n", pkt_id);
+  }
+
+  return frame;
+}
+
+// Writes text as a JSON string. Quotes and backslashes are escaped and control
+// characters are replaced, so a name can't break out of the string. out needs
+// room for twice the text plus the quotes.
+static size_t pxe_game_write_json_string(char* out, const char* text) {
+  size_t size = 0;
+
+  out[size++] = '"';
+
+  for (; *text; ++text) {
+    char c = *text;
 
-    if (session->protocol_state != PXE_PROTOCOL_STATE_PLAY) continue;
+    if (c == '"' || c == '\\') {
+      out[size++] = '\\';
+      out[size++] = c;
+    } else if ((u8)c < 0x20) {
+      out[size++] = '?';
+    } else {
+      out[size++] = c;
+    }
+  }
+
+  out[size++] = '"';
 
-    pxe_send_packet_chain(&session->socket, trans_arena, server->write_pool, pkt_id, buffer, 0);
+  return size;
+}
+
+// Returns the status response frame, building it first if a player joined or
+// left since the last one. The player count comes from the session index and
+// the sample is the first players in the session table.
+static pxe_shared_frame* pxe_game_server_status_frame(pxe_game_server* server) {
+  if (!server->status_stale && server->status_frame) {
+    return server->status_frame;
   }
 
-  pxe_pool_free(server->write_pool, buffer, 1);
+  // Each sample entry is at most a 36 character uuid and an escaped name.
+  char json[512 + PXE_GAME_SERVER_STATUS_SAMPLE_SIZE * 128];
+  size_t size = 0;
+  size_t sampled = 0;
 
-  return 1;
+  memcpy(json, pxe_status_response_start,
+         pxe_array_string_size(pxe_status_response_start));
+  size += pxe_array_string_size(pxe_status_response_start);
+
+  size += sprintf_s(json + size, pxe_array_size(json) - size,
+                    "{\"max\": %d, \"online\": %zu, \"sample\": [",
+                    PXE_GAME_SERVER_MAX_SESSIONS,
+                    server->sessions_by_eid.count);
+
+  for (size_t i = 0; i < server->session_count &&
+                     sampled < PXE_GAME_SERVER_STATUS_SAMPLE_SIZE;
+       ++i) {
+    pxe_session* session = pxe_game_server_session(server, i);
+
+    if (session->hot->protocol_state != PXE_PROTOCOL_STATE_PLAY) continue;
+
+    char uuid[37];
+
+    pxe_uuid_to_string(&session->uuid, uuid, 1);
+
+    if (sampled++ > 0) {
+      json[size++] = ',';
+      json[size++] = ' ';
+    }
+
+    size += sprintf_s(json + size, pxe_array_size(json) - size,
+                      "{\"id\": \"%s\", \"name\": ", uuid);
+    size += pxe_game_write_json_string(json + size, session->username);
+    json[size++] = '}';
+  }
+
+  json[size++] = ']';
+  json[size++] = '}';
+
+  memcpy(json + size, pxe_status_response_end,
+         pxe_array_string_size(pxe_status_response_end));
+  size += pxe_array_string_size(pxe_status_response_end);
+
+  pxe_buffer_writer writer = pxe_buffer_writer_create_sized(
+      server->write_pool, pxe_varint_size((i32)size) + size);
+
+  if (!pxe_buffer_write_length_string(&writer, json, size)) {
+    pxe_pool_free(server->write_pool, writer.head, 1);
+    return server->status_frame;
+  }
+
+  pxe_shared_frame* frame = pxe_game_frame_broadcast(
+      server, PXE_PROTOCOL_OUTBOUND_STATUS_RESPONSE, writer.head);
+
+  if (frame == NULL) return server->status_frame;
+
+  // Pings that are still sending the old frame hold their own references.
+  pxe_shared_frame_release(server->status_frame);
+
+  server->status_frame = frame;
+  server->status_stale = 0;
+
+  return frame;
 }
 
 bool32 pxe_game_broadcast_except(pxe_game_server* server, pxe_session* except,
                                  int pkt_id, pxe_buffer_chain* buffer,
                                  pxe_memory_arena* trans_arena) {
+  pxe_shared_frame* frame = pxe_game_frame_broadcast(server, pkt_id, buffer);
+
+  if (frame == NULL) return 0;
+
   for (size_t i = 0; i < server->session_count; ++i) {
-    pxe_session* session = server->sessions + i;
+    pxe_session_hot* hot = pxe_game_server_session_hot(server, i);
+    pxe_session* session = pxe_game_server_session(server, i);
 
     if (session == except) continue;
-    if (session->protocol_state != PXE_PROTOCOL_STATE_PLAY) continue;
+    if (hot->protocol_state != PXE_PROTOCOL_STATE_PLAY) continue;
 
-    pxe_send_packet_chain(&session->socket, trans_arena, server->write_pool, pkt_id, buffer, 0);
+    pxe_session_send_shared(session, trans_arena, server->write_pool, frame);
   }
 
-  pxe_pool_free(server->write_pool, buffer, 1);
+  pxe_shared_frame_release(frame);
 
   return 1;
 }
 
+bool32 pxe_game_broadcast(pxe_game_server* server, int pkt_id,
+                          pxe_buffer_chain* buffer, pxe_memory_arena* trans_arena) {
+  return pxe_game_broadcast_except(server, NULL, pkt_id, buffer, trans_arena);
+}
+
 bool32 pxe_game_create_heightmap_nbt(pxe_nbt_tag_compound** root,
                                      pxe_memory_arena* trans_arena) {
   static const char motion_blocking[] = "MOTION_BLOCKING";
@@ -290,7 +436,7 @@ pxe_buffer_chain* pxe_game_encode_chunk_data(pxe_memory_arena* perm_arena,
   return chain;
 }
 
-pxe_buffer_chain* pxe_game_create_palette(pxe_pool* pool, size_t* size) {
+bool32 pxe_game_write_palette(pxe_buffer_writer* writer, size_t* size) {
   size_t palette_length = pxe_array_size(pxe_chunk_palette);
 
   *size = pxe_varint_size((i32)palette_length);
@@ -299,19 +445,17 @@ pxe_buffer_chain* pxe_game_create_palette(pxe_pool* pool, size_t* size) {
     *size += pxe_varint_size((i32)pxe_chunk_palette[i]);
   }
 
-  pxe_buffer_writer writer = pxe_buffer_writer_create(pool);
-
-  if (pxe_buffer_write_varint(&writer, (i32)palette_length) == 0) {
+  if (pxe_buffer_write_varint(writer, (i32)palette_length) == 0) {
     return 0;
   }
 
   for (size_t i = 0; i < palette_length; ++i) {
-    if (pxe_buffer_write_varint(&writer, (i32)pxe_chunk_palette[i]) == 0) {
+    if (pxe_buffer_write_varint(writer, (i32)pxe_chunk_palette[i]) == 0) {
       return 0;
     }
   }
 
-  return writer.head;
+  return 1;
 }
 
 pxe_buffer_chain* pxe_game_create_chunk_section(pxe_pool* pool,
@@ -324,23 +468,16 @@ pxe_buffer_chain* pxe_game_create_chunk_section(pxe_pool* pool,
       perm_arena, &encoded_data_size, &bits_per_block);
 
   size_t palette_size = 0;
-  pxe_buffer_chain* palette_chain = NULL;
-
-  if (bits_per_block < 9) {
-    palette_chain = pxe_game_create_palette(pool, &palette_size);
-  }
-
   size_t encoded_count = encoded_data_size / sizeof(u64);
-  pxe_buffer_writer writer = pxe_buffer_writer_create(pool);
+  // The palette is small, so this is enough to get one buffer for all of it.
+  pxe_buffer_writer writer =
+      pxe_buffer_writer_create_sized(pool, encoded_data_size + 64);
 
   pxe_buffer_write_u16(&writer, 16 * 16);
   pxe_buffer_write_u8(&writer, bits_per_block);
 
   if (bits_per_block < 9) {
-    writer.current->next = palette_chain;
-    writer.current = palette_chain;
-    writer.last = palette_chain;
-    writer.relative_write_pos = palette_chain->buffer->size;
+    pxe_game_write_palette(&writer, &palette_size);
   }
 
   pxe_buffer_write_varint(&writer, (i32)encoded_count);
@@ -350,19 +487,18 @@ pxe_buffer_chain* pxe_game_create_chunk_section(pxe_pool* pool,
                               encoded_data_size);
 
   *size = encoded_data_size + palette_size + sizeof(u16) + sizeof(u8) + pxe_varint_size((i32)encoded_count);
-  size_t test = pxe_buffer_size(writer.head);
-  
+
   pxe_pool_free(chunk_pool, data_chain, 1);
 
   return writer.head;
 }
 
-// TODO: This should probably be generated with buffer_chains to minimize
-// copying
-bool32 pxe_game_send_chunk_data(pxe_session* session, pxe_pool* pool,
-                                pxe_memory_arena* perm_arena,
-                                pxe_memory_arena* trans_arena, i32 chunk_x,
-                                i32 chunk_z, bool32 blank) {
+// Returns the payload of a Chunk Data packet or NULL if it couldn't be built.
+pxe_buffer_chain* pxe_game_create_chunk_data(pxe_pool* pool,
+                                             pxe_memory_arena* perm_arena,
+                                             pxe_memory_arena* trans_arena,
+                                             i32 chunk_x, i32 chunk_z,
+                                             bool32 blank) {
   char* heightmap_data = NULL;
   size_t heightmap_size = 0;
 
@@ -376,12 +512,12 @@ bool32 pxe_game_send_chunk_data(pxe_session* session, pxe_pool* pool,
   pxe_nbt_tag_compound* heightmap;
 
   if (pxe_game_create_heightmap_nbt(&heightmap, trans_arena) == 0) {
-    return 0;
+    return NULL;
   }
 
-  if (pxe_nbt_write(heightmap, trans_arena, &heightmap_data, &heightmap_size) ==
-      0) {
-    return 0;
+  if (pxe_nbt_write(heightmap, trans_arena, pool, &heightmap_data,
+                    &heightmap_size) == 0) {
+    return NULL;
   }
 
   size_t chunk_section_size;
@@ -400,49 +536,43 @@ bool32 pxe_game_send_chunk_data(pxe_session* session, pxe_pool* pool,
   size += total_chunk_data_size;
   size += pxe_varint_size(block_entity_count);
 
-  pxe_buffer_writer writer = pxe_buffer_writer_create(pool);
+  pxe_buffer_writer writer = pxe_buffer_writer_create_sized(pool, size);
 
   if (pxe_buffer_write_u32(&writer, chunk_x) == 0) {
-    return 0;
+    return NULL;
   }
 
   if (pxe_buffer_write_u32(&writer, chunk_z) == 0) {
-    return 0;
+    return NULL;
   }
 
   if (pxe_buffer_write_u8(&writer, (u8)full_chunk) == 0) {
-    return 0;
+    return NULL;
   }
 
   if (pxe_buffer_write_varint(&writer, bitmask) == 0) {
-    return 0;
+    return NULL;
   }
 
   if (pxe_buffer_write_raw_string(&writer, heightmap_data, heightmap_size) ==
       0) {
-    return 0;
+    return NULL;
   }
 
   if (pxe_buffer_write_varint(&writer, (i32)total_chunk_data_size) == 0) {
-    return 0;
+    return NULL;
   }
 
   for (size_t i = 0; i < chunk_section_count; ++i) {
     pxe_buffer_chain* current_section = section_chain;
-    
-    while (current_section) {
-      pxe_buffer_chain* current_chain = pxe_pool_alloc(pool);
 
+    while (current_section) {
       // TODO: avoid copy
-      memcpy(current_chain->buffer->data, current_section->buffer->data,
-        current_section->buffer->size);
-
-      current_chain->buffer->size = current_section->buffer->size;
-
-      writer.current->next = current_chain;
-      writer.current = current_chain;
-      writer.last = current_chain;
-      writer.relative_write_pos = current_chain->buffer->size;
+      if (pxe_buffer_write_raw_string(
+              &writer, (char*)current_section->buffer->data,
+              current_section->buffer->size) == 0) {
+        return NULL;
+      }
 
       current_section = current_section->next;
     }
@@ -452,18 +582,62 @@ bool32 pxe_game_send_chunk_data(pxe_session* session, pxe_pool* pool,
 
   for (size_t i = 0; i < 256; ++i) {
     if (pxe_buffer_write_u32(&writer, 0) == 0) {
-      return 0;
+      return NULL;
     }
   }
 
   if (pxe_buffer_write_varint(&writer, block_entity_count) == 0) {
-    return 0;
+    return NULL;
   }
 
-  pxe_send_packet_chain(&session->socket, trans_arena, pool,
-                        PXE_PROTOCOL_OUTBOUND_PLAY_CHUNK_DATA, writer.head, 1);
+  return writer.head;
+}
 
-  return 1;
+// Returns the Chunk Data frame for a spawn chunk, building it the first time.
+static pxe_shared_frame* pxe_game_server_chunk_frame(
+    pxe_game_server* server, u32 index, pxe_memory_arena* perm_arena,
+    pxe_memory_arena* trans_arena) {
+  if (server->chunk_frames[index]) return server->chunk_frames[index];
+
+  i32 radius = PXE_GAME_SERVER_VIEW_RADIUS;
+  i32 x = (i32)(index % PXE_GAME_SERVER_VIEW_DIAMETER) - radius;
+  i32 z = (i32)(index / PXE_GAME_SERVER_VIEW_DIAMETER) - radius;
+
+  float r = (float)(x * x + z * z);
+  bool32 blank = r > 3.5f * 3.5f;
+
+  pxe_buffer_chain* payload = pxe_game_create_chunk_data(
+      server->write_pool, perm_arena, trans_arena, x, z, blank);
+
+  if (payload == NULL) return NULL;
+
+  server->chunk_frames[index] = pxe_game_frame_broadcast(
+      server, PXE_PROTOCOL_OUTBOUND_PLAY_CHUNK_DATA, payload);
+
+  return server->chunk_frames[index];
+}
+
+// Sends the session's remaining spawn chunks until its output backs up. The
+// rest go out on later ticks once the client has caught up.
+void pxe_game_stream_chunks(pxe_game_server* server, pxe_session* session,
+                            pxe_memory_arena* perm_arena,
+                            pxe_memory_arena* trans_arena) {
+  while (session->hot->chunks_remaining > 0 &&
+         pxe_session_write_queued(session) < PXE_SESSION_WRITE_SOFT_LIMIT) {
+    u32 index = PXE_GAME_SERVER_SPAWN_CHUNKS - session->hot->chunks_remaining--;
+    pxe_shared_frame* frame =
+        pxe_game_server_chunk_frame(server, index, perm_arena, trans_arena);
+
+    if (frame == NULL) {
+      fprintf(stderr, "Failed to send chunk data\n");
+      continue;
+    }
+
+    if (!pxe_session_send_shared(session, trans_arena, server->write_pool,
+                                 frame)) {
+      break;
+    }
+  }
 }
 
 bool32 pxe_game_send_brand(pxe_session* session, pxe_memory_arena* trans_arena,
@@ -472,7 +646,7 @@ bool32 pxe_game_send_brand(pxe_session* session, pxe_memory_arena* trans_arena,
       pool, "minecraft:brand", (const u8*)pxe_server_brand,
       pxe_array_string_size(pxe_server_brand));
 
-  pxe_send_packet_chain(&session->socket, trans_arena, pool,
+  pxe_send_packet_chain(session, trans_arena, pool,
                         PXE_PROTOCOL_OUTBOUND_PLAY_PLUGIN_MESSAGE, buffer, 1);
 
   return 1;
@@ -486,7 +660,7 @@ bool32 pxe_game_change_game_state(pxe_session* session,
   pxe_buffer_chain* buffer = pxe_serialize_play_change_game_state(
       pool, PXE_CHANGE_GAME_STATE_REASON_GAMEMODE, (float)gamemode);
 
-  pxe_send_packet_chain(&session->socket, trans_arena, pool,
+  pxe_send_packet_chain(session, trans_arena, pool,
                         PXE_PROTOCOL_OUTBOUND_PLAY_CHANGE_GAME_STATE, buffer, 1);
 
   return 1;
@@ -497,7 +671,7 @@ bool32 pxe_game_send_time(pxe_game_server* server, pxe_session* session,
   pxe_buffer_chain* buffer = pxe_serialize_play_time_update(
       pool, server->world_age, server->world_time);
 
-  pxe_send_packet_chain(&session->socket, trans_arena, pool,
+  pxe_send_packet_chain(session, trans_arena, pool,
                         PXE_PROTOCOL_OUTBOUND_PLAY_TIME_UPDATE, buffer, 1);
 
   return 1;
@@ -512,7 +686,7 @@ bool32 pxe_game_send_position_and_look(pxe_session* session,
   pxe_buffer_chain* buffer = pxe_serialize_play_position_and_look(
       pool, x, y, z, yaw, pitch, 0, next_teleport_id++);
 
-  pxe_send_packet_chain(&session->socket, trans_arena, pool,
+  pxe_send_packet_chain(session, trans_arena, pool,
                         PXE_PROTOCOL_OUTBOUND_PLAY_PLAYER_POSITION_AND_LOOK,
                         buffer, 1);
 
@@ -524,7 +698,7 @@ bool32 pxe_game_send_keep_alive_packet(pxe_session* session,
                                        pxe_pool* pool, i64 id) {
   pxe_buffer_chain* buffer = pxe_serialize_play_keep_alive(pool, id);
 
-  pxe_send_packet_chain(&session->socket, trans_arena, pool,
+  pxe_send_packet_chain(session, trans_arena, pool,
                         PXE_PROTOCOL_OUTBOUND_PLAY_KEEP_ALIVE, buffer, 1);
 
   return 1;
@@ -537,7 +711,7 @@ bool32 pxe_game_send_player_abilities(pxe_session* session,
   pxe_buffer_chain* buffer =
       pxe_serialize_play_player_abilities(pool, flags, fly_speed, fov);
 
-  pxe_send_packet_chain(&session->socket, trans_arena, pool,
+  pxe_send_packet_chain(session, trans_arena, pool,
                         PXE_PROTOCOL_OUTBOUND_PLAY_PLAYER_ABILITIES, buffer, 1);
 
   return 1;
@@ -547,9 +721,9 @@ bool32 pxe_game_send_join_packet(pxe_session* session,
                                  pxe_memory_arena* trans_arena,
                                  pxe_pool* pool) {
   pxe_buffer_chain* buffer = pxe_serialize_play_join_game(
-      pool, session->entity_id, 0, 0, "default", 16, 0);
+      pool, session->hot->entity_id, 0, 0, "default", 16, 0);
 
-  pxe_send_packet_chain(&session->socket, trans_arena, pool,
+  pxe_send_packet_chain(session, trans_arena, pool,
                         PXE_PROTOCOL_OUTBOUND_PLAY_JOIN_GAME, buffer, 1);
 
   return 1;
@@ -559,68 +733,109 @@ bool32 pxe_game_broadcast_spawn_player(pxe_game_server* server,
                                        pxe_session* session,
                                        pxe_memory_arena* trans_arena,
                                        pxe_pool* pool) {
-  pxe_buffer_chain* buffer = pxe_serialize_play_spawn_player(
-      pool, session->entity_id, &session->uuid, session->x, session->y,
-      session->z, 0.0f, 0.0f);
-
-  for (size_t i = 0; i < server->session_count; ++i) {
-    pxe_session* target_session = server->sessions + i;
-
-    if (target_session == session) continue;
-    if (target_session->protocol_state != PXE_PROTOCOL_STATE_PLAY) continue;
-
-    pxe_send_packet_chain(&target_session->socket, trans_arena, pool,
-                          PXE_PROTOCOL_OUTBOUND_PLAY_SPAWN_PLAYER, buffer, 0);
-  }
+  pxe_session_hot* hot = session->hot;
 
-  pxe_pool_free(pool, buffer, 1);
+  pxe_buffer_chain* buffer = pxe_serialize_play_spawn_player(
+      pool, hot->entity_id, &session->uuid, hot->x, hot->y,
+      hot->z, 0.0f, 0.0f);
 
-  return 1;
+  return pxe_game_broadcast_except(server, session,
+                                   PXE_PROTOCOL_OUTBOUND_PLAY_SPAWN_PLAYER,
+                                   buffer, trans_arena);
 }
 
 bool32 pxe_game_broadcast_player_move(pxe_game_server* server,
                                       pxe_session* session,
                                       pxe_memory_arena* trans_arena,
                                       pxe_pool* pool) {
-  double delta_x = session->x - session->previous_x;
-  double delta_y = session->y - session->previous_y;
-  double delta_z = session->z - session->previous_z;
+  pxe_session_hot* hot = session->hot;
+
+  double delta_x = hot->x - hot->previous_x;
+  double delta_y = hot->y - hot->previous_y;
+  double delta_z = hot->z - hot->previous_z;
 
   pxe_buffer_chain* buffer;
   pxe_protocol_outbound_play_id pkt_id;
+  bool32 teleport = 0;
 
   if (delta_x < 8 && delta_y < 8 && delta_z < 8) {
     buffer = pxe_serialize_play_entity_look_and_relative_move(
-        pool, session->entity_id, delta_x, delta_y, delta_z, session->yaw,
-        session->pitch, session->on_ground);
+        pool, hot->entity_id, delta_x, delta_y, delta_z, hot->yaw,
+        hot->pitch, hot->on_ground);
 
     pkt_id = PXE_PROTOCOL_OUTBOUND_PLAY_ENTITY_LOOK_AND_RELATIVE_MOVE;
   } else {
     buffer = pxe_serialize_play_entity_teleport(
-        pool, session->entity_id, session->x, session->y, session->z,
-        session->yaw, session->pitch, session->on_ground);
+        pool, hot->entity_id, hot->x, hot->y, hot->z,
+        hot->yaw, hot->pitch, hot->on_ground);
 
     pkt_id = PXE_PROTOCOL_OUTBOUND_PLAY_ENTITY_TELEPORT;
+    teleport = 1;
   }
 
-  pxe_buffer_chain* look_buffer = pxe_serialize_play_entity_head_look(
-      pool, session->entity_id, session->yaw);
+  pxe_shared_frame* move = pxe_game_frame_broadcast(server, pkt_id, buffer);
+  pxe_shared_frame* look = pxe_game_frame_broadcast(
+      server, PXE_PROTOCOL_OUTBOUND_PLAY_ENTITY_HEAD_LOOK,
+      pxe_serialize_play_entity_head_look(pool, hot->entity_id, hot->yaw));
+  pxe_shared_frame* teleport_frame = teleport ? move : NULL;
+  i64 current_time = pxe_get_time_ms();
+
+  if (move == NULL || look == NULL) {
+    pxe_shared_frame_release(move);
+    pxe_shared_frame_release(look);
+    return 0;
+  }
 
   for (size_t i = 0; i < server->session_count; ++i) {
-    pxe_session* target_session = server->sessions + i;
+    pxe_session_hot* target_hot = pxe_game_server_session_hot(server, i);
+    pxe_session* target_session = pxe_game_server_session(server, i);
 
+    if (target_hot->protocol_state != PXE_PROTOCOL_STATE_PLAY) continue;
     if (target_session == session) continue;
-    if (target_session->protocol_state != PXE_PROTOCOL_STATE_PLAY) continue;
 
-    pxe_send_packet_chain(&target_session->socket, trans_arena, pool, pkt_id, buffer, 0);
+    // Movement is sent again constantly, so it's the first thing skipped for a
+    // client that isn't keeping up.
+    if (pxe_session_write_queued(target_session) >=
+        PXE_SESSION_WRITE_SOFT_LIMIT) {
+      target_session->moves_dropped = 1;
+      server->stats.dropped_packets += 2;
+      continue;
+    }
+
+    if (target_session->moves_dropped) {
+      // Every player moves at least once in this window, so the client gets
+      // an absolute position for each of them.
+      target_session->moves_dropped = 0;
+      target_session->move_resync_until =
+          current_time + PXE_GAME_SERVER_POSITION_INTERVAL_MS * 2;
+    }
+
+    pxe_shared_frame* frame = move;
 
-    pxe_send_packet_chain(&target_session->socket, trans_arena, pool,
-                          PXE_PROTOCOL_OUTBOUND_PLAY_ENTITY_HEAD_LOOK,
-                          look_buffer, 0);
+    if (current_time < target_session->move_resync_until) {
+      if (teleport_frame == NULL) {
+        teleport_frame = pxe_game_frame_broadcast(
+            server, PXE_PROTOCOL_OUTBOUND_PLAY_ENTITY_TELEPORT,
+            pxe_serialize_play_entity_teleport(
+                pool, hot->entity_id, hot->x, hot->y, hot->z, hot->yaw,
+                hot->pitch, hot->on_ground));
+
+        if (teleport_frame == NULL) break;
+      }
+
+      frame = teleport_frame;
+    }
+
+    pxe_session_send_shared(target_session, trans_arena, pool, frame);
+    pxe_session_send_shared(target_session, trans_arena, pool, look);
   }
 
-  pxe_pool_free(pool, buffer, 1);
-  pxe_pool_free(pool, look_buffer, 1);
+  pxe_shared_frame_release(move);
+  pxe_shared_frame_release(look);
+
+  if (!teleport) {
+    pxe_shared_frame_release(teleport_frame);
+  }
 
   return 1;
 }
@@ -630,16 +845,17 @@ bool32 pxe_game_broadcast_existing_players(pxe_game_server* server,
                                            pxe_memory_arena* trans_arena,
                                            pxe_pool* pool) {
   for (size_t i = 0; i < server->session_count; ++i) {
-    pxe_session* target_session = server->sessions + i;
+    pxe_session_hot* target_hot = pxe_game_server_session_hot(server, i);
+    pxe_session* target_session = pxe_game_server_session(server, i);
 
+    if (target_hot->protocol_state != PXE_PROTOCOL_STATE_PLAY) continue;
     if (target_session == session) continue;
-    if (target_session->protocol_state != PXE_PROTOCOL_STATE_PLAY) continue;
 
     pxe_buffer_chain* buffer = pxe_serialize_play_spawn_player(
-        pool, target_session->entity_id, &target_session->uuid,
-        target_session->x, target_session->y, target_session->z, 0.0f, 0.0f);
+        pool, target_hot->entity_id, &target_session->uuid,
+        target_hot->x, target_hot->y, target_hot->z, 0.0f, 0.0f);
 
-    pxe_send_packet_chain(&session->socket, trans_arena, pool,
+    pxe_send_packet_chain(session, trans_arena, pool,
                           PXE_PROTOCOL_OUTBOUND_PLAY_SPAWN_PLAYER, buffer, 1);
   }
 
@@ -654,9 +870,10 @@ bool32 pxe_game_send_existing_player_info(pxe_game_server* server,
   size_t info_count = 0;
 
   for (size_t i = 0; i < server->session_count; ++i) {
-    pxe_session* existing_session = server->sessions + i;
+    pxe_session_hot* existing_hot = pxe_game_server_session_hot(server, i);
+    pxe_session* existing_session = pxe_game_server_session(server, i);
 
-    if (existing_session->protocol_state != PXE_PROTOCOL_STATE_PLAY) {
+    if (existing_hot->protocol_state != PXE_PROTOCOL_STATE_PLAY) {
       continue;
     }
 
@@ -672,37 +889,31 @@ bool32 pxe_game_send_existing_player_info(pxe_game_server* server,
   pxe_buffer_chain* buffer = pxe_serialize_play_player_info(
       pool, PXE_PLAYER_INFO_ADD, infos, info_count);
 
-  for (size_t i = 0; i < server->session_count; ++i) {
-    pxe_session* target_session = server->sessions + i;
-
-    if (target_session->protocol_state != PXE_PROTOCOL_STATE_PLAY) continue;
-
-    pxe_send_packet_chain(&target_session->socket, trans_arena, pool,
-                          PXE_PROTOCOL_OUTBOUND_PLAY_PLAYER_INFO, buffer, 0);
-  }
-
-  pxe_pool_free(pool, buffer, 1);
-
-  return 1;
+  return pxe_game_broadcast(server, PXE_PROTOCOL_OUTBOUND_PLAY_PLAYER_INFO,
+                            buffer, trans_arena);
 }
 
 bool32 pxe_game_broadcast_destroy_entity(pxe_game_server* server,
                                          pxe_entity_id eid,
                                          pxe_memory_arena* trans_arena,
                                          pxe_pool* pool) {
-  pxe_buffer_chain* buffer = pxe_serialize_play_destroy_entities(pool, &eid, 1);
+  pxe_shared_frame* frame = pxe_game_frame_broadcast(
+      server, PXE_PROTOCOL_OUTBOUND_PLAY_DESTROY_ENTITIES,
+      pxe_serialize_play_destroy_entities(pool, &eid, 1));
+
+  if (frame == NULL) return 0;
 
   for (size_t i = 0; i < server->session_count; ++i) {
-    pxe_session* target_session = server->sessions + i;
+    pxe_session_hot* target_hot = pxe_game_server_session_hot(server, i);
+    pxe_session* target_session = pxe_game_server_session(server, i);
 
-    if (target_session->entity_id == eid) continue;
-    if (target_session->protocol_state != PXE_PROTOCOL_STATE_PLAY) continue;
+    if (target_hot->entity_id == eid) continue;
+    if (target_hot->protocol_state != PXE_PROTOCOL_STATE_PLAY) continue;
 
-    pxe_send_packet_chain(&target_session->socket, trans_arena, pool,
-                          PXE_PROTOCOL_OUTBOUND_PLAY_DESTROY_ENTITIES, buffer, 0);
+    pxe_session_send_shared(target_session, trans_arena, pool, frame);
   }
 
-  pxe_pool_free(pool, buffer, 1);
+  pxe_shared_frame_release(frame);
 
   return 1;
 }
@@ -723,19 +934,9 @@ bool32 pxe_game_broadcast_player_info(pxe_game_server* server,
   pxe_buffer_chain* buffer =
       pxe_serialize_play_player_info(pool, action, &info, 1);
 
-  for (size_t i = 0; i < server->session_count; ++i) {
-    pxe_session* target_session = server->sessions + i;
-
-    if (target_session == session) continue;
-    if (target_session->protocol_state != PXE_PROTOCOL_STATE_PLAY) continue;
-
-    pxe_send_packet_chain(&target_session->socket, trans_arena, pool,
-                          PXE_PROTOCOL_OUTBOUND_PLAY_PLAYER_INFO, buffer, 0);
-  }
-
-  pxe_pool_free(pool, buffer, 1);
-
-  return 1;
+  return pxe_game_broadcast_except(server, session,
+                                   PXE_PROTOCOL_OUTBOUND_PLAY_PLAYER_INFO,
+                                   buffer, trans_arena);
 }
 
 bool32 pxe_game_server_send_chat(pxe_game_server* server,
@@ -745,165 +946,329 @@ bool32 pxe_game_server_send_chat(pxe_game_server* server,
   pxe_buffer_chain* buffer =
       pxe_serialize_play_chat(pool, message, message_len, color);
 
-  for (size_t i = 0; i < server->session_count; ++i) {
-    pxe_session* session = server->sessions + i;
-
-    if (session->protocol_state != PXE_PROTOCOL_STATE_PLAY) continue;
-
-    pxe_send_packet_chain(&session->socket, trans_arena, pool,
-                          PXE_PROTOCOL_OUTBOUND_PLAY_CHAT, buffer, 0);
-  }
-
-  pxe_pool_free(pool, buffer, 1);
-
-  return 1;
+  return pxe_game_broadcast(server, PXE_PROTOCOL_OUTBOUND_PLAY_CHAT, buffer,
+                            trans_arena);
 }
 
 bool32 pxe_game_send_health(pxe_session* session, pxe_memory_arena* trans_arena,
                             pxe_pool* pool) {
   pxe_buffer_chain* buffer =
-      pxe_serialize_play_update_health(pool, session->health, 20, 5.0f);
+      pxe_serialize_play_update_health(pool, session->hot->health, 20, 5.0f);
 
-  pxe_send_packet_chain(&session->socket, trans_arena, pool,
+  pxe_send_packet_chain(session, trans_arena, pool,
                         PXE_PROTOCOL_OUTBOUND_PLAY_UPDATE_HEALTH, buffer, 1);
 
   return 1;
 }
 
-pxe_session* pxe_game_server_get_session_by_eid(pxe_game_server* game_server,
-                                                i32 eid) {
-  for (size_t i = 0; i < game_server->session_count; ++i) {
-    pxe_session* session = game_server->sessions + i;
+static pxe_session* pxe_game_server_timer_session(pxe_timer* timer) {
+  pxe_timer* timers = timer - timer->id;
 
-    if (session->protocol_state != PXE_PROTOCOL_STATE_PLAY) continue;
+  return (pxe_session*)((u8*)timers - offsetof(pxe_session, timers));
+}
 
-    if (session->entity_id == eid) {
-      return session;
-    }
-  }
+// Returns 0 if the timer isn't active.
+static i64 pxe_game_server_timer_deadline(pxe_session* session,
+                                          pxe_session_timer_id id) {
+  pxe_timer* timer = session->timers + id;
 
-  return NULL;
+  return pxe_timer_active(timer) ? (i64)timer->deadline : 0;
 }
 
-pxe_process_result pxe_game_process_session(pxe_game_server* game_server,
-                                            pxe_session* session,
-                                            pxe_memory_arena* trans_arena,
-                                            pxe_memory_arena* perm_arena) {
-  pxe_buffer_reader* reader = &session->buffer_reader;
+void pxe_game_server_schedule(pxe_game_server* server, pxe_session* session,
+                              pxe_session_timer_id id, i64 deadline) {
+  pxe_timer_schedule(&server->timers, session->timers + id, (u64)deadline);
+}
 
-  session->buffer_reader.chain = session->read_buffer_chain;
+// Starts the update timer if the session has anything to do each tick.
+void pxe_game_server_schedule_update(pxe_game_server* server,
+                                     pxe_session* session, i64 current_time) {
+  pxe_session_hot* hot = session->hot;
+  pxe_timer* timer = session->timers + PXE_SESSION_TIMER_UPDATE;
 
-  i32 pkt_len, pkt_id;
-  size_t pkt_len_size = 0;
+  if (pxe_timer_active(timer)) return;
 
-  if (pxe_buffer_read_varint(reader, &pkt_len) == 0) {
-    return PXE_PROCESS_RESULT_CONSUMED;
+  if ((hot->health > 0 && hot->health < 20.0f) || hot->chunks_remaining > 0) {
+    pxe_game_server_schedule(server, session, PXE_SESSION_TIMER_UPDATE,
+                             current_time + PXE_GAME_SERVER_TICK_US / 1000);
   }
+}
 
-  pkt_len_size = pxe_varint_size(pkt_len);
+// Replaces the login timeout with the timers of a player.
+void pxe_game_server_start_play_timers(pxe_game_server* server,
+                                       pxe_session* session,
+                                       i64 current_time) {
+  pxe_timer_cancel(session->timers + PXE_SESSION_TIMER_TIMEOUT);
+
+  pxe_game_server_schedule(server, session, PXE_SESSION_TIMER_KEEP_ALIVE,
+                           current_time);
+  pxe_game_server_schedule(server, session, PXE_SESSION_TIMER_POSITION,
+                           current_time);
+  pxe_game_server_schedule_update(server, session, current_time);
+}
 
-  if (pxe_buffer_read_varint(reader, &pkt_id) == 0) {
-    return PXE_PROCESS_RESULT_CONSUMED;
-  }
+static void pxe_game_server_eid_key(i32 eid, u8* key) {
+  memset(key, 0, PXE_SESSION_INDEX_KEY_SIZE);
+  memcpy(key, &eid, sizeof(eid));
+}
 
-  if (session->protocol_state == PXE_PROTOCOL_STATE_HANDSHAKING) {
-    switch (pkt_id) {
-      case PXE_PROTOCOL_INBOUND_HANDSHAKING_HANDSHAKE: {
-        i32 version;
+static void pxe_game_server_name_key(const char* name, u8* key) {
+  memset(key, 0, PXE_SESSION_INDEX_KEY_SIZE);
 
-        if (pxe_buffer_read_varint(reader, &version) == 0) {
-          return PXE_PROCESS_RESULT_CONSUMED;
-        }
+  for (size_t i = 0; i < PXE_SESSION_INDEX_KEY_SIZE && name[i]; ++i) {
+    char c = name[i];
 
-        size_t hostname_len;
+    key[i] = (u8)(c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c);
+  }
+}
 
-        if (pxe_buffer_read_length_string(reader, NULL, &hostname_len) == 0) {
-          return PXE_PROCESS_RESULT_CONSUMED;
-        }
+// Makes the session findable once it's in the play state. Returns 0 if another
+// session already has one of its keys, which leaves that session's entry.
+bool32 pxe_game_server_index_session(pxe_game_server* server,
+                                     pxe_session* session) {
+  pxe_session_handle handle = pxe_game_server_session_handle(server, session);
+  u8 key[PXE_SESSION_INDEX_KEY_SIZE];
+  bool32 indexed = 1;
 
-        char* hostname = pxe_arena_alloc(trans_arena, hostname_len);
+  pxe_game_server_eid_key(session->hot->entity_id, key);
+  indexed &= pxe_session_index_insert(&server->sessions_by_eid, key, handle);
 
-        if (pxe_buffer_read_length_string(reader, hostname, &hostname_len) ==
-            0) {
-          return PXE_PROCESS_RESULT_CONSUMED;
-        }
+  indexed &= pxe_session_index_insert(&server->sessions_by_uuid,
+                                      &session->uuid, handle);
 
-        u16 port;
-        if (pxe_buffer_read_u16(reader, &port) == 0) {
-          return PXE_PROCESS_RESULT_CONSUMED;
-        }
+  pxe_game_server_name_key(session->username, key);
+  indexed &= pxe_session_index_insert(&server->sessions_by_name, key, handle);
 
-        i32 next_state;
-        if (pxe_buffer_read_varint(reader, &next_state) == 0) {
-          return PXE_PROCESS_RESULT_CONSUMED;
-        }
+  if (!indexed) {
+    fprintf(stderr, "Failed to index session for %s.\n", session->username);
+  }
 
-        if (next_state >= PXE_PROTOCOL_STATE_COUNT) {
-          printf("Illegal state: %d. Terminating connection.\n", next_state);
-          return PXE_PROCESS_RESULT_DESTROY;
-        }
+  server->status_stale = 1;
 
-        session->protocol_state = next_state;
-      } break;
-      default: {
-        printf("Illegal packet %d received in handshaking state.\n", pkt_id);
-        return PXE_PROCESS_RESULT_DESTROY;
-      }
-    }
-  } else if (session->protocol_state == PXE_PROTOCOL_STATE_STATUS) {
-    switch (pkt_id) {
-      case PXE_PROTOCOL_INBOUND_STATUS_REQUEST: {
-        size_t data_size = pxe_array_size(pxe_ping_response);
-        pxe_buffer_writer writer =
-            pxe_buffer_writer_create(game_server->write_pool);
+  return indexed;
+}
 
-        pxe_buffer_write_length_string(&writer, pxe_ping_response, data_size);
+void pxe_game_server_unindex_session(pxe_game_server* server,
+                                     pxe_session* session) {
+  pxe_session_handle handle = pxe_game_server_session_handle(server, session);
+  u8 key[PXE_SESSION_INDEX_KEY_SIZE];
 
-        pxe_send_packet_chain(&session->socket, trans_arena, game_server->write_pool,
-                              PXE_PROTOCOL_OUTBOUND_STATUS_RESPONSE,
-                              writer.head, 1);
-      } break;
-      case PXE_PROTOCOL_INBOUND_STATUS_PING: {
-        // Respond to the game with the same payload.
-        u64 payload;
-        if (pxe_buffer_read_u64(reader, &payload) == 0) {
-          return PXE_PROCESS_RESULT_CONSUMED;
-        }
+  pxe_game_server_eid_key(session->hot->entity_id, key);
+  pxe_session_index_remove(&server->sessions_by_eid, key, handle);
 
-        pxe_buffer buffer;
-        buffer.data = (u8*)&payload;
-        buffer.size = sizeof(u64);
+  pxe_session_index_remove(&server->sessions_by_uuid, &session->uuid, handle);
 
-        pxe_send_packet(&session->socket, trans_arena,
-                        PXE_PROTOCOL_OUTBOUND_STATUS_PONG, &buffer);
-      } break;
-      default: {
-        printf("Illegal packet %d received in status state.\n", pkt_id);
-        return PXE_PROCESS_RESULT_DESTROY;
-      }
-    }
-  } else if (session->protocol_state == PXE_PROTOCOL_STATE_LOGIN) {
-    switch (pkt_id) {
-      case PXE_PROTOCOL_INBOUND_LOGIN_START: {
-        size_t username_len;
-        if (pxe_buffer_read_length_string(reader, NULL, &username_len) == 0) {
-          return PXE_PROCESS_RESULT_CONSUMED;
-        }
+  pxe_game_server_name_key(session->username, key);
+  pxe_session_index_remove(&server->sessions_by_name, key, handle);
 
-        char* username = pxe_arena_alloc(trans_arena, username_len + 1);
-        if (pxe_buffer_read_length_string(reader, username, &username_len) ==
-            0) {
-          return PXE_PROCESS_RESULT_CONSUMED;
-        }
+  server->status_stale = 1;
+}
 
-        username[username_len] = 0;
+// Sends the session a Disconnect and closes it. It's taken out of the indexes
+// right away so a new session can take its name, and the server loop removes
+// it like any other failed session.
+static void pxe_game_server_kick(pxe_game_server* server, pxe_session* session,
+                                 char* reason, pxe_memory_arena* trans_arena) {
+  pxe_buffer_chain* buffer =
+      pxe_serialize_play_disconnect(server->write_pool, reason);
+
+  pxe_send_packet_chain(session, trans_arena, server->write_pool,
+                        PXE_PROTOCOL_OUTBOUND_PLAY_DISCONNECT, buffer, 1);
+
+  // The Disconnect is written out now, since the socket is shut down as soon
+  // as the session is removed. A reactor sends it before it handles the
+  // close. Writing it while an io_uring send is in flight would put it ahead
+  // of that send, so it's left queued then and might not make it out.
+  bool32 flush = session->reactor == NULL;
+
+#ifdef __linux__
+  if (session->io_uring_conn && session->io_uring_conn->sending) {
+    flush = 0;
+  }
+#endif
+
+  if (flush) {
+    pxe_session_flush(session, trans_arena, server->write_pool);
+  }
+
+  pxe_game_server_unindex_session(server, session);
+  pxe_session_fail(session);
+}
+
+pxe_session* pxe_game_server_get_session_by_eid(pxe_game_server* server,
+                                                i32 eid) {
+  u8 key[PXE_SESSION_INDEX_KEY_SIZE];
+
+  pxe_game_server_eid_key(eid, key);
+
+  return pxe_game_server_resolve_session(
+      server, pxe_session_index_find(&server->sessions_by_eid, key));
+}
+
+pxe_session* pxe_game_server_get_session_by_uuid(pxe_game_server* server,
+                                                 pxe_uuid* uuid) {
+  return pxe_game_server_resolve_session(
+      server, pxe_session_index_find(&server->sessions_by_uuid, uuid));
+}
+
+pxe_session* pxe_game_server_get_session_by_name(pxe_game_server* server,
+                                                 const char* name) {
+  u8 key[PXE_SESSION_INDEX_KEY_SIZE];
+
+  pxe_game_server_name_key(name, key);
+
+  return pxe_game_server_resolve_session(
+      server, pxe_session_index_find(&server->sessions_by_name, key));
+}
+
+pxe_process_result pxe_game_process_session(pxe_game_server* game_server,
+                                            pxe_session* session,
+                                            pxe_memory_arena* trans_arena,
+                                            pxe_memory_arena* perm_arena) {
+  pxe_session_hot* hot = session->hot;
+
+  pxe_buffer_reader* reader = &session->buffer_reader;
+
+  i32 pkt_len;
+
+  if (pxe_buffer_read_varint(reader, &pkt_len) == 0) {
+    return PXE_PROCESS_RESULT_CONSUMED;
+  }
+
+  if (pkt_len <= 0 || pkt_len > PXE_GAME_SERVER_MAX_PACKET_SIZE) {
+    fprintf(stderr, "Illegal packet length %d.\n", pkt_len);
+    return PXE_PROCESS_RESULT_DESTROY;
+  }
+
+  // Nothing is decoded until the whole packet is here, so a partial packet
+  // only has its length read again once more input arrives.
+  pxe_arena_reset(&game_server->packet_arena);
+
+  u8* pkt_data = pxe_buffer_read_contiguous(reader, pkt_len,
+                                            &game_server->packet_arena);
+
+  if (pkt_data == NULL) {
+    return PXE_PROCESS_RESULT_CONSUMED;
+  }
+
+  pxe_frame frame_data = pxe_frame_create(pkt_data, pkt_len);
+  pxe_frame* frame = &frame_data;
+
+  if (session->compressed) {
+    i32 data_len = pxe_frame_read_varint(frame);
+
+    if (frame->overflow || data_len < 0 ||
+        data_len > PXE_COMPRESSION_MAX_INFLATED_SIZE) {
+      fprintf(stderr, "Illegal data length %d.\n", data_len);
+      return PXE_PROCESS_RESULT_DESTROY;
+    }
+
+    // Packets under the threshold can't be compressed, which is all vanilla
+    // checks. Uncompressed packets of any size are accepted.
+    if (data_len > 0 && data_len < PXE_COMPRESSION_THRESHOLD) {
+      fprintf(stderr, "Compressed packet of %d bytes is under the threshold.\n",
+              data_len);
+      return PXE_PROCESS_RESULT_DESTROY;
+    }
+
+    // A Data Length of 0 means the rest of the packet isn't compressed.
+    if (data_len > 0) {
+      size_t compressed_size = pxe_frame_remaining(frame);
+      u8* inflated = pxe_compress_inflate(
+          pxe_frame_take(frame, compressed_size), compressed_size, data_len);
+
+      if (inflated == NULL) {
+        fprintf(stderr, "Failed to inflate packet.\n");
+        return PXE_PROCESS_RESULT_DESTROY;
+      }
+
+      frame_data = pxe_frame_create(inflated, data_len);
+    }
+  }
+
+  i32 pkt_id = pxe_frame_read_varint(frame);
+
+  if (hot->protocol_state == PXE_PROTOCOL_STATE_HANDSHAKING) {
+    switch (pkt_id) {
+      case PXE_PROTOCOL_INBOUND_HANDSHAKING_HANDSHAKE: {
+        // The protocol version, address and port aren't checked.
+        pxe_frame_read_varint(frame);
+        pxe_frame_read_string(frame, 255);
+        pxe_frame_skip(frame, sizeof(u16));
+        i32 next_state = pxe_frame_read_varint(frame);
+
+        if (frame->overflow) break;
+
+        if (next_state < 0 || next_state >= PXE_PROTOCOL_STATE_COUNT) {
+          printf("Illegal state: %d. Terminating connection.\n", next_state);
+          return PXE_PROCESS_RESULT_DESTROY;
+        }
+
+        hot->protocol_state = next_state;
+      } break;
+      default: {
+        printf("Illegal packet %d received in handshaking state.\n", pkt_id);
+        return PXE_PROCESS_RESULT_DESTROY;
+      }
+    }
+  } else if (hot->protocol_state == PXE_PROTOCOL_STATE_STATUS) {
+    switch (pkt_id) {
+      case PXE_PROTOCOL_INBOUND_STATUS_REQUEST: {
+        pxe_shared_frame* status = pxe_game_server_status_frame(game_server);
+
+        if (status) {
+          pxe_session_send_shared(session, trans_arena,
+                                  game_server->write_pool, status);
+        }
+      } break;
+      case PXE_PROTOCOL_INBOUND_STATUS_PING: {
+        // The payload goes back exactly as it came in, so it isn't decoded.
+        const u8* payload = pxe_frame_take(frame, sizeof(u64));
+
+        if (frame->overflow) break;
+
+        // The whole frame is built here, since its length and id are each a
+        // single byte.
+        u8 pong[2 + sizeof(u64)] = {1 + sizeof(u64),
+                                    PXE_PROTOCOL_OUTBOUND_STATUS_PONG};
+
+        memcpy(pong + 2, payload, sizeof(u64));
+
+        pxe_session_send_bytes(session, trans_arena, game_server->write_pool,
+                               pong, sizeof(pong));
+      } break;
+      default: {
+        printf("Illegal packet %d received in status state.\n", pkt_id);
+        return PXE_PROCESS_RESULT_DESTROY;
+      }
+    }
+  } else if (hot->protocol_state == PXE_PROTOCOL_STATE_LOGIN) {
+    switch (pkt_id) {
+      case PXE_PROTOCOL_INBOUND_LOGIN_START: {
+        pxe_string_view username = pxe_frame_read_string(frame, 64);
+        size_t username_len = username.size;
+
+        if (frame->overflow) break;
 
         if (username_len > 16) {
-          fprintf(stderr, "Illegal username: %.20s\n", username);
+          fprintf(stderr, "Illegal username: %.*s\n", (int)username_len,
+                  username.data);
           return PXE_PROCESS_RESULT_DESTROY;
         }
 
-        pxe_strcpy(session->username, username);
+        memcpy(session->username, username.data, username_len);
+        session->username[username_len] = 0;
+
+        // Names aren't authenticated, so like vanilla the newest login with a
+        // name takes over from the player who's already on with it.
+        pxe_session* existing =
+            pxe_game_server_get_session_by_name(game_server, session->username);
+
+        if (existing) {
+          pxe_game_server_kick(game_server, existing,
+                               "You logged in from another location",
+                               trans_arena);
+        }
 
         char uuid[37];
         session->uuid = pxe_uuid_random();
@@ -917,6 +1282,21 @@ pxe_process_result pxe_game_process_session(pxe_game_server* game_server,
         size_t response_size = pxe_varint_size((i32)username_len) +
                                username_len + pxe_varint_size(36) + 36;
 
+        if (PXE_COMPRESSION_THRESHOLD >= 0) {
+          pxe_buffer_writer compression =
+              pxe_buffer_writer_create(game_server->write_pool);
+
+          pxe_buffer_write_varint(&compression, PXE_COMPRESSION_THRESHOLD);
+
+          pxe_send_packet_chain(session, trans_arena, game_server->write_pool,
+                                PXE_PROTOCOL_OUTBOUND_LOGIN_SET_COMPRESSION,
+                                compression.head, 1);
+
+          // Everything after Set Compression is framed for it, starting with
+          // Login Success.
+          session->compressed = 1;
+        }
+
         pxe_buffer_writer writer =
             pxe_buffer_writer_create(game_server->write_pool);
 
@@ -924,26 +1304,30 @@ pxe_process_result pxe_game_process_session(pxe_game_server* game_server,
         pxe_buffer_write_length_string(&writer, session->username,
                                        username_len);
 
-        pxe_send_packet_chain(&session->socket, trans_arena, game_server->write_pool,
+        pxe_send_packet_chain(session, trans_arena, game_server->write_pool,
                               PXE_PROTOCOL_OUTBOUND_LOGIN_SUCCESS, writer.head, 1);
 
-        session->entity_id = game_server->next_entity_id++;
+        hot->entity_id = game_server->next_entity_id++;
 
         i32 spawn_radius = 30;
-        session->previous_x = session->x =
+        hot->previous_x = hot->x =
             (rand() % (spawn_radius * 2)) - (double)spawn_radius;
-        session->previous_y = session->y = 68;
-        session->previous_z = session->z =
+        hot->previous_y = hot->y = 68;
+        hot->previous_z = hot->z =
             (rand() % (spawn_radius * 2)) - (double)spawn_radius;
 
-        session->yaw = (float)(rand() % 360);
-        session->pitch = (float)((rand() % 30) - 30);
+        hot->yaw = (float)(rand() % 360);
+        hot->pitch = (float)((rand() % 30) - 30);
         if (!pxe_game_send_join_packet(session, trans_arena,
                                        game_server->write_pool)) {
           fprintf(stderr, "Error writing join packet.\n");
         }
 
-        session->protocol_state = PXE_PROTOCOL_STATE_PLAY;
+        hot->protocol_state = PXE_PROTOCOL_STATE_PLAY;
+
+        if (!pxe_game_server_index_session(game_server, session)) {
+          return PXE_PROCESS_RESULT_DESTROY;
+        }
 
         pxe_game_send_brand(session, trans_arena, game_server->write_pool);
 
@@ -962,8 +1346,8 @@ pxe_process_result pxe_game_process_session(pxe_game_server* game_server,
         }
 
         if (pxe_game_send_position_and_look(
-                session, trans_arena, game_server->write_pool, session->x,
-                session->y, session->z, session->yaw, session->pitch) == 0) {
+                session, trans_arena, game_server->write_pool, hot->x,
+                hot->y, hot->z, hot->yaw, hot->pitch) == 0) {
           fprintf(stderr, "Failed to send position\n");
         }
 
@@ -990,52 +1374,37 @@ pxe_process_result pxe_game_process_session(pxe_game_server* game_server,
         }
 
         // Send terrain
-        i32 terrain_radius = 5;
-        for (i32 z = -terrain_radius; z < terrain_radius + 1; ++z) {
-          for (i32 x = -terrain_radius; x < terrain_radius + 1; ++x) {
-            bool32 blank = 0;
-
-            float r = (float)(x * x + z * z);
-            if (r > 3.5f * 3.5f) {
-              blank = 1;
-            }
+        hot->chunks_remaining = PXE_GAME_SERVER_SPAWN_CHUNKS;
+        pxe_game_stream_chunks(game_server, session, perm_arena, trans_arena);
 
-            if (pxe_game_send_chunk_data(session, game_server->write_pool, perm_arena, trans_arena, x,
-                                         z, blank) == 0) {
-              fprintf(stderr, "Failed to send chunk data\n");
-            }
-          }
-        }
+        pxe_game_server_start_play_timers(game_server, session,
+                                          pxe_get_time_ms());
       } break;
       default: {
         fprintf(stderr, "Received unhandled packet %d in state %d\n", pkt_id,
-                session->protocol_state);
+                hot->protocol_state);
         return PXE_PROCESS_RESULT_DESTROY;
       }
     }
-  } else if (session->protocol_state == PXE_PROTOCOL_STATE_PLAY) {
+  } else if (hot->protocol_state == PXE_PROTOCOL_STATE_PLAY) {
     switch (pkt_id) {
       case PXE_PROTOCOL_INBOUND_PLAY_TELEPORT_CONFIRM: {
-        i32 teleport_id;
-
-        if (pxe_buffer_read_varint(reader, &teleport_id) == 0) {
-          return PXE_PROCESS_RESULT_CONSUMED;
-        }
+        // Teleports aren't tracked, so the id is only read past.
+        pxe_frame_read_varint(frame);
       } break;
       case PXE_PROTOCOL_INBOUND_PLAY_CHAT: {
-        size_t message_len;
-        if (pxe_buffer_read_length_string(reader, NULL, &message_len) == 0) {
-          return PXE_PROCESS_RESULT_CONSUMED;
-        }
+        pxe_string_view chat = pxe_frame_read_string(frame, 256);
 
-        char* message = pxe_arena_alloc(trans_arena, message_len + 1);
-        if (pxe_buffer_read_length_string(reader, message, &message_len) == 0) {
-          return PXE_PROCESS_RESULT_CONSUMED;
-        }
+        if (frame->overflow) break;
+
+        if (chat.size > 0 && chat.data[0] == '/') {
+          // Commands are rare enough to be copied so they can be parsed as C
+          // strings. Normal chat is forwarded straight from the packet.
+          char message[257];
 
-        message[message_len] = 0;
+          memcpy(message, chat.data, chat.size);
+          message[chat.size] = 0;
 
-        if (message_len > 0 && message[0] == '/') {
           if (strcmp(message, "/spawn") == 0) {
             if (pxe_game_send_position_and_look(session, trans_arena,
                                                 game_server->write_pool, 5.0f,
@@ -1049,8 +1418,105 @@ pxe_process_result pxe_game_process_session(pxe_game_server* game_server,
 
             for (size_t session_index = 0;
                  session_index < game_server->session_count; ++session_index) {
-              game_server->sessions[session_index].next_keep_alive = 0;
+              pxe_session* target =
+                  pxe_game_server_session(game_server, session_index);
+
+              if (target->hot->protocol_state == PXE_PROTOCOL_STATE_PLAY) {
+                pxe_game_send_time(game_server, target, trans_arena,
+                                   game_server->write_pool);
+              }
+            }
+          } else if (strcmp(message, "/stats") == 0) {
+            pxe_game_server_stats* stats = &game_server->stats;
+            u64 saved = 0;
+            char stats_message[256];
+
+            if (stats->packets_sent > stats->send_calls) {
+              saved = stats->packets_sent - stats->send_calls;
+            }
+
+            size_t stats_message_len = sprintf_s(
+                stats_message, pxe_array_size(stats_message),
+                "packets: %llu, sends: %llu, saved: %llu, zero-copy: %llu, "
+                "copied: %llu",
+                (unsigned long long)stats->packets_sent,
+                (unsigned long long)stats->send_calls,
+                (unsigned long long)saved,
+                (unsigned long long)stats->zerocopy_sends,
+                (unsigned long long)stats->zerocopy_copied);
+
+            pxe_buffer_chain* buffer =
+                pxe_serialize_play_chat(game_server->write_pool, stats_message,
+                                        stats_message_len, "gray");
+
+            pxe_send_packet_chain(session, trans_arena, game_server->write_pool,
+                                  PXE_PROTOCOL_OUTBOUND_PLAY_CHAT, buffer, 1);
+
+            i64 uptime = pxe_get_time_us() - stats->start_time_us;
+            u64 idle_percent = 0;
+            u64 average_jitter = 0;
+            u64 average_tick = 0;
+
+            if (uptime > 0) {
+              idle_percent = stats->idle_us * 100 / (u64)uptime;
+            }
+
+            if (stats->ticks > 0) {
+              average_jitter = stats->tick_jitter_us / stats->ticks;
+              average_tick = stats->tick_us / stats->ticks;
             }
+
+            stats_message_len = sprintf_s(
+                stats_message, pxe_array_size(stats_message),
+                "wakeups: %llu, idle: %llu%%, tick: %lluus avg, %lluus max, "
+                "tick jitter: %lluus avg, %lluus max",
+                (unsigned long long)stats->wakeups,
+                (unsigned long long)idle_percent,
+                (unsigned long long)average_tick,
+                (unsigned long long)stats->max_tick_us,
+                (unsigned long long)average_jitter,
+                (unsigned long long)stats->max_tick_jitter_us);
+
+            buffer =
+                pxe_serialize_play_chat(game_server->write_pool, stats_message,
+                                        stats_message_len, "gray");
+
+            pxe_send_packet_chain(session, trans_arena, game_server->write_pool,
+                                  PXE_PROTOCOL_OUTBOUND_PLAY_CHAT, buffer, 1);
+
+            stats_message_len = sprintf_s(
+                stats_message, pxe_array_size(stats_message),
+                "queued: %zu bytes, max queued: %llu, dropped: %llu, "
+                "evicted: %llu, timed out: %llu, trimmed: %llu KB",
+                pxe_session_write_queued(session),
+                (unsigned long long)stats->max_write_queued,
+                (unsigned long long)stats->dropped_packets,
+                (unsigned long long)stats->evicted,
+                (unsigned long long)stats->timed_out,
+                (unsigned long long)(stats->trimmed_bytes / 1024));
+
+            buffer =
+                pxe_serialize_play_chat(game_server->write_pool, stats_message,
+                                        stats_message_len, "gray");
+
+            pxe_send_packet_chain(session, trans_arena, game_server->write_pool,
+                                  PXE_PROTOCOL_OUTBOUND_PLAY_CHAT, buffer, 1);
+
+            stats_message_len = sprintf_s(
+                stats_message, pxe_array_size(stats_message),
+                "accepted: %llu, rejected: %llu, accept queue full: %llu, "
+                "max queued: %u",
+                (unsigned long long)stats->accepted,
+                (unsigned long long)stats->rejected,
+                (unsigned long long)stats->accept_queue_full,
+                stats->max_accept_queue);
+
+            buffer =
+                pxe_serialize_play_chat(game_server->write_pool, stats_message,
+                                        stats_message_len, "gray");
+
+            pxe_send_packet_chain(session, trans_arena, game_server->write_pool,
+                                  PXE_PROTOCOL_OUTBOUND_PLAY_CHAT, buffer, 1);
           } else if (strncmp(message, "/gm ", 4) == 0) {
             long gamemode = strtol(message + 4, NULL, 10);
 
@@ -1067,7 +1533,8 @@ pxe_process_result pxe_game_process_session(pxe_game_server* game_server,
 
           size_t output_message_len =
               sprintf_s(output_message, pxe_array_size(output_message),
-                        "%s> %s", session->username, message);
+                        "%s> %.*s", session->username, (int)chat.size,
+                        chat.data);
 
           pxe_game_server_send_chat(game_server, trans_arena,
                                     game_server->write_pool, output_message,
@@ -1075,33 +1542,30 @@ pxe_process_result pxe_game_process_session(pxe_game_server* game_server,
         }
       } break;
       case PXE_PROTOCOL_INBOUND_PLAY_CLIENT_STATUS: {
-        i32 action;
-
-        if (pxe_buffer_read_varint(reader, &action) == 0) {
-          return PXE_PROCESS_RESULT_CONSUMED;
-        }
+        i32 action = pxe_frame_read_varint(frame);
 
-        if (action == 0x00) {
-          if (session->health <= 0) {
-            session->health = 20;
+        if (!frame->overflow && action == 0x00) {
+          if (hot->health <= 0) {
+            hot->health = 20;
+            pxe_timer_cancel(session->timers + PXE_SESSION_TIMER_UPDATE);
 
             pxe_buffer_chain* buffer = pxe_serialize_play_respawn(
               game_server->write_pool, 0, PXE_GAMEMODE_SURVIVAL, "default");
-            pxe_send_packet_chain(&session->socket, trans_arena, game_server->write_pool,
+            pxe_send_packet_chain(session, trans_arena, game_server->write_pool,
                             PXE_PROTOCOL_OUTBOUND_PLAY_RESPAWN, buffer, 1);
           }
 
-          session->x = 0;
-          session->y = 66;
-          session->z = 0;
+          hot->x = 0;
+          hot->y = 66;
+          hot->z = 0;
 
           pxe_game_send_position_and_look(
-              session, trans_arena, game_server->write_pool, session->x,
-              session->y, session->z, session->yaw, session->pitch);
+              session, trans_arena, game_server->write_pool, hot->x,
+              hot->y, hot->z, hot->yaw, hot->pitch);
 
           pxe_buffer_chain* buffer = pxe_serialize_play_spawn_player(
-              game_server->write_pool, session->entity_id, &session->uuid,
-              session->x, session->y, session->z, session->yaw, session->pitch);
+              game_server->write_pool, hot->entity_id, &session->uuid,
+              hot->x, hot->y, hot->z, hot->yaw, hot->pitch);
 
           pxe_game_broadcast_except(game_server, session,
                                     PXE_PROTOCOL_OUTBOUND_PLAY_SPAWN_PLAYER,
@@ -1109,184 +1573,94 @@ pxe_process_result pxe_game_process_session(pxe_game_server* game_server,
         }
       } break;
       case PXE_PROTOCOL_INBOUND_PLAY_CLIENT_SETTINGS: {
-        size_t locale_len;
-        if (pxe_buffer_read_length_string(reader, NULL, &locale_len) == 0) {
-          return PXE_PROCESS_RESULT_CONSUMED;
-        }
-
-        char* locale = pxe_arena_alloc(trans_arena, locale_len + 1);
-        if (pxe_buffer_read_length_string(reader, locale, &locale_len) == 0) {
-          return PXE_PROCESS_RESULT_CONSUMED;
-        }
-
-        locale[locale_len] = 0;
-
-        u8 view_distance;
-        if (pxe_buffer_read_u8(reader, &view_distance) == 0) {
-          return PXE_PROCESS_RESULT_CONSUMED;
-        }
-
-        i32 chat_mode;
-        if (pxe_buffer_read_varint(reader, &chat_mode) == 0) {
-          return PXE_PROCESS_RESULT_CONSUMED;
-        }
-
-        bool32 chat_colors = 0;
-        if (pxe_buffer_read_u8(reader, (u8*)&chat_colors) == 0) {
-          return PXE_PROCESS_RESULT_CONSUMED;
-        }
-
-        u8 skin_parts;
-        if (pxe_buffer_read_u8(reader, &skin_parts) == 0) {
-          return PXE_PROCESS_RESULT_CONSUMED;
-        }
-
-        i32 main_hand;
-        if (pxe_buffer_read_varint(reader, &main_hand) == 0) {
-          return PXE_PROCESS_RESULT_CONSUMED;
-        }
+        // None of the settings are used yet. They're still read past so a
+        // malformed packet overflows. Locale, view distance, chat mode, chat
+        // colors, skin parts and main hand.
+        pxe_frame_read_string(frame, 16);
+        pxe_frame_skip(frame, sizeof(u8));
+        pxe_frame_read_varint(frame);
+        pxe_frame_skip(frame, sizeof(u8) + sizeof(u8));
+        pxe_frame_read_varint(frame);
       } break;
       case PXE_PROTOCOL_INBOUND_PLAY_PLUGIN_MESSAGE: {
-        size_t channel_len;
-        if (pxe_buffer_read_length_string(reader, NULL, &channel_len) == 0) {
-          return PXE_PROCESS_RESULT_CONSUMED;
-        }
-
-        char* channel = pxe_arena_alloc(trans_arena, channel_len + 1);
+        pxe_string_view channel = pxe_frame_read_string(frame, 32767);
+        // The rest of the packet is the message, without a length.
+        pxe_string_view plugin_message = {
+            (const char*)frame->data + frame->pos, pxe_frame_remaining(frame)};
 
-        if (pxe_buffer_read_length_string(reader, channel, &channel_len) == 0) {
-          return PXE_PROCESS_RESULT_CONSUMED;
-        }
-
-        channel[channel_len] = 0;
-
-        size_t message_size;
-
-        if (pxe_buffer_read_length_string(reader, NULL, &message_size) == 0) {
-          return PXE_PROCESS_RESULT_CONSUMED;
-        }
-
-        char* plugin_message = pxe_arena_alloc(trans_arena, message_size + 1);
-        if (pxe_buffer_read_length_string(reader, plugin_message,
-                                          &message_size) == 0) {
-          return PXE_PROCESS_RESULT_CONSUMED;
-        }
-        plugin_message[message_size] = 0;
+        if (frame->overflow) break;
 
-        printf("plugin message from %s: (%s, %s)\n", session->username, channel,
-               plugin_message);
+        printf("plugin message from %s: (%.*s, %.*s)\n", session->username,
+               (int)channel.size, channel.data, (int)plugin_message.size,
+               plugin_message.data);
 
 #if 0
         return PXE_PROCESS_RESULT_DESTROY;
 #endif
       } break;
       case PXE_PROTOCOL_INBOUND_PLAY_KEEP_ALIVE: {
-        u64 id;
+        u64 id = pxe_frame_read_u64(frame);
 
-        if (pxe_buffer_read_u64(reader, &id) == 0) {
-          return PXE_PROCESS_RESULT_CONSUMED;
-        }
+        if (frame->overflow) break;
 
-        // TODO: Verify keep alive id
+        // Answers to anything but the last keep-alive don't count, so a
+        // client has to keep up with them to stay connected.
+        if (session->keep_alive_pending &&
+            id == (u64)session->keep_alive_id) {
+          session->keep_alive_pending = 0;
+          pxe_timer_cancel(session->timers + PXE_SESSION_TIMER_TIMEOUT);
+        }
       } break;
       case PXE_PROTOCOL_INBOUND_PLAY_PLAYER_POSITION: {
-        double x;
-        double y;
-        double z;
-        bool32 on_ground;
-
-        if (pxe_buffer_read_double(reader, &x) == 0) {
-          return PXE_PROCESS_RESULT_CONSUMED;
-        }
-
-        if (pxe_buffer_read_double(reader, &y) == 0) {
-          return PXE_PROCESS_RESULT_CONSUMED;
-        }
-
-        if (pxe_buffer_read_double(reader, &z) == 0) {
-          return PXE_PROCESS_RESULT_CONSUMED;
-        }
+        double x = pxe_frame_read_double(frame);
+        double y = pxe_frame_read_double(frame);
+        double z = pxe_frame_read_double(frame);
+        bool32 on_ground = pxe_frame_read_u8(frame);
 
-        if (pxe_buffer_read_u8(reader, (u8*)&on_ground) == 0) {
-          return PXE_PROCESS_RESULT_CONSUMED;
-        }
+        if (frame->overflow) break;
 
         // TODO: validate inputs
-        session->x = x;
-        session->y = y;
-        session->z = z;
-        session->on_ground = on_ground;
+        hot->x = x;
+        hot->y = y;
+        hot->z = z;
+        hot->on_ground = on_ground;
 
       } break;
       case PXE_PROTOCOL_INBOUND_PLAY_PLAYER_POSITION_AND_LOOK: {
-        double x;
-        double y;
-        double z;
-        float yaw;
-        float pitch;
-        bool32 on_ground;
-
-        if (pxe_buffer_read_double(reader, &x) == 0) {
-          return PXE_PROCESS_RESULT_CONSUMED;
-        }
-
-        if (pxe_buffer_read_double(reader, &y) == 0) {
-          return PXE_PROCESS_RESULT_CONSUMED;
-        }
-
-        if (pxe_buffer_read_double(reader, &z) == 0) {
-          return PXE_PROCESS_RESULT_CONSUMED;
-        }
-
-        if (pxe_buffer_read_float(reader, &yaw) == 0) {
-          return PXE_PROCESS_RESULT_CONSUMED;
-        }
-
-        if (pxe_buffer_read_float(reader, &pitch) == 0) {
-          return PXE_PROCESS_RESULT_CONSUMED;
-        }
+        double x = pxe_frame_read_double(frame);
+        double y = pxe_frame_read_double(frame);
+        double z = pxe_frame_read_double(frame);
+        float yaw = pxe_frame_read_float(frame);
+        float pitch = pxe_frame_read_float(frame);
+        bool32 on_ground = pxe_frame_read_u8(frame);
 
-        if (pxe_buffer_read_u8(reader, (u8*)&on_ground) == 0) {
-          return PXE_PROCESS_RESULT_CONSUMED;
-        }
+        if (frame->overflow) break;
 
         // TODO: validate inputs
-        session->x = x;
-        session->y = y;
-        session->z = z;
-        session->yaw = yaw;
-        session->pitch = pitch;
-        session->on_ground = on_ground;
+        hot->x = x;
+        hot->y = y;
+        hot->z = z;
+        hot->yaw = yaw;
+        hot->pitch = pitch;
+        hot->on_ground = on_ground;
 
       } break;
       case PXE_PROTOCOL_INBOUND_PLAY_PLAYER_LOOK: {
-        float yaw;
-        float pitch;
-        bool32 on_ground;
-
-        if (pxe_buffer_read_float(reader, &yaw) == 0) {
-          return PXE_PROCESS_RESULT_CONSUMED;
-        }
+        float yaw = pxe_frame_read_float(frame);
+        float pitch = pxe_frame_read_float(frame);
+        bool32 on_ground = pxe_frame_read_u8(frame);
 
-        if (pxe_buffer_read_float(reader, &pitch) == 0) {
-          return PXE_PROCESS_RESULT_CONSUMED;
-        }
-
-        if (pxe_buffer_read_u8(reader, (u8*)&on_ground) == 0) {
-          return PXE_PROCESS_RESULT_CONSUMED;
-        }
+        if (frame->overflow) break;
 
-        session->yaw = yaw;
-        session->pitch = pitch;
-        session->on_ground = on_ground;
+        hot->yaw = yaw;
+        hot->pitch = pitch;
+        hot->on_ground = on_ground;
 
       } break;
       case PXE_PROTOCOL_INBOUND_PLAY_ANIMATION: {
-        i32 hand;
+        i32 hand = pxe_frame_read_varint(frame);
 
-        if (pxe_buffer_read_varint(reader, &hand) == 0) {
-          return PXE_PROCESS_RESULT_CONSUMED;
-        }
+        if (frame->overflow) break;
 
         pxe_animation_type type = PXE_ANIMATION_TYPE_SWING_MAIN;
         if (hand != 0) {
@@ -1295,71 +1669,54 @@ pxe_process_result pxe_game_process_session(pxe_game_server* game_server,
 
         // Broadcast swing
         pxe_buffer_chain* buffer =
-            pxe_serialize_play_animation(game_server->write_pool, session->entity_id, type);
+            pxe_serialize_play_animation(game_server->write_pool, hot->entity_id, type);
         pxe_game_broadcast_except(game_server, session,
                                   PXE_PROTOCOL_OUTBOUND_PLAY_ANIMATION, buffer,
                                   trans_arena);
       } break;
       case PXE_PROTOCOL_INBOUND_PLAY_USE_ENTITY: {
-        i32 target, type;
-
-        if (pxe_buffer_read_varint(reader, &target) == 0) {
-          return PXE_PROCESS_RESULT_CONSUMED;
-        }
-
-        if (pxe_buffer_read_varint(reader, &type) == 0) {
-          return PXE_PROCESS_RESULT_CONSUMED;
-        }
+        i32 target = pxe_frame_read_varint(frame);
+        i32 type = pxe_frame_read_varint(frame);
 
+        // Neither the target position nor the hand is used.
         if (type == 2) {
-          float target_x, target_y, target_z;
-
-          if (pxe_buffer_read_float(reader, &target_x) == 0) {
-            return PXE_PROCESS_RESULT_CONSUMED;
-          }
-
-          if (pxe_buffer_read_float(reader, &target_y) == 0) {
-            return PXE_PROCESS_RESULT_CONSUMED;
-          }
-
-          if (pxe_buffer_read_float(reader, &target_z) == 0) {
-            return PXE_PROCESS_RESULT_CONSUMED;
-          }
+          pxe_frame_skip(frame, sizeof(float) * 3);
         }
 
         if (type != 1) {
-          i32 hand;
-
-          if (pxe_buffer_read_varint(reader, &hand) == 0) {
-            return PXE_PROCESS_RESULT_CONSUMED;
-          }
+          pxe_frame_read_varint(frame);
         }
 
+        if (frame->overflow) break;
+
         if (type == 1) {
           pxe_session* target_session =
               pxe_game_server_get_session_by_eid(game_server, target);
           if (target_session != NULL) {
+            pxe_session_hot* target_hot = target_session->hot;
             i64 time = pxe_get_time_ms();
 
-            if (target_session->health > 0 &&
+            if (target_hot->health > 0 &&
                 time > target_session->last_damage_time + 500) {
               pxe_buffer_chain* buffer = pxe_serialize_play_animation(
-                game_server->write_pool, target_session->entity_id,
+                game_server->write_pool, target_hot->entity_id,
                   PXE_ANIMATION_TYPE_DAMAGE);
 
               pxe_game_broadcast(game_server,
                                  PXE_PROTOCOL_OUTBOUND_PLAY_ANIMATION, buffer,
                                  trans_arena);
 
-              target_session->health -= 6.0f;
+              target_hot->health -= 6.0f;
               pxe_game_send_health(target_session, trans_arena,
                                    game_server->write_pool);
 
               target_session->last_damage_time = time;
+              pxe_game_server_schedule_update(game_server, target_session,
+                                              time);
 
-              if (target_session->health < 0) {
+              if (target_hot->health < 0) {
                 pxe_buffer_chain* buffer = pxe_serialize_play_entity_status(
-                  game_server->write_pool, target_session->entity_id, 3);
+                  game_server->write_pool, target_hot->entity_id, 3);
 
                 pxe_game_broadcast(game_server,
                                    PXE_PROTOCOL_OUTBOUND_PLAY_ENTITY_STATUS,
@@ -1372,19 +1729,10 @@ pxe_process_result pxe_game_process_session(pxe_game_server* game_server,
       default: {
 #if 1
         fprintf(stderr, "Received unhandled packet %d in state %d\n", pkt_id,
-                session->protocol_state);
+                hot->protocol_state);
 #endif
 
-#if 1
-        size_t payload_size = pkt_len - pxe_varint_size(pkt_id);
-        size_t buffer_size = pxe_buffer_size(reader->chain);
-        if (buffer_size >= reader->read_pos + payload_size) {
-          // Skip over this packet
-          reader->read_pos += payload_size;
-        } else {
-          return PXE_PROCESS_RESULT_CONSUMED;
-        }
-#else
+#if 0
         return PXE_PROCESS_RESULT_DESTROY;
 #endif
       }
@@ -1395,6 +1743,18 @@ pxe_process_result pxe_game_process_session(pxe_game_server* game_server,
     return PXE_PROCESS_RESULT_DESTROY;
   }
 
+  if (frame->overflow) {
+    fprintf(stderr, "Malformed packet %d in state %d.\n", pkt_id,
+            hot->protocol_state);
+    return PXE_PROCESS_RESULT_DESTROY;
+  }
+
+  if (reader->chain == &session->ring_chain) {
+    // The ring is consumed once pxe_game_server_read_ring stops decoding.
+    return PXE_PROCESS_RESULT_CONTINUE;
+  }
+
+  pxe_pool* read_pool = pxe_session_read_pool(session, game_server);
   pxe_buffer_chain* current = session->read_buffer_chain;
 
   while (current && reader->read_pos >= current->buffer->size) {
@@ -1402,7 +1762,7 @@ pxe_process_result pxe_game_process_session(pxe_game_server* game_server,
 
     pxe_buffer_chain* next = current->next;
 
-    pxe_pool_free(game_server->read_pool, current, 0);
+    pxe_pool_free(read_pool, current, 0);
 
     current = next;
 
@@ -1410,6 +1770,7 @@ pxe_process_result pxe_game_process_session(pxe_game_server* game_server,
   }
 
   session->read_buffer_chain = current;
+  pxe_buffer_reader_reset(reader, current, reader->read_pos);
 
   if (current == NULL) {
     session->last_read_chain = NULL;
@@ -1419,7 +1780,8 @@ pxe_process_result pxe_game_process_session(pxe_game_server* game_server,
   return PXE_PROCESS_RESULT_CONTINUE;
 }
 
-pxe_game_server* pxe_game_server_create(pxe_memory_arena* perm_arena) {
+pxe_game_server* pxe_game_server_create(pxe_memory_arena* perm_arena,
+                                        pxe_socket* existing_socket) {
 #ifndef PXE_TEST_CHUNK_PALETTE
   u32 palette_size = (u32)pxe_array_size(pxe_chunk_palette);
 
@@ -1448,8 +1810,22 @@ pxe_game_server* pxe_game_server_create(pxe_memory_arena* perm_arena) {
 #endif
 
   pxe_socket listen_socket = {0};
+  bool32 listening = 0;
+
+  if (existing_socket) {
+    listen_socket = *existing_socket;
+    listening = 1;
+  } else {
+#if PXE_GAME_SERVER_REACTORS > 0 && defined(__linux__)
+    listening = pxe_socket_listen_shared(&listen_socket, "127.0.0.1", 25565,
+                                         PXE_GAME_SERVER_BACKLOG);
+#else
+    listening = pxe_socket_listen(&listen_socket, "127.0.0.1", 25565,
+                                  PXE_GAME_SERVER_BACKLOG);
+#endif
+  }
 
-  if (pxe_socket_listen(&listen_socket, "127.0.0.1", 25565) == 0) {
+  if (listening == 0) {
     fprintf(stderr, "Failed to listen with socket.\n");
     return NULL;
   }
@@ -1464,8 +1840,22 @@ pxe_game_server* pxe_game_server_create(pxe_memory_arena* perm_arena) {
   game_server->next_entity_id = 0;
   game_server->world_age = 0;
   game_server->world_time = 0;
+  memset(&game_server->stats, 0, sizeof(game_server->stats));
+  game_server->stats.start_time_us = pxe_get_time_us();
+  pxe_timer_wheel_init(&game_server->timers, (u64)pxe_get_time_ms());
+  game_server->next_trim_time =
+      pxe_get_time_ms() + PXE_GAME_SERVER_TRIM_INTERVAL_MS;
   game_server->read_pool = pxe_pool_create(perm_arena, PXE_READ_BUFFER_SIZE);
+  pxe_arena_initialize(
+      &game_server->packet_arena,
+      pxe_arena_alloc(perm_arena, PXE_GAME_SERVER_MAX_PACKET_SIZE),
+      PXE_GAME_SERVER_MAX_PACKET_SIZE);
   game_server->write_pool = pxe_pool_create(perm_arena, PXE_WRITE_BUFFER_SIZE);
+  game_server->shared_pool =
+      pxe_shared_pool_create(perm_arena, game_server->write_pool);
+  game_server->status_frame = NULL;
+  game_server->status_stale = 1;
+  memset(game_server->chunk_frames, 0, sizeof(game_server->chunk_frames));
 
 #ifndef _WIN32
   game_server->epollfd = epoll_create1(0);
@@ -1473,34 +1863,108 @@ pxe_game_server* pxe_game_server_create(pxe_memory_arena* perm_arena) {
     fprintf(stderr, "Failed to create epoll fd.\n");
     return NULL;
   }
+
+  game_server->wakefd = -1;
+  game_server->handoff_fd = -1;
 #else
   game_server->nevents = 0;
 #endif
 
-  for (size_t i = 0; i < PXE_GAME_SERVER_MAX_SESSIONS; ++i) {
-    game_server->sessions[i].buffer_reader.read_pos = 0;
+  game_server->io_uring = NULL;
+  game_server->reactor_count = 0;
+
+#if PXE_GAME_SERVER_REACTORS > 0 && defined(__linux__)
+  // The game thread sleeps on this until a reactor has messages for it.
+  game_server->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+  struct epoll_event wake_event = {0};
+
+  wake_event.events = EPOLLIN;
+  wake_event.data.u64 = PXE_GAME_SERVER_MAX_SESSIONS + 2;
+
+  if (game_server->wakefd == -1 ||
+      epoll_ctl(game_server->epollfd, EPOLL_CTL_ADD, game_server->wakefd,
+                &wake_event)) {
+    fprintf(stderr, "Failed to create game thread eventfd.\n");
+    return NULL;
+  }
+
+  // The first reactor takes over the server's socket and the rest open their
+  // own on the same port.
+  for (u32 i = 0; i < PXE_GAME_SERVER_REACTORS &&
+                  i < PXE_GAME_SERVER_MAX_REACTORS;
+       ++i) {
+    pxe_socket reactor_socket = listen_socket;
+
+    if (i > 0 && pxe_socket_listen_shared(&reactor_socket, "127.0.0.1", 25565,
+                                          PXE_GAME_SERVER_BACKLOG) == 0) {
+      fprintf(stderr, "Failed to listen with reactor socket.\n");
+      return NULL;
+    }
+
+    pxe_socket_set_block(&reactor_socket, 0);
+
+    pxe_reactor* reactor =
+        pxe_reactor_create(perm_arena, i, &reactor_socket,
+                           PXE_READ_BUFFER_SIZE, PXE_WRITE_BUFFER_SIZE);
+
+    if (reactor == NULL) {
+      return NULL;
+    }
+
+    reactor->notify_fd = game_server->wakefd;
+    reactor->busy_poll = PXE_GAME_SERVER_BUSY_POLL;
+
+    if (PXE_GAME_SERVER_BUSY_POLL) {
+      reactor->cpu = PXE_GAME_SERVER_CPU + 1 + i;
+    }
+
+    game_server->reactors[game_server->reactor_count++] = reactor;
+  }
+#elif PXE_GAME_SERVER_IO_URING && defined(__linux__)
+  game_server->io_uring =
+      pxe_io_uring_create(perm_arena, game_server->read_pool);
+
+  if (game_server->io_uring == NULL) {
+    fprintf(stderr, "io_uring is not supported. Falling back to epoll.\n");
   }
+#endif
+
+  memset(&game_server->sessions_by_eid, 0, sizeof(pxe_session_index));
+  memset(&game_server->sessions_by_uuid, 0, sizeof(pxe_session_index));
+  memset(&game_server->sessions_by_name, 0, sizeof(pxe_session_index));
+
+  // Pages are only created once sessions need them.
+  memset(game_server->session_pages, 0, sizeof(game_server->session_pages));
+  game_server->next_generation = 0;
 
   return game_server;
 }
 
-bool32 pxe_game_server_read_session(pxe_game_server* game_server,
-                                    pxe_memory_arena* perm_arena,
-                                    pxe_memory_arena* trans_arena,
-                                    pxe_session* session) {
+// Appends received data to the session and processes every complete packet.
+bool32 pxe_game_server_receive_chain(pxe_game_server* game_server,
+                                     pxe_memory_arena* perm_arena,
+                                     pxe_memory_arena* trans_arena,
+                                     pxe_session* session,
+                                     pxe_buffer_chain* buffer_chain) {
   pxe_socket* socket = &session->socket;
-  pxe_buffer_chain* buffer_chain = pxe_pool_alloc(game_server->read_pool);
-  pxe_buffer* buffer = buffer_chain->buffer;
-
-  buffer->size =
-      pxe_socket_receive(socket, (char*)buffer->data, PXE_READ_BUFFER_SIZE);
 
   if (session->read_buffer_chain == NULL) {
     session->read_buffer_chain = buffer_chain;
-    session->last_read_chain = buffer_chain;
   } else {
     session->last_read_chain->next = buffer_chain;
-    session->last_read_chain = buffer_chain;
+  }
+
+  while (buffer_chain->next) {
+    buffer_chain = buffer_chain->next;
+  }
+
+  session->last_read_chain = buffer_chain;
+
+  if (session->buffer_reader.chain != session->read_buffer_chain) {
+    pxe_buffer_reader_reset(&session->buffer_reader,
+                            session->read_buffer_chain,
+                            session->buffer_reader.read_pos);
   }
 
   if (socket->state != PXE_SOCKET_STATE_CONNECTED) {
@@ -1510,7 +1974,8 @@ bool32 pxe_game_server_read_session(pxe_game_server* game_server,
   pxe_process_result process_result = PXE_PROCESS_RESULT_CONTINUE;
 
   while (process_result == PXE_PROCESS_RESULT_CONTINUE) {
-    size_t reader_pos_snapshot = session->buffer_reader.read_pos;
+    pxe_buffer_reader_snapshot snapshot =
+        pxe_buffer_reader_save(&session->buffer_reader);
 
     process_result = pxe_game_process_session(game_server, session, trans_arena,
                                               perm_arena);
@@ -1519,11 +1984,11 @@ bool32 pxe_game_server_read_session(pxe_game_server* game_server,
       if (session->read_buffer_chain == NULL) {
         // Set the read position back to the beginning because the entire buffer
         // was processed.
-        session->buffer_reader.read_pos = 0;
+        pxe_buffer_reader_reset(&session->buffer_reader, NULL, 0);
       } else {
         // Revert the read position because the last process didn't fully
         // read a packet.
-        session->buffer_reader.read_pos = reader_pos_snapshot;
+        pxe_buffer_reader_rewind(&session->buffer_reader, &snapshot);
       }
     }
   }
@@ -1533,78 +1998,1060 @@ bool32 pxe_game_server_read_session(pxe_game_server* game_server,
   return process_result != PXE_PROCESS_RESULT_DESTROY;
 }
 
-void pxe_game_server_on_disconnect(pxe_game_server* server,
-                                   pxe_session* session,
-                                   pxe_memory_arena* arena) {
-  if (session->protocol_state == PXE_PROTOCOL_STATE_PLAY) {
-    if (pxe_game_broadcast_player_info(server, session, PXE_PLAYER_INFO_REMOVE,
-                                       arena, server->write_pool) == 0) {
-      fprintf(stderr, "Failed to broadcast player info leave\n");
-    }
-
-    if (pxe_game_broadcast_destroy_entity(server, session->entity_id, arena,
-                                          server->write_pool) == 0) {
-      fprintf(stderr, "Failed to broadcast entity destroy.\n");
+// Remembers whether the socket still has input after a read.
+void pxe_game_server_set_drained(pxe_game_server* game_server,
+                                 pxe_session* session, bool32 drained) {
+#if PXE_GAME_SERVER_EDGE_TRIGGERED && !defined(_WIN32)
+  // An edge-triggered socket won't report the remaining input again, so the
+  // session is read again on the next loop iteration.
+  if (drained == session->read_pending) {
+    session->read_pending = !drained;
+
+    if (drained) {
+      --game_server->read_pending_count;
+    } else {
+      ++game_server->read_pending_count;
     }
   }
+#endif
 }
 
-void pxe_game_server_tick(pxe_game_server* server, pxe_memory_arena* perm_arena,
-                          pxe_memory_arena* trans_arena) {
-  i64 current_time = pxe_get_time_ms();
-
-  ++server->world_age;
-  server->world_time = (server->world_time + 1) % 24000;
-
-  float dt = 50.0f / 1000.0f;
-  for (size_t i = 0; i < server->session_count; ++i) {
-    pxe_session* session = server->sessions + i;
-
-    if (session->protocol_state != PXE_PROTOCOL_STATE_PLAY) continue;
-
-    if (session->health > 0) {
-      i32 prev_discrete_health = (i32)session->health;
-
-      session->health += session->health_regen * dt;
+// Reads into the session's receive ring and decodes the packets where they
+// landed. Whatever is left of a partial packet stays in the ring.
+bool32 pxe_game_server_read_ring(pxe_game_server* game_server,
+                                 pxe_memory_arena* perm_arena,
+                                 pxe_memory_arena* trans_arena,
+                                 pxe_session* session) {
+  pxe_socket* socket = &session->socket;
+  pxe_ring* ring = &session->receive_ring;
+  pxe_buffer_reader* reader = &session->buffer_reader;
+  size_t budget = PXE_GAME_SERVER_READ_BUDGET;
+  bool32 drained = 0;
 
-      if (session->health > 20.0f) {
-        session->health = 20.0f;
-      }
+  while (budget > 0 && pxe_ring_free(ring) > 0) {
+    size_t size = pxe_ring_free(ring);
 
-      if ((i32)session->health > prev_discrete_health) {
-        pxe_game_send_health(session, trans_arena, server->write_pool);
-      }
+    if (size > budget) {
+      size = budget;
     }
 
-    if (current_time >= session->next_keep_alive) {
-      pxe_game_send_keep_alive_packet(session, trans_arena, server->write_pool,
-                                      current_time);
-      pxe_game_send_time(server, session, trans_arena, server->write_pool);
+    size_t received =
+        pxe_socket_receive(socket, (char*)pxe_ring_write_ptr(ring), size);
 
-      session->next_keep_alive = current_time + 10000;
+    if (received == 0) {
+      drained = 1;
+      break;
     }
 
-    if (current_time >= session->next_position_broadcast) {
-      pxe_game_broadcast_player_move(server, session, trans_arena,
-                                     server->write_pool);
+    pxe_ring_produce(ring, received);
+    budget -= received;
+  }
+
+  pxe_game_server_set_drained(game_server, session, drained);
+
+  if (socket->state != PXE_SOCKET_STATE_CONNECTED) {
+    return 0;
+  }
+
+  pxe_buffer_reader_reset(reader, pxe_session_wrap_ring(session), 0);
+
+  pxe_process_result process_result = PXE_PROCESS_RESULT_CONTINUE;
+
+  while (process_result == PXE_PROCESS_RESULT_CONTINUE &&
+         reader->read_pos < session->ring_buffer.size) {
+    pxe_buffer_reader_snapshot snapshot = pxe_buffer_reader_save(reader);
+
+    process_result = pxe_game_process_session(game_server, session, trans_arena,
+                                              perm_arena);
+
+    if (process_result == PXE_PROCESS_RESULT_CONSUMED) {
+      pxe_buffer_reader_rewind(reader, &snapshot);
+    }
+  }
+
+  pxe_ring_consume(ring, reader->read_pos);
+  pxe_buffer_reader_reset(reader, NULL, 0);
+
+  if (process_result == PXE_PROCESS_RESULT_DESTROY) {
+    return 0;
+  }
+
+  if (pxe_ring_free(ring) == 0) {
+    fprintf(stderr, "Packet is larger than the receive ring.\n");
+    return 0;
+  }
+
+  return 1;
+}
+
+bool32 pxe_game_server_read_session(pxe_game_server* game_server,
+                                    pxe_memory_arena* perm_arena,
+                                    pxe_memory_arena* trans_arena,
+                                    pxe_session* session) {
+  if (session->receive_ring.data) {
+    return pxe_game_server_read_ring(game_server, perm_arena, trans_arena,
+                                     session);
+  }
+
+  pxe_socket* socket = &session->socket;
+  bool32 drained = 0;
+
+  // Everything read here is decoded in one pass afterwards.
+  pxe_buffer_chain* buffer_chain = pxe_socket_receive_chain(
+      socket, trans_arena, game_server->read_pool, PXE_GAME_SERVER_READ_BUDGET,
+      &drained);
+
+  pxe_game_server_set_drained(game_server, session, drained);
+
+  if (buffer_chain == NULL) {
+    return socket->state == PXE_SOCKET_STATE_CONNECTED;
+  }
+
+  return pxe_game_server_receive_chain(game_server, perm_arena, trans_arena,
+                                       session, buffer_chain);
+}
+
+// Zero is skipped so handles never collide with the other epoll events.
+static u32 pxe_game_server_next_generation(pxe_game_server* server) {
+  if (++server->next_generation == 0) {
+    server->next_generation = 1;
+  }
+
+  return server->next_generation;
+}
+
+pxe_session_handle pxe_game_server_session_handle(pxe_game_server* server,
+                                                  pxe_session* session) {
+  pxe_session_page* page =
+      server->session_pages[session->slot / PXE_GAME_SERVER_SESSION_PAGE_SIZE];
+  u32 generation =
+      page->generations[session->slot % PXE_GAME_SERVER_SESSION_PAGE_SIZE];
+
+  return ((u64)generation << 32) | session->slot;
+}
+
+pxe_session* pxe_game_server_resolve_session(pxe_game_server* server,
+                                             pxe_session_handle handle) {
+  u32 slot = (u32)handle;
+
+  if (slot >= PXE_GAME_SERVER_MAX_SESSIONS) return NULL;
+
+  pxe_session_page* page =
+      server->session_pages[slot / PXE_GAME_SERVER_SESSION_PAGE_SIZE];
+  u32 index = slot % PXE_GAME_SERVER_SESSION_PAGE_SIZE;
+
+  if (page == NULL || page->generations[index] != (u32)(handle >> 32)) {
+    return NULL;
+  }
+
+  return page->sessions + index;
+}
+
+// Maps the page at page_index with all of its slots free.
+pxe_session_page* pxe_game_server_create_page(pxe_game_server* server,
+                                              size_t page_index) {
+  pxe_session_page* page = pxe_page_alloc(sizeof(pxe_session_page));
+
+  if (page == NULL) {
+    fprintf(stderr, "Failed to allocate a page of sessions.\n");
+    return NULL;
+  }
+
+  u32 first_slot = (u32)(page_index * PXE_GAME_SERVER_SESSION_PAGE_SIZE);
+  u32 capacity = PXE_GAME_SERVER_SESSION_PAGE_SIZE;
+
+  if (first_slot + capacity > PXE_GAME_SERVER_MAX_SESSIONS) {
+    capacity = PXE_GAME_SERVER_MAX_SESSIONS - first_slot;
+  }
+
+  page->capacity = capacity;
+  page->free_count = capacity;
+
+  // Free slots are taken from the end, so the lowest ones are used first.
+  for (u32 i = 0; i < capacity; ++i) {
+    page->sessions[i].hot = page->hot + i;
+    page->sessions[i].slot = first_slot + i;
+    page->generations[i] = pxe_game_server_next_generation(server);
+    page->free_slots[i] = (u16)(capacity - 1 - i);
+  }
+
+  server->session_pages[page_index] = page;
+
+  return page;
+}
+
+// Gives the memory of pages without sessions back to the OS. The first page is
+// kept so a server with a few players coming and going doesn't keep mapping
+// it again.
+void pxe_game_server_release_pages(pxe_game_server* server) {
+  for (size_t i = 1; i < PXE_GAME_SERVER_SESSION_PAGES; ++i) {
+    pxe_session_page* page = server->session_pages[i];
+
+    if (page && page->free_count == page->capacity) {
+      pxe_page_free(page, sizeof(pxe_session_page));
+      server->session_pages[i] = NULL;
+    }
+  }
+}
+
+// Takes a slot on the first page that has one free, so sessions gather in the
+// lower pages and the higher ones can empty out. Returns NULL if the server is
+// full.
+pxe_session* pxe_game_server_alloc_session(pxe_game_server* server) {
+  pxe_session_page* page = NULL;
+
+  if (server->session_count < PXE_GAME_SERVER_MAX_SESSIONS) {
+    for (size_t i = 0; i < PXE_GAME_SERVER_SESSION_PAGES; ++i) {
+      page = server->session_pages[i];
+
+      if (page == NULL) {
+        page = pxe_game_server_create_page(server, i);
+        break;
+      }
+
+      if (page->free_count > 0) break;
+    }
+  }
+
+  if (page == NULL || page->free_count == 0) {
+    ++server->stats.rejected;
+    return NULL;
+  }
+
+  u32 index = page->free_slots[--page->free_count];
+  pxe_session* session = page->sessions + index;
+
+  page->live_positions[index] = (u32)server->session_count;
+  server->live_sessions[server->session_count++] = session->slot;
+
+  pxe_session_initialize(session);
+  pxe_game_server_schedule(server, session, PXE_SESSION_TIMER_TIMEOUT,
+                           pxe_get_time_ms() +
+                               PXE_GAME_SERVER_LOGIN_TIMEOUT_MS);
+
+  return session;
+}
+
+// Creates a session for a newly accepted socket. Returns NULL if the server is
+// full, in which case the caller closes the socket.
+pxe_session* pxe_game_server_add_session(pxe_game_server* server,
+                                         pxe_socket* new_socket) {
+#if PXE_OUTPUT_CONNECTIONS
+  u8 bytes[] = ENDPOINT_BYTES(new_socket->endpoint);
+
+  printf("Accepted %hhu.%hhu.%hhu.%hhu:%hu\n", bytes[0], bytes[1], bytes[2],
+         bytes[3], new_socket->endpoint.sin_port);
+#endif
+
+  if (PXE_SESSION_COALESCE_WRITES) {
+    // Writes are already batched per loop iteration, so Nagle would only
+    // delay them.
+    pxe_socket_set_nodelay(new_socket, 1);
+  }
+
+  if (PXE_GAME_SERVER_BUSY_POLL) {
+    pxe_socket_set_busy_poll(new_socket, PXE_GAME_SERVER_BUSY_POLL);
+  }
+
+  pxe_session* session = pxe_game_server_alloc_session(server);
+
+  if (session) {
+    session->socket = *new_socket;
+  }
+
+  return session;
+}
+
+// Records how full the accept queue is. A full queue means the kernel is
+// dropping new connections.
+void pxe_game_server_sample_accept_queue(pxe_game_server* server,
+                                         pxe_socket* listen_socket) {
+  u32 length, capacity;
+
+  if (!pxe_socket_accept_queue(listen_socket, &length, &capacity)) return;
+
+  if (length > server->stats.max_accept_queue) {
+    server->stats.max_accept_queue = length;
+  }
+
+  if (capacity > 0 && length >= capacity) {
+    ++server->stats.accept_queue_full;
+  }
+}
+
+// Starts polling a session's socket on the game thread's own loop.
+void pxe_game_server_watch_session(pxe_game_server* server,
+                                   pxe_session* session) {
+  pxe_socket* socket = &session->socket;
+
+  if (PXE_SESSION_ZEROCOPY) {
+    session->zerocopy = pxe_socket_set_zerocopy(socket);
+  }
+
+  if (PXE_SESSION_RECEIVE_RING &&
+      pxe_ring_create(&session->receive_ring, PXE_SESSION_RING_SIZE) &&
+      !pxe_session_fill_ring(session, server->read_pool)) {
+    // Input taken over from another server that doesn't fit stays in the
+    // read chain, which the session keeps using.
+    pxe_ring_destroy(&session->receive_ring);
+  }
+
+#ifdef _WIN32
+  WSAPOLLFD* new_event = server->events + server->nevents++;
+
+  new_event->fd = socket->fd;
+  new_event->events = POLLIN;
+  new_event->revents = 0;
+#else
+  struct epoll_event new_event = {0};
+
+  new_event.events = EPOLLIN | EPOLLHUP;
+  new_event.data.u64 = pxe_game_server_session_handle(server, session);
+
+  if (PXE_GAME_SERVER_EDGE_TRIGGERED) {
+    new_event.events |= EPOLLET;
+  }
+
+  if (epoll_ctl(server->epollfd, EPOLL_CTL_ADD, socket->fd, &new_event)) {
+    fprintf(stderr, "Failed to add new socket to epoll.\n");
+  }
+#endif
+}
+
+// Accepts every pending connection and registers them all in one pass.
+void pxe_game_server_accept_sessions(pxe_game_server* server,
+                                     pxe_socket* listen_socket) {
+  pxe_socket new_socket = {0};
+
+  pxe_game_server_sample_accept_queue(server, listen_socket);
+
+  while (pxe_socket_accept(listen_socket, &new_socket)) {
+    ++server->stats.accepted;
+
+    pxe_session* session = pxe_game_server_add_session(server, &new_socket);
+
+    if (session == NULL) {
+      closesocket(new_socket.fd);
+      continue;
+    }
+
+    pxe_game_server_watch_session(server, session);
+  }
+}
+
+#if PXE_GAME_SERVER_HOT_RESTART && defined(__linux__)
+// Sends the listen socket and every session to the process connecting on the
+// handoff socket. Returns 1 once that process has confirmed it took over, at
+// which point this server must stop touching its sockets. If anything fails,
+// the new process gives up and this server keeps running as before.
+bool32 pxe_game_server_hand_off(pxe_game_server* server) {
+  int fd = pxe_handoff_accept(server->handoff_fd);
+
+  if (fd < 0) return 0;
+
+  pxe_handoff_request request;
+
+  if (!pxe_handoff_receive(fd, &request, sizeof(request), NULL) ||
+      request.magic != PXE_HANDOFF_MAGIC ||
+      request.version != PXE_HANDOFF_VERSION) {
+    fprintf(stderr, "Refused handoff to an incompatible server.\n");
+    close(fd);
+    return 0;
+  }
+
+  pxe_handoff_header header = {0};
+
+  header.magic = PXE_HANDOFF_MAGIC;
+  header.version = PXE_HANDOFF_VERSION;
+  header.session_count = (u32)server->session_count;
+  header.next_entity_id = server->next_entity_id;
+  header.world_age = server->world_age;
+  header.world_time = server->world_time;
+
+  bool32 sent = pxe_handoff_send(fd, &header, sizeof(header),
+                                 server->listen_socket.fd);
+
+  for (size_t i = 0; sent && i < server->session_count; ++i) {
+    pxe_session_hot* hot = pxe_game_server_session_hot(server, i);
+    pxe_session* session = pxe_game_server_session(server, i);
+    pxe_handoff_session record = {0};
+
+    // Only the start of an incomplete packet can be left in the read chain.
+    pxe_buffer_chain* read_chain = session->read_buffer_chain;
+    size_t read_offset = session->buffer_reader.read_pos;
+    size_t read_size = 0;
+    size_t write_size = 0;
+
+    if (session->receive_ring.data) {
+      read_chain = pxe_session_wrap_ring(session);
+      read_offset = 0;
+    }
+
+    if (read_chain) {
+      read_size = pxe_buffer_size(read_chain) - read_offset;
+    }
+
+    if (session->write_buffer_chain) {
+      write_size = pxe_buffer_size(session->write_buffer_chain) -
+                   session->write_offset;
+    }
+
+    record.protocol_state = hot->protocol_state;
+    record.compressed = session->compressed;
+    record.endpoint = session->socket.endpoint;
+    record.entity_id = hot->entity_id;
+    memcpy(record.username, session->username, sizeof(record.username));
+    record.uuid = session->uuid;
+    record.next_keep_alive = pxe_game_server_timer_deadline(
+        session, PXE_SESSION_TIMER_KEEP_ALIVE);
+    record.next_position_broadcast = pxe_game_server_timer_deadline(
+        session, PXE_SESSION_TIMER_POSITION);
+    record.timeout =
+        pxe_game_server_timer_deadline(session, PXE_SESSION_TIMER_TIMEOUT);
+    record.last_damage_time = session->last_damage_time;
+    record.keep_alive_id = session->keep_alive_id;
+    record.keep_alive_pending = session->keep_alive_pending;
+    record.gamemode = session->gamemode;
+    record.previous_x = hot->previous_x;
+    record.previous_y = hot->previous_y;
+    record.previous_z = hot->previous_z;
+    record.x = hot->x;
+    record.y = hot->y;
+    record.z = hot->z;
+    record.health = hot->health;
+    record.health_regen = hot->health_regen;
+    record.yaw = hot->yaw;
+    record.pitch = hot->pitch;
+    record.on_ground = hot->on_ground;
+    record.moves_dropped = session->moves_dropped;
+    record.chunks_remaining = hot->chunks_remaining;
+    record.read_size = (u32)read_size;
+    record.write_size = (u32)write_size;
+
+    sent = pxe_handoff_send(fd, &record, sizeof(record), session->socket.fd) &&
+           pxe_handoff_send_chain(fd, read_chain, read_offset, read_size) &&
+           pxe_handoff_send_chain(fd, session->write_buffer_chain,
+                                  session->write_offset, write_size);
+  }
+
+  // The new process echoes the request once everything was set up.
+  bool32 confirmed =
+      sent && pxe_handoff_receive(fd, &request, sizeof(request), NULL);
+
+  close(fd);
+
+  if (!confirmed) {
+    fprintf(stderr, "Handoff failed. Continuing to run.\n");
+    return 0;
+  }
+
+  printf("Handed %zu sessions off to the new server.\n",
+         server->session_count);
+  fflush(stdout);
+
+  return 1;
+}
+
+// Receives the sessions from the server being replaced and starts serving them.
+bool32 pxe_game_server_take_over(pxe_game_server* server, int fd,
+                                 pxe_handoff_header* header) {
+  server->next_entity_id = header->next_entity_id;
+  server->world_age = header->world_age;
+  server->world_time = header->world_time;
+
+  if (header->session_count > PXE_GAME_SERVER_MAX_SESSIONS) {
+    fprintf(stderr, "Too many sessions to take over: %u\n",
+            header->session_count);
+    return 0;
+  }
+
+  for (u32 i = 0; i < header->session_count; ++i) {
+    pxe_handoff_session record;
+    int session_fd;
+
+    if (!pxe_handoff_receive(fd, &record, sizeof(record), &session_fd) ||
+        session_fd < 0) {
+      return 0;
+    }
+
+    pxe_socket new_socket = {0};
+
+    new_socket.fd = session_fd;
+    new_socket.endpoint = record.endpoint;
+    new_socket.state = PXE_SOCKET_STATE_CONNECTED;
+
+    pxe_session* session = pxe_game_server_add_session(server, &new_socket);
+
+    if (session == NULL) {
+      close(session_fd);
+      return 0;
+    }
+
+    pxe_session_hot* hot = session->hot;
+
+    hot->protocol_state = (pxe_protocol_state)record.protocol_state;
+    session->compressed = record.compressed;
+    hot->entity_id = record.entity_id;
+    hot->previous_x = record.previous_x;
+    hot->previous_y = record.previous_y;
+    hot->previous_z = record.previous_z;
+    hot->x = record.x;
+    hot->y = record.y;
+    hot->z = record.z;
+    hot->health = record.health;
+    hot->health_regen = record.health_regen;
+    hot->yaw = record.yaw;
+    hot->pitch = record.pitch;
+    hot->on_ground = record.on_ground;
+    hot->chunks_remaining = record.chunks_remaining;
+
+    memcpy(session->username, record.username, sizeof(record.username));
+    session->username[sizeof(record.username)] = 0;
+    session->uuid = record.uuid;
+    session->last_damage_time = record.last_damage_time;
+    session->gamemode = (pxe_gamemode)record.gamemode;
+    session->moves_dropped = record.moves_dropped;
+    session->keep_alive_id = record.keep_alive_id;
+    session->keep_alive_pending = record.keep_alive_pending;
+
+    pxe_timer_cancel(session->timers + PXE_SESSION_TIMER_TIMEOUT);
+
+    if (record.next_keep_alive) {
+      pxe_game_server_schedule(server, session, PXE_SESSION_TIMER_KEEP_ALIVE,
+                               record.next_keep_alive);
+    }
+
+    if (record.next_position_broadcast) {
+      pxe_game_server_schedule(server, session, PXE_SESSION_TIMER_POSITION,
+                               record.next_position_broadcast);
+    }
+
+    if (record.timeout) {
+      pxe_game_server_schedule(server, session, PXE_SESSION_TIMER_TIMEOUT,
+                               record.timeout);
+    }
+
+    pxe_game_server_schedule_update(server, session, pxe_get_time_ms());
+
+    if (hot->protocol_state == PXE_PROTOCOL_STATE_PLAY) {
+      pxe_game_server_index_session(server, session);
+    }
+
+    if (!pxe_handoff_receive_chain(fd, server->read_pool, record.read_size,
+                                   &session->read_buffer_chain) ||
+        !pxe_handoff_receive_chain(fd, server->write_pool, record.write_size,
+                                   &session->write_buffer_chain)) {
+      return 0;
+    }
+
+    for (pxe_buffer_chain* chain = session->read_buffer_chain; chain;
+         chain = chain->next) {
+      session->last_read_chain = chain;
+    }
+
+    for (pxe_buffer_chain* chain = session->write_buffer_chain; chain;
+         chain = chain->next) {
+      session->last_write_chain = chain;
+    }
+
+    session->write_queued = record.write_size;
+
+    // Epoll reports input that arrived during the handoff as soon as the
+    // socket is added.
+    pxe_game_server_watch_session(server, session);
+  }
+
+  pxe_handoff_request confirm = {PXE_HANDOFF_MAGIC, PXE_HANDOFF_VERSION};
+
+  if (!pxe_handoff_send(fd, &confirm, sizeof(confirm), -1)) return 0;
+
+  printf("Took over %u sessions.\n", header->session_count);
+  fflush(stdout);
+
+  return 1;
+}
+#endif
+
+void pxe_game_server_on_disconnect(pxe_game_server* server,
+                                   pxe_session* session,
+                                   pxe_memory_arena* arena) {
+  if (session->hot->protocol_state == PXE_PROTOCOL_STATE_PLAY) {
+    if (pxe_game_broadcast_player_info(server, session, PXE_PLAYER_INFO_REMOVE,
+                                       arena, server->write_pool) == 0) {
+      fprintf(stderr, "Failed to broadcast player info leave\n");
+    }
+
+    if (pxe_game_broadcast_destroy_entity(server, session->hot->entity_id,
+                                          arena, server->write_pool) == 0) {
+      fprintf(stderr, "Failed to broadcast entity destroy.\n");
+    }
+  }
+}
+
+// Updates the events the session's socket is polled for. The socket only waits
+// for writability while the session has output queued.
+void pxe_game_server_update_events(pxe_game_server* server,
+                                   pxe_session* session) {
+#ifdef _WIN32
+  pxe_session_page* page =
+      server->session_pages[session->slot / PXE_GAME_SERVER_SESSION_PAGE_SIZE];
+  u32 position =
+      page->live_positions[session->slot % PXE_GAME_SERVER_SESSION_PAGE_SIZE];
+  WSAPOLLFD* event = server->events + position + 1;
+
+  event->fd = session->socket.fd;
+  event->events = POLLIN;
+
+  if (session->write_registered) {
+    event->events |= POLLOUT;
+  }
+#else
+  struct epoll_event mod_event;
+  mod_event.events = EPOLLIN | EPOLLHUP;
+  mod_event.data.u64 = pxe_game_server_session_handle(server, session);
+
+  if (PXE_GAME_SERVER_EDGE_TRIGGERED) {
+    mod_event.events |= EPOLLET;
+  }
+
+  if (session->write_registered) {
+    mod_event.events |= EPOLLOUT;
+  }
+
+  if (epoll_ctl(server->epollfd, EPOLL_CTL_MOD, session->socket.fd,
+                &mod_event)) {
+    fprintf(stderr, "Failed to modify events for fd %d.\n",
+            session->socket.fd);
+  }
+#endif
+}
+
+// Moves the session's send counters into the server stats.
+void pxe_game_server_collect_stats(pxe_game_server* server,
+                                   pxe_session* session) {
+  server->stats.packets_sent += session->packets_queued;
+  server->stats.send_calls += session->send_calls;
+  server->stats.zerocopy_sends += session->zerocopy_sends;
+  server->stats.zerocopy_copied += session->zerocopy_copied;
+
+  session->packets_queued = 0;
+  session->send_calls = 0;
+  session->zerocopy_sends = 0;
+  session->zerocopy_copied = 0;
+}
+
+// Frees the session's slot. Only the last live entry moves to fill the gap,
+// so sessions can be removed while iterating live_sessions by position as long
+// as the position isn't advanced past the removed one.
+void pxe_game_server_remove_session(pxe_game_server* server,
+                                    pxe_session* session,
+                                    pxe_memory_arena* trans_arena) {
+  pxe_game_server_on_disconnect(server, session, trans_arena);
+  pxe_game_server_collect_stats(server, session);
+
+  if (session->hot->protocol_state == PXE_PROTOCOL_STATE_PLAY) {
+    pxe_game_server_unindex_session(server, session);
+  }
+
+  if (session->read_pending) {
+    --server->read_pending_count;
+  }
+
+  for (size_t i = 0; i < PXE_SESSION_TIMER_COUNT; ++i) {
+    pxe_timer_cancel(session->timers + i);
+  }
+
+#ifdef __linux__
+  if (session->io_uring_conn) {
+    // Queued buffers might still be read by a send in flight, but that send
+    // is to a socket that's being shut down.
+    pxe_io_uring_close(server->io_uring, session->io_uring_conn);
+    pxe_io_uring_conn_release(server->io_uring, session->io_uring_conn);
+    session->io_uring_conn = NULL;
+  }
+
+  if (session->reactor) {
+    pxe_reactor* reactor = session->reactor;
+    pxe_reactor_message message = {PXE_REACTOR_MESSAGE_CLOSE,
+                                   session->reactor_conn, NULL};
+
+    reactor->session_indices[session->reactor_conn] = PXE_REACTOR_NO_SESSION;
+    pxe_reactor_post(reactor, &message);
+
+    // The reactor owns the socket, so there's nothing to close here.
+    session->socket.state = PXE_SOCKET_STATE_DISCONNECTED;
+  }
+#endif
+
+  pxe_session_free(session, server);
+  pxe_socket_disconnect(&session->socket);
+
+#if PXE_OUTPUT_CONNECTIONS
+  u8 bytes[] = ENDPOINT_BYTES(session->socket.endpoint);
+  printf("%hhu.%hhu.%hhu.%hhu:%hu disconnected.\n", bytes[0], bytes[1],
+         bytes[2], bytes[3], session->socket.endpoint.sin_port);
+#endif
+
+  pxe_session_page* page =
+      server->session_pages[session->slot / PXE_GAME_SERVER_SESSION_PAGE_SIZE];
+  u32 index = session->slot % PXE_GAME_SERVER_SESSION_PAGE_SIZE;
+  u32 position = page->live_positions[index];
+  u32 last_slot = server->live_sessions[--server->session_count];
+
+  server->live_sessions[position] = last_slot;
+  server->session_pages[last_slot / PXE_GAME_SERVER_SESSION_PAGE_SIZE]
+      ->live_positions[last_slot % PXE_GAME_SERVER_SESSION_PAGE_SIZE] =
+      position;
+
+#ifdef _WIN32
+  server->events[position + 1] = server->events[--server->nevents];
+#endif
+
+  // Invalidates every handle to the session.
+  page->generations[index] = pxe_game_server_next_generation(server);
+  page->free_slots[page->free_count++] = (u16)index;
+}
+
+// Tracks how long the session's output has been backed up. Returns 0 if the
+// session should be disconnected for it.
+bool32 pxe_game_server_check_backlog(pxe_game_server* server,
+                                     pxe_session* session, i64 current_time) {
+  size_t queued = pxe_session_write_queued(session);
+
+  if (queued > server->stats.max_write_queued) {
+    server->stats.max_write_queued = queued;
+  }
+
+  if (queued < PXE_SESSION_WRITE_SOFT_LIMIT) {
+    session->write_backlog_time = 0;
+    return 1;
+  }
+
+  if (session->write_backlog_time == 0) {
+    session->write_backlog_time = current_time;
+  }
+
+  bool32 expired =
+      PXE_SESSION_WRITE_GRACE_MS > 0 &&
+      current_time - session->write_backlog_time >= PXE_SESSION_WRITE_GRACE_MS;
+
+  if (queued < PXE_SESSION_WRITE_HARD_LIMIT && !expired) return 1;
 
-      session->previous_x = session->x;
-      session->previous_y = session->y;
-      session->previous_z = session->z;
-      session->next_position_broadcast = current_time + 100;
+  printf("Disconnecting %s with %zu bytes queued.\n", session->username,
+         queued);
+  ++server->stats.evicted;
+
+  return 0;
+}
+
+// Writes out everything queued during this loop iteration, removes sessions
+// whose sockets failed while sending and registers for writability on the
+// sessions that still have output queued.
+void pxe_game_server_update_sessions(pxe_game_server* server,
+                                     pxe_memory_arena* trans_arena) {
+  i64 current_time = pxe_get_time_ms();
+
+  for (size_t i = 0; i < server->session_count;) {
+    pxe_session* session = pxe_game_server_session(server, i);
+
+    if (!pxe_game_server_check_backlog(server, session, current_time)) {
+      pxe_game_server_remove_session(server, session, trans_arena);
+      continue;
+    }
+
+#ifdef __linux__
+    if (session->io_uring_conn) {
+      pxe_io_uring_conn* conn = session->io_uring_conn;
+
+      // Completion of the send in flight submits the rest of the queue.
+      if (!conn->sending && session->write_buffer_chain &&
+          pxe_io_uring_send_chain(server->io_uring, conn,
+                                  session->write_buffer_chain,
+                                  session->write_offset)) {
+        ++session->send_calls;
+      }
+
+      pxe_game_server_collect_stats(server, session);
+
+      if (session->socket.state != PXE_SOCKET_STATE_CONNECTED) {
+        pxe_game_server_remove_session(server, session, trans_arena);
+        continue;
+      }
+
+      ++i;
+      continue;
+    }
+
+    if (session->reactor) {
+      if (session->write_buffer_chain) {
+        pxe_reactor_message message = {PXE_REACTOR_MESSAGE_SEND,
+                                       session->reactor_conn,
+                                       session->write_buffer_chain};
+
+        pxe_reactor_post(session->reactor, &message);
+        ++session->send_calls;
+
+        session->write_posted += session->write_queued;
+        session->write_buffer_chain = NULL;
+        session->last_write_chain = NULL;
+        session->write_queued = 0;
+      }
+
+      pxe_game_server_collect_stats(server, session);
+
+      if (session->socket.state != PXE_SOCKET_STATE_CONNECTED) {
+        pxe_game_server_remove_session(server, session, trans_arena);
+        continue;
+      }
+
+      ++i;
+      continue;
+    }
+#endif
+
+    if (session->zerocopy_pending > 0) {
+      pxe_session_complete_zerocopy(session, server->write_pool);
+    }
+
+    // Sessions waiting on writability get flushed once the socket is ready.
+    if (!session->write_registered) {
+      pxe_session_flush(session, trans_arena, server->write_pool);
+    }
+
+    pxe_game_server_collect_stats(server, session);
+
+    if (session->socket.state != PXE_SOCKET_STATE_CONNECTED) {
+      pxe_game_server_remove_session(server, session, trans_arena);
+      continue;
+    }
+
+    bool32 queued = session->write_buffer_chain != NULL;
+
+    if (queued != session->write_registered) {
+      session->write_registered = queued;
+      pxe_game_server_update_events(server, session);
+    }
+
+    ++i;
+  }
+
+#ifdef __linux__
+  for (size_t i = 0; i < server->reactor_count; ++i) {
+    pxe_reactor* reactor = server->reactors[i];
+
+    pxe_buffer_chain* returns = pxe_pool_take(reactor->read_returns);
+
+    if (returns) {
+      pxe_reactor_message message = {PXE_REACTOR_MESSAGE_RELEASE, 0, returns};
+
+      pxe_reactor_post(reactor, &message);
+    }
+
+    pxe_reactor_wake(reactor);
+  }
+#endif
+}
+
+// Gives back the pages of buffer slabs that sat unused since the last trim.
+// The reactors' read pools are only touched by their own threads, so they're
+// asked to trim them.
+static void pxe_game_server_trim_pools(pxe_game_server* server) {
+  server->stats.trimmed_bytes += pxe_pool_trim(server->write_pool);
+  server->stats.trimmed_bytes += pxe_pool_trim(server->read_pool);
+
+  if (chunk_pool) {
+    server->stats.trimmed_bytes += pxe_pool_trim(chunk_pool);
+  }
+
+#ifdef __linux__
+  for (size_t i = 0; i < server->reactor_count; ++i) {
+    pxe_reactor_message message = {PXE_REACTOR_MESSAGE_TRIM, 0, NULL};
+
+    pxe_reactor_post(server->reactors[i], &message);
+    pxe_reactor_wake(server->reactors[i]);
+  }
+#endif
+}
+
+void pxe_game_server_tick(pxe_game_server* server, pxe_memory_arena* perm_arena,
+                          pxe_memory_arena* trans_arena) {
+  i64 current_time = pxe_get_time_ms();
+
+  if (current_time >= server->next_trim_time) {
+    pxe_game_server_trim_pools(server);
+    server->next_trim_time = current_time + PXE_GAME_SERVER_TRIM_INTERVAL_MS;
+  }
+
+#ifdef __linux__
+  // These listen sockets aren't accepted on by this thread's own loop, so
+  // their queues are checked once per tick.
+  for (size_t i = 0; i < server->reactor_count; ++i) {
+    pxe_game_server_sample_accept_queue(server,
+                                        &server->reactors[i]->listen_socket);
+  }
+
+  if (server->io_uring) {
+    pxe_game_server_sample_accept_queue(server, &server->listen_socket);
+  }
+#endif
+
+  ++server->world_age;
+  server->world_time = (server->world_time + 1) % 24000;
+
+  float dt = 50.0f / 1000.0f;
+  pxe_timer due;
+  pxe_timer* timer;
+
+  // Only sessions with a timer that's due are touched.
+  pxe_timer_wheel_advance(&server->timers, (u64)current_time, &due);
+
+  while ((timer = pxe_timer_pop(&due))) {
+    pxe_session* session = pxe_game_server_timer_session(timer);
+    pxe_session_hot* hot = session->hot;
+
+    switch (timer->id) {
+      case PXE_SESSION_TIMER_KEEP_ALIVE: {
+        // The same id is sent again until it's answered, and the timeout
+        // runs from the first time it was sent.
+        if (!session->keep_alive_pending) {
+          session->keep_alive_pending = 1;
+          session->keep_alive_id = current_time;
+
+          pxe_game_server_schedule(
+              server, session, PXE_SESSION_TIMER_TIMEOUT,
+              current_time + PXE_GAME_SERVER_KEEP_ALIVE_TIMEOUT_MS);
+        }
+
+        pxe_game_send_keep_alive_packet(session, trans_arena,
+                                        server->write_pool,
+                                        session->keep_alive_id);
+        pxe_game_send_time(server, session, trans_arena, server->write_pool);
+
+        pxe_game_server_schedule(
+            server, session, PXE_SESSION_TIMER_KEEP_ALIVE,
+            current_time + PXE_GAME_SERVER_KEEP_ALIVE_INTERVAL_MS);
+      } break;
+      case PXE_SESSION_TIMER_POSITION: {
+        pxe_game_broadcast_player_move(server, session, trans_arena,
+                                       server->write_pool);
+
+        hot->previous_x = hot->x;
+        hot->previous_y = hot->y;
+        hot->previous_z = hot->z;
+
+        pxe_game_server_schedule(
+            server, session, PXE_SESSION_TIMER_POSITION,
+            current_time + PXE_GAME_SERVER_POSITION_INTERVAL_MS);
+      } break;
+      case PXE_SESSION_TIMER_UPDATE: {
+        if (hot->chunks_remaining > 0) {
+          pxe_game_stream_chunks(server, session, perm_arena, trans_arena);
+        }
+
+        if (hot->health > 0 && hot->health < 20.0f) {
+          i32 prev_discrete_health = (i32)hot->health;
+
+          hot->health += hot->health_regen * dt;
+
+          if (hot->health > 20.0f) {
+            hot->health = 20.0f;
+          }
+
+          if ((i32)hot->health > prev_discrete_health) {
+            pxe_game_send_health(session, trans_arena, server->write_pool);
+          }
+        }
+
+        pxe_game_server_schedule_update(server, session, current_time);
+      } break;
+      case PXE_SESSION_TIMER_TIMEOUT: {
+#if PXE_OUTPUT_CONNECTIONS
+        printf("%s timed out.\n",
+               hot->protocol_state == PXE_PROTOCOL_STATE_PLAY
+                   ? session->username
+                   : "Connection");
+#endif
+        ++server->stats.timed_out;
+        pxe_game_server_remove_session(server, session, trans_arena);
+      } break;
     }
   }
 }
 
 void pxe_game_server_run(pxe_memory_arena* perm_arena,
-                         pxe_memory_arena* trans_arena) {
-  pxe_game_server* game_server = pxe_game_server_create(perm_arena);
+                         pxe_memory_arena* trans_arena, bool32 take_over) {
+  pxe_socket* existing_socket = NULL;
+
+#if PXE_GAME_SERVER_HOT_RESTART && defined(__linux__)
+  pxe_socket handoff_socket = {0};
+  pxe_handoff_header handoff_header = {0};
+  int handoff_fd = -1;
+
+  if (take_over) {
+    pxe_handoff_request request = {PXE_HANDOFF_MAGIC, PXE_HANDOFF_VERSION};
+    int listen_fd = -1;
+
+    handoff_fd = pxe_handoff_connect(PXE_GAME_SERVER_HANDOFF_PATH);
+
+    if (handoff_fd < 0 ||
+        !pxe_handoff_send(handoff_fd, &request, sizeof(request), -1) ||
+        !pxe_handoff_receive(handoff_fd, &handoff_header,
+                             sizeof(handoff_header), &listen_fd) ||
+        listen_fd < 0) {
+      fprintf(stderr, "Failed to take over from the running server.\n");
+      return;
+    }
+
+    handoff_socket.fd = listen_fd;
+    handoff_socket.state = PXE_SOCKET_STATE_LISTENING;
+    existing_socket = &handoff_socket;
+  }
+#else
+  if (take_over) {
+    fprintf(stderr, "Hot restart isn't supported by this build.\n");
+    return;
+  }
+#endif
+
+  pxe_game_server* game_server =
+      pxe_game_server_create(perm_arena, existing_socket);
 
   if (game_server == NULL) {
     fprintf(stderr, "Failed to create game server.\n");
     return;
   }
 
+#if PXE_GAME_SERVER_HOT_RESTART && defined(__linux__)
+  if (handoff_fd >= 0) {
+    bool32 took_over =
+        pxe_game_server_take_over(game_server, handoff_fd, &handoff_header);
+
+    close(handoff_fd);
+
+    if (!took_over) {
+      fprintf(stderr, "Failed to take over sessions.\n");
+      return;
+    }
+  }
+
+  game_server->handoff_fd = pxe_handoff_listen(PXE_GAME_SERVER_HANDOFF_PATH);
+
+  if (game_server->handoff_fd >= 0) {
+    struct epoll_event handoff_event = {0};
+
+    handoff_event.events = EPOLLIN;
+    handoff_event.data.u64 = PXE_GAME_SERVER_MAX_SESSIONS + 3;
+
+    if (epoll_ctl(game_server->epollfd, EPOLL_CTL_ADD, game_server->handoff_fd,
+                  &handoff_event)) {
+      fprintf(stderr, "Failed to add handoff socket to epoll.\n");
+    }
+  } else {
+    fprintf(stderr, "Failed to listen for handoffs on %s.\n",
+            PXE_GAME_SERVER_HANDOFF_PATH);
+  }
+#endif
+
   struct timeval timeout = {0};
 
   printf("Listening for connections...\n");
@@ -1612,39 +3059,109 @@ void pxe_game_server_run(pxe_memory_arena* perm_arena,
 
   pxe_socket* listen_socket = &game_server->listen_socket;
 
+#ifdef __linux__
+  if (PXE_GAME_SERVER_BUSY_POLL &&
+      !pxe_reactor_pin_thread(PXE_GAME_SERVER_CPU)) {
+    fprintf(stderr, "Failed to pin game thread to cpu %d.\n",
+            PXE_GAME_SERVER_CPU);
+  }
+#endif
+
 #ifdef _WIN32
   game_server->events[0].fd = listen_socket->fd;
   game_server->events[0].events = POLLIN;
   game_server->events[0].revents = 0;
   game_server->nevents = 1;
 #else
-  game_server->events[0].events = EPOLLIN;
-  game_server->events[0].data.u64 = PXE_GAME_SERVER_MAX_SESSIONS + 1;
+  if (game_server->reactor_count > 0) {
+    for (size_t i = 0; i < game_server->reactor_count; ++i) {
+      if (!pxe_reactor_start(game_server->reactors[i])) {
+        fprintf(stderr, "Failed to start reactor thread.\n");
+        return;
+      }
+    }
+  } else if (game_server->io_uring) {
+    if (!pxe_io_uring_accept(game_server->io_uring, listen_socket->fd)) {
+      fprintf(stderr, "Failed to submit accept to io_uring.\n");
+      return;
+    }
+  } else {
+    game_server->events[0].events = EPOLLIN;
+    game_server->events[0].data.u64 = PXE_GAME_SERVER_MAX_SESSIONS + 1;
 
-  if (epoll_ctl(game_server->epollfd, EPOLL_CTL_ADD, listen_socket->fd,
-                game_server->events)) {
-    fprintf(stderr, "Failed to add listen socket to epoll.\n");
-    return;
+    if (epoll_ctl(game_server->epollfd, EPOLL_CTL_ADD, listen_socket->fd,
+                  game_server->events)) {
+      fprintf(stderr, "Failed to add listen socket to epoll.\n");
+      return;
+    }
   }
 #endif
 
-  i64 last_tick_time = 0;
+  i64 next_tick_time = pxe_get_time_us();
 
   while (listen_socket->state == PXE_SOCKET_STATE_LISTENING) {
+    // Sleep until the next tick is due unless there's network activity first.
+    // Rounding up means the loop never wakes just short of the deadline.
+    i64 until_tick = next_tick_time - pxe_get_time_us();
+    i32 timeout_ms = 0;
+
+    if (!PXE_GAME_SERVER_BUSY_POLL && until_tick > 0) {
+      timeout_ms = (i32)((until_tick + 999) / 1000);
+    }
+
 #ifdef _WIN32
     pxe_game_server_wsa_poll(game_server, listen_socket, perm_arena,
-                             trans_arena);
+                             trans_arena, timeout_ms);
 #else
-    pxe_game_server_epoll(game_server, listen_socket, perm_arena, trans_arena);
+    if (game_server->reactor_count > 0) {
+      pxe_game_server_poll_reactors(game_server, perm_arena, trans_arena,
+                                    timeout_ms);
+    } else if (game_server->io_uring) {
+      pxe_game_server_io_uring(game_server, perm_arena, trans_arena,
+                               timeout_ms);
+    } else {
+      pxe_game_server_epoll(game_server, listen_socket, perm_arena,
+                            trans_arena, timeout_ms);
+    }
 #endif
 
-    i64 current_time = pxe_get_time_ms();
+    // The sockets belong to the new server after a handoff.
+    if (listen_socket->state != PXE_SOCKET_STATE_LISTENING) break;
+
+    i64 current_time = pxe_get_time_us();
+
+    if (current_time >= next_tick_time) {
+      u64 jitter = (u64)(current_time - next_tick_time);
+
+      ++game_server->stats.ticks;
+      game_server->stats.tick_jitter_us += jitter;
+
+      if (jitter > game_server->stats.max_tick_jitter_us) {
+        game_server->stats.max_tick_jitter_us = jitter;
+      }
 
-    if (current_time >= last_tick_time + 50) {
       pxe_game_server_tick(game_server, perm_arena, trans_arena);
-      last_tick_time = current_time;
+      pxe_game_server_release_pages(game_server);
+
+      u64 tick_us = (u64)(pxe_get_time_us() - current_time);
+
+      game_server->stats.tick_us += tick_us;
+
+      if (tick_us > game_server->stats.max_tick_us) {
+        game_server->stats.max_tick_us = tick_us;
+      }
+
+      // Keep the ticks on a fixed schedule, but don't try to catch up on
+      // ticks that were missed entirely.
+      next_tick_time += PXE_GAME_SERVER_TICK_US;
+
+      if (next_tick_time <= current_time) {
+        next_tick_time = current_time + PXE_GAME_SERVER_TICK_US;
+      }
     }
 
+    pxe_game_server_update_sessions(game_server, trans_arena);
+
     pxe_arena_reset(trans_arena);
   }
 }
@@ -1652,65 +3169,39 @@ void pxe_game_server_run(pxe_memory_arena* perm_arena,
 void pxe_game_server_wsa_poll(pxe_game_server* game_server,
                               pxe_socket* listen_socket,
                               pxe_memory_arena* perm_arena,
-                              pxe_memory_arena* trans_arena) {
+                              pxe_memory_arena* trans_arena, i32 timeout_ms) {
 #ifdef _WIN32
-  int wsa_result = WSAPoll(game_server->events, (ULONG)game_server->nevents, 0);
+  i64 wait_start = pxe_get_time_us();
+  int wsa_result =
+      WSAPoll(game_server->events, (ULONG)game_server->nevents, timeout_ms);
+
+  pxe_game_server_record_wait(game_server, wait_start);
 
   if (wsa_result > 0) {
     if (game_server->events[0].revents != 0) {
-      pxe_socket new_socket = {0};
-
-      if (pxe_socket_accept(listen_socket, &new_socket)) {
-#if PXE_OUTPUT_CONNECTIONS
-        u8 bytes[] = ENDPOINT_BYTES(new_socket.endpoint);
-
-        printf("Accepted %hhu.%hhu.%hhu.%hhu:%hu\n", bytes[0], bytes[1],
-               bytes[2], bytes[3], new_socket.endpoint.sin_port);
-#endif
-
-        pxe_socket_set_block(&new_socket, 0);
-
-        size_t index = game_server->session_count++;
-        pxe_session* session = game_server->sessions + index;
-
-        pxe_session_initialize(session);
-
-        session->socket = new_socket;
-
-        WSAPOLLFD* new_event = game_server->events + game_server->nevents++;
-
-        new_event->fd = new_socket.fd;
-        new_event->events = POLLIN;
-        new_event->revents = 0;
-      }
+      pxe_game_server_accept_sessions(game_server, listen_socket);
     }
 
     for (size_t event_index = 1; event_index < game_server->nevents;) {
-      if (game_server->events[event_index].revents != 0) {
-        size_t session_index = event_index - 1;
-        pxe_session* session = &game_server->sessions[session_index];
-
-        if (pxe_game_server_read_session(game_server, perm_arena, trans_arena,
-                                         session) == 0) {
-          pxe_game_server_on_disconnect(game_server, session, trans_arena);
-
-          pxe_session_free(session, game_server);
-          pxe_socket_disconnect(&session->socket);
+      SHORT revents = game_server->events[event_index].revents;
 
-          // Swap the last session to the current position then decrement
-          // session count so this session is removed.
-          game_server->sessions[session_index] =
-              game_server->sessions[--game_server->session_count];
+      if (revents != 0) {
+        pxe_session* session =
+            pxe_game_server_session(game_server, event_index - 1);
+        bool32 connected = 1;
 
-          game_server->events[event_index] =
-              game_server->events[--game_server->nevents];
+        if (revents & POLLOUT) {
+          connected =
+              pxe_session_flush(session, trans_arena, game_server->write_pool);
+        }
 
-#if PXE_OUTPUT_CONNECTIONS
-          u8 bytes[] = ENDPOINT_BYTES(session->socket.endpoint);
+        if (connected && (revents & ~POLLOUT)) {
+          connected = pxe_game_server_read_session(game_server, perm_arena,
+                                                   trans_arena, session);
+        }
 
-          printf("%hhu.%hhu.%hhu.%hhu:%hu disconnected.\n", bytes[0], bytes[1],
-                 bytes[2], bytes[3], session->socket.endpoint.sin_port);
-#endif
+        if (!connected) {
+          pxe_game_server_remove_session(game_server, session, trans_arena);
           continue;
         }
       }
@@ -1731,86 +3222,292 @@ void pxe_game_server_wsa_poll(pxe_game_server* game_server,
 void pxe_game_server_epoll(pxe_game_server* game_server,
                            pxe_socket* listen_socket,
                            pxe_memory_arena* perm_arena,
-                           pxe_memory_arena* trans_arena) {
+                           pxe_memory_arena* trans_arena, i32 timeout_ms) {
 #ifndef _WIN32
+  // Sessions with input left over from the last iteration can't wait.
+  if (game_server->read_pending_count > 0) {
+    timeout_ms = 0;
+  }
+
+  i64 wait_start = pxe_get_time_us();
   int nfds = epoll_wait(game_server->epollfd, game_server->events,
-                        PXE_GAME_SERVER_MAX_SESSIONS, 0);
+                        PXE_GAME_SERVER_EVENT_BATCH, timeout_ms);
+
+  pxe_game_server_record_wait(game_server, wait_start);
+
+  for (size_t i = 0;
+       game_server->read_pending_count > 0 && i < game_server->session_count;) {
+    pxe_session* session = pxe_game_server_session(game_server, i);
+
+    if (session->read_pending &&
+        !pxe_game_server_read_session(game_server, perm_arena, trans_arena,
+                                      session)) {
+      pxe_game_server_remove_session(game_server, session, trans_arena);
+      continue;
+    }
+
+    ++i;
+  }
 
   for (int event_index = 0; event_index < nfds; ++event_index) {
     struct epoll_event* event = game_server->events + event_index;
 
     if (event->data.u64 == PXE_GAME_SERVER_MAX_SESSIONS + 1) {
-      pxe_socket new_socket = {0};
+      pxe_game_server_accept_sessions(game_server, listen_socket);
+#if PXE_GAME_SERVER_HOT_RESTART && defined(__linux__)
+    } else if (event->data.u64 == PXE_GAME_SERVER_MAX_SESSIONS + 3) {
+      if (pxe_game_server_hand_off(game_server)) {
+        listen_socket->state = PXE_SOCKET_STATE_DISCONNECTED;
+        return;
+      }
+#endif
+    } else {
+      pxe_session* session =
+          pxe_game_server_resolve_session(game_server, event->data.u64);
 
-      if (pxe_socket_accept(listen_socket, &new_socket)) {
-#if PXE_OUTPUT_CONNECTIONS
-        u8 bytes[] = ENDPOINT_BYTES(new_socket.endpoint);
+      // The session this event was for was already removed during this loop.
+      if (session == NULL) continue;
+
+      bool32 connected = 1;
+
+      if (event->events & EPOLLOUT) {
+        connected =
+            pxe_session_flush(session, trans_arena, game_server->write_pool);
+      }
 
-        printf("Accepted %hhu.%hhu.%hhu.%hhu:%hu\n", bytes[0], bytes[1],
-               bytes[2], bytes[3], new_socket.endpoint.sin_port);
+      // Sessions with pending input were already read this iteration.
+      if (connected && !session->read_pending &&
+          (event->events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+        connected = pxe_game_server_read_session(game_server, perm_arena,
+                                                 trans_arena, session);
+      }
+
+      if (!connected) {
+        pxe_game_server_remove_session(game_server, session, trans_arena);
+        continue;
+      }
+    }
+    fflush(stdout);
+  }
 #endif
+}
+
+void pxe_game_server_io_uring(pxe_game_server* game_server,
+                              pxe_memory_arena* perm_arena,
+                              pxe_memory_arena* trans_arena, i32 timeout_ms) {
+#ifdef __linux__
+  pxe_io_uring* ring = game_server->io_uring;
+
+  // Everything queued since the last loop goes to the kernel in one call.
+  i64 wait_start = pxe_get_time_us();
+
+  pxe_io_uring_wait(ring, timeout_ms);
+  pxe_game_server_record_wait(game_server, wait_start);
 
-        pxe_socket_set_block(&new_socket, 0);
+  struct io_uring_cqe* cqe;
 
-        size_t index = game_server->session_count++;
-        pxe_session* session = game_server->sessions + index;
+  while ((cqe = pxe_io_uring_peek_cqe(ring)) != NULL) {
+    u64 user_data = cqe->user_data;
+    i32 result = cqe->res;
+    u32 flags = cqe->flags;
 
-        pxe_session_initialize(session);
+    pxe_io_uring_cqe_seen(ring);
 
-        session->socket = new_socket;
+    pxe_io_uring_op op = (pxe_io_uring_op)(user_data & PXE_IO_URING_OP_MASK);
+    pxe_io_uring_conn* conn =
+        (pxe_io_uring_conn*)(uintptr_t)(user_data & ~(u64)PXE_IO_URING_OP_MASK);
 
-        struct epoll_event new_event = {0};
+    switch (op) {
+      case PXE_IO_URING_OP_ACCEPT: {
+        pxe_session* session = NULL;
 
-        new_event.events = EPOLLIN | EPOLLHUP;
-        new_event.data.u64 = index;
+        if (result >= 0) {
+          pxe_socket new_socket = {0};
 
-        if (epoll_ctl(game_server->epollfd, EPOLL_CTL_ADD, new_socket.fd,
-                      &new_event)) {
-          fprintf(stderr, "Failed to add new socket to epoll.\n");
+          ++game_server->stats.accepted;
+
+          new_socket.fd = result;
+          new_socket.state = PXE_SOCKET_STATE_CONNECTED;
+
+          session = pxe_game_server_add_session(game_server, &new_socket);
+
+          if (session == NULL) {
+            close(result);
+          }
+        } else {
+          fprintf(stderr, "Failed to accept new socket\n");
         }
-      } else {
-        fprintf(stderr, "Failed to accept new socket\n");
-      }
-    } else {
-      size_t session_index = (size_t)event->data.u64;
-      pxe_session* session = game_server->sessions + session_index;
 
-      if (pxe_game_server_read_session(game_server, perm_arena, trans_arena,
-                                       session) == 0) {
-        pxe_game_server_on_disconnect(game_server, session, trans_arena);
+        if (session) {
+          session->io_uring_conn =
+              pxe_io_uring_conn_create(ring, session, result);
 
-        pxe_session_free(session, game_server);
-        pxe_socket_disconnect(&session->socket);
+          if (!pxe_io_uring_recv(ring, session->io_uring_conn)) {
+            session->socket.state = PXE_SOCKET_STATE_ERROR;
+          }
+        }
 
-#if PXE_OUTPUT_CONNECTIONS
-        u8 bytes[] = ENDPOINT_BYTES(session->socket.endpoint);
-        printf("%hhu.%hhu.%hhu.%hhu:%hu disconnected.\n", bytes[0], bytes[1],
-               bytes[2], bytes[3], session->socket.endpoint.sin_port);
+        if (!(flags & IORING_CQE_F_MORE)) {
+          pxe_io_uring_accept(ring, game_server->listen_socket.fd);
+        }
+      } break;
+      case PXE_IO_URING_OP_RECV: {
+        pxe_buffer_chain* chain = NULL;
+
+        if (flags & IORING_CQE_F_BUFFER) {
+          u16 bid = (u16)(flags >> IORING_CQE_BUFFER_SHIFT);
+
+          chain = pxe_io_uring_take_buffer(ring, bid, result > 0 ? result : 0);
+        }
+
+        if (!(flags & IORING_CQE_F_MORE)) {
+          conn->recv_armed = 0;
+          --conn->pending;
+        }
+
+        pxe_session* session = conn->session;
+
+        if (session == NULL) {
+          pxe_pool_free(game_server->read_pool, chain, 1);
+          pxe_io_uring_conn_release(ring, conn);
+          break;
+        }
+
+        bool32 connected = 1;
+
+        if (result > 0 && chain) {
+          connected = pxe_game_server_receive_chain(
+              game_server, perm_arena, trans_arena, session, chain);
+        } else {
+          pxe_pool_free(game_server->read_pool, chain, 1);
+
+          // The recv stops when the kernel runs out of buffers, so it's
+          // submitted again now that they have been replaced.
+          connected = result == -ENOBUFS;
+        }
+
+        if (connected && !conn->recv_armed) {
+          connected = pxe_io_uring_recv(ring, conn);
+        }
+
+        if (!connected) {
+          pxe_game_server_remove_session(game_server, session, trans_arena);
+        }
+      } break;
+      case PXE_IO_URING_OP_SEND: {
+        pxe_session* session = conn->session;
+
+        conn->sending = 0;
+        --conn->pending;
+
+        if (session == NULL) {
+          pxe_io_uring_conn_release(ring, conn);
+          break;
+        }
+
+        if (result < 0) {
+          session->socket.error_code = -result;
+          session->socket.state = PXE_SOCKET_STATE_ERROR;
+        } else {
+          pxe_session_consume_sent(session, game_server->write_pool,
+                                   (size_t)result);
+        }
+      } break;
+      default: {
+      } break;
+    }
+  }
+
+  fflush(stdout);
 #endif
+}
+
+// Handles the connections and whole packets that the reactor threads have
+// queued since the last loop.
+void pxe_game_server_poll_reactors(pxe_game_server* game_server,
+                                   pxe_memory_arena* perm_arena,
+                                   pxe_memory_arena* trans_arena,
+                                   i32 timeout_ms) {
+#ifdef __linux__
+  i64 wait_start = pxe_get_time_us();
+  struct epoll_event event;
+
+  if (epoll_wait(game_server->epollfd, &event, 1, timeout_ms) > 0) {
+    u64 value;
+
+    // Reset before draining so messages queued from here on wake the next
+    // wait.
+    if (read(game_server->wakefd, &value, sizeof(value)) < 0) {
+      // Another wait already reset it.
+    }
+  }
 
-        // Swap the last session to the current position then decrement
-        // session count so this session is removed.
-        game_server->sessions[session_index] =
-            game_server->sessions[--game_server->session_count];
-
-        if (session_index < game_server->session_count) {
-          struct epoll_event mod_event;
-          mod_event.events = EPOLLIN | EPOLLHUP;
-          mod_event.data.u64 = session_index;
-
-          // The session pointer now points to the swapped session, so the event
-          // should be modified to point to the new session index.
-          if (epoll_ctl(game_server->epollfd, EPOLL_CTL_MOD, session->socket.fd,
-                        &mod_event)) {
-            fprintf(stderr, "Failed to modify event session index for fd %d.\n",
-                    session->socket.fd);
+  pxe_game_server_record_wait(game_server, wait_start);
+
+  for (size_t i = 0; i < game_server->reactor_count; ++i) {
+    pxe_reactor* reactor = game_server->reactors[i];
+    pxe_reactor_message message;
+
+    while (pxe_spsc_queue_pop(&reactor->inbound, &message)) {
+      u32 session_index = PXE_REACTOR_NO_SESSION;
+
+      if (message.type != PXE_REACTOR_MESSAGE_RELEASE) {
+        session_index = reactor->session_indices[message.conn];
+      }
+
+      switch (message.type) {
+        case PXE_REACTOR_MESSAGE_CONNECT: {
+          ++game_server->stats.accepted;
+
+          pxe_session* session = pxe_game_server_alloc_session(game_server);
+
+          if (session == NULL) {
+            pxe_reactor_message close = {PXE_REACTOR_MESSAGE_CLOSE,
+                                         message.conn, NULL};
+
+            pxe_reactor_post(reactor, &close);
+            break;
           }
-        }
 
-        continue;
+          session->socket.state = PXE_SOCKET_STATE_CONNECTED;
+          session->reactor = reactor;
+          session->reactor_conn = message.conn;
+
+          reactor->session_indices[message.conn] = session->slot;
+        } break;
+        case PXE_REACTOR_MESSAGE_PACKETS: {
+          if (session_index == PXE_REACTOR_NO_SESSION) {
+            // The session was removed after the reactor read these.
+            pxe_pool_free(reactor->read_returns, message.chain, 1);
+            break;
+          }
+
+          pxe_session* session =
+              pxe_game_server_slot_session(game_server, session_index);
+          // Everything processed is freed straight back to the reactor's
+          // returns.
+          bool32 connected = pxe_game_server_receive_chain(
+              game_server, perm_arena, trans_arena, session, message.chain);
+
+          if (!connected) {
+            pxe_game_server_remove_session(game_server, session, trans_arena);
+          }
+        } break;
+        case PXE_REACTOR_MESSAGE_DISCONNECT: {
+          if (session_index != PXE_REACTOR_NO_SESSION) {
+            pxe_game_server_remove_session(
+                game_server,
+                pxe_game_server_slot_session(game_server, session_index),
+                trans_arena);
+          }
+        } break;
+        case PXE_REACTOR_MESSAGE_RELEASE: {
+          pxe_pool_free(game_server->write_pool, message.chain, 1);
+        } break;
+        default: {
+        } break;
       }
     }
-    fflush(stdout);
   }
 #endif
 }
@@ -4,25 +4,230 @@
 #include "pixie.h"
 #include "pxe_buffer.h"
 #include "pxe_session.h"
+#include "pxe_session_index.h"
 #include "pxe_socket.h"
+#include "pxe_timer_wheel.h"
 
 #ifndef _WIN32
 #include <sys/epoll.h>
 #endif
 
-#define PXE_GAME_SERVER_MAX_SESSIONS 4096
+// Most sessions the server holds at once. Connections past it are closed as
+// soon as they're accepted.
+#ifndef PXE_GAME_SERVER_MAX_SESSIONS
+#define PXE_GAME_SERVER_MAX_SESSIONS 16384
+#endif
+
+// Sessions are allocated in pages of this many slots as the server fills up,
+// and pages left without sessions are given back on the next tick. Must be a
+// power of two no larger than 65536.
+#ifndef PXE_GAME_SERVER_SESSION_PAGE_SIZE
+#define PXE_GAME_SERVER_SESSION_PAGE_SIZE 256
+#endif
+
+#define PXE_GAME_SERVER_SESSION_PAGES                                      \
+  ((PXE_GAME_SERVER_MAX_SESSIONS + PXE_GAME_SERVER_SESSION_PAGE_SIZE - 1) / \
+   PXE_GAME_SERVER_SESSION_PAGE_SIZE)
+
+// Most socket events handled per wait. Any others are returned by the next.
+#define PXE_GAME_SERVER_EVENT_BATCH 1024
+
+// Refers to a session by its slot in the server and the slot's generation,
+// which changes every time the slot is freed. A handle kept past the
+// session's removal won't resolve to whatever session reuses the slot.
+// Generations start at 1, so small values are free for other epoll events.
+typedef u64 pxe_session_handle;
+
+// Runs the network loop on io_uring instead of epoll. The server falls back to
+// epoll if the kernel doesn't support it.
+#ifndef PXE_GAME_SERVER_IO_URING
+#define PXE_GAME_SERVER_IO_URING 0
+#endif
+
+// Number of network threads. Each one accepts on its own SO_REUSEPORT socket
+// and does the socket reads, framing and writes for its connections, while the
+// game thread only handles whole packets. Zero keeps all of the networking on
+// the game thread.
+#ifndef PXE_GAME_SERVER_REACTORS
+#define PXE_GAME_SERVER_REACTORS 0
+#endif
+
+#define PXE_GAME_SERVER_MAX_REACTORS 64
+
+// Largest packet a client can send, which is the most a three byte length
+// varint can hold. Longer lengths close the connection.
+#define PXE_GAME_SERVER_MAX_PACKET_SIZE ((1 << 21) - 1)
+
+#define PXE_GAME_SERVER_TICK_US 50000
+// How often each player's movement is sent to the others.
+#define PXE_GAME_SERVER_POSITION_INTERVAL_MS 100
+// How often keep-alives are sent to each player.
+#define PXE_GAME_SERVER_KEEP_ALIVE_INTERVAL_MS 10000
+// Players that don't answer a keep-alive within this long are disconnected.
+#ifndef PXE_GAME_SERVER_KEEP_ALIVE_TIMEOUT_MS
+#define PXE_GAME_SERVER_KEEP_ALIVE_TIMEOUT_MS 30000
+#endif
+// Connections that haven't reached the play state by this long after being
+// accepted are disconnected.
+#ifndef PXE_GAME_SERVER_LOGIN_TIMEOUT_MS
+#define PXE_GAME_SERVER_LOGIN_TIMEOUT_MS 30000
+#endif
+// How often the buffer pools give back the memory of slabs that went unused
+// since the last time, so a slab is given back after one to two of these.
+#ifndef PXE_GAME_SERVER_TRIM_INTERVAL_MS
+#define PXE_GAME_SERVER_TRIM_INTERVAL_MS 10000
+#endif
+// Most players listed in the sample of the status response.
+#define PXE_GAME_SERVER_STATUS_SAMPLE_SIZE 12
+// Chunks in each direction from spawn that are sent to new players.
+#define PXE_GAME_SERVER_VIEW_RADIUS 5
+#define PXE_GAME_SERVER_VIEW_DIAMETER (PXE_GAME_SERVER_VIEW_RADIUS * 2 + 1)
+#define PXE_GAME_SERVER_SPAWN_CHUNKS \
+  (PXE_GAME_SERVER_VIEW_DIAMETER * PXE_GAME_SERVER_VIEW_DIAMETER)
+
+// Connections that can wait to be accepted. The kernel caps this at
+// net.core.somaxconn.
+#ifndef PXE_GAME_SERVER_BACKLOG
+#define PXE_GAME_SERVER_BACKLOG 1024
+#endif
+
+// Registers sessions with epoll as edge-triggered. Each ready socket is then
+// drained with vectored reads until it would block or the session used up
+// PXE_GAME_SERVER_READ_BUDGET bytes for this loop iteration, in which case the
+// rest is read on the next iteration.
+#ifndef PXE_GAME_SERVER_EDGE_TRIGGERED
+#define PXE_GAME_SERVER_EDGE_TRIGGERED 1
+#endif
+
+#ifndef PXE_GAME_SERVER_READ_BUDGET
+#define PXE_GAME_SERVER_READ_BUDGET pxe_kilobytes(16)
+#endif
+
+// Microseconds that sockets spin on the device queue before sleeping. When set,
+// the network loop polls without ever sleeping and each thread is pinned to its
+// own CPU starting at PXE_GAME_SERVER_CPU. This trades a busy core for lower
+// latency, so it's only meant for dedicated machines. Otherwise the loop
+// sleeps until the next event or tick.
+#ifndef PXE_GAME_SERVER_BUSY_POLL
+#define PXE_GAME_SERVER_BUSY_POLL 0
+#endif
+
+#ifndef PXE_GAME_SERVER_CPU
+#define PXE_GAME_SERVER_CPU 0
+#endif
+
+// Listens on a Unix socket at PXE_GAME_SERVER_HANDOFF_PATH for a newer server
+// started with --upgrade. The new process takes over the listen socket and
+// every session, including their unprocessed input and unsent output, and
+// this one exits, so the server can be replaced without players reconnecting.
+// Only the epoll backend supports it.
+#ifndef PXE_GAME_SERVER_HOT_RESTART
+#if PXE_GAME_SERVER_REACTORS == 0 && !PXE_GAME_SERVER_IO_URING
+#define PXE_GAME_SERVER_HOT_RESTART 1
+#else
+#define PXE_GAME_SERVER_HOT_RESTART 0
+#endif
+#endif
+
+#ifndef PXE_GAME_SERVER_HANDOFF_PATH
+#define PXE_GAME_SERVER_HANDOFF_PATH "pixie.handoff"
+#endif
+
+typedef struct pxe_game_server_stats {
+  // Packets that were queued to be sent to sessions.
+  u64 packets_sent;
+  // Socket send calls made for those packets. The difference between the two
+  // is the number of syscalls saved by coalescing writes.
+  u64 send_calls;
+  // Sends made without a copy and those the kernel ended up copying anyway.
+  u64 zerocopy_sends;
+  u64 zerocopy_copied;
+
+  i64 start_time_us;
+  // Times the loop returned from waiting on the network.
+  u64 wakeups;
+  // Time spent waiting on the network.
+  u64 idle_us;
+  u64 ticks;
+  // Time spent running ticks, which grows with the number of sessions.
+  u64 tick_us;
+  u64 max_tick_us;
+  // How late ticks started compared to their deadline.
+  u64 tick_jitter_us;
+  u64 max_tick_jitter_us;
+
+  u64 accepted;
+  // Connections closed because the server was full.
+  u64 rejected;
+  // Times the accept queue was found full, which means the kernel was
+  // dropping connection attempts.
+  u64 accept_queue_full;
+  u32 max_accept_queue;
+
+  // Packets skipped for sessions whose output was backed up.
+  u64 dropped_packets;
+  // Sessions disconnected for letting their output back up.
+  u64 evicted;
+  // Sessions disconnected for not logging in or answering keep-alives in time.
+  u64 timed_out;
+  u64 max_write_queued;
+  // Memory of idle buffer slabs given back by the game thread's pools.
+  u64 trimmed_bytes;
+} pxe_game_server_stats;
+
+// A page of session slots. Slot numbers count through the pages in order, so
+// slot / PXE_GAME_SERVER_SESSION_PAGE_SIZE is the page a slot is on.
+typedef struct pxe_session_page {
+  // The hot data of the session in the same slot.
+  pxe_session_hot hot[PXE_GAME_SERVER_SESSION_PAGE_SIZE];
+  // A session stays in its slot for as long as it's connected, so pointers
+  // to it stay valid until it's removed.
+  pxe_session sessions[PXE_GAME_SERVER_SESSION_PAGE_SIZE];
+  u32 generations[PXE_GAME_SERVER_SESSION_PAGE_SIZE];
+  // Where each connected slot is in the server's live_sessions.
+  u32 live_positions[PXE_GAME_SERVER_SESSION_PAGE_SIZE];
+  u16 free_slots[PXE_GAME_SERVER_SESSION_PAGE_SIZE];
+  u32 free_count;
+  // Slots on this page, which is less than the page size on the last page if
+  // the limit isn't a multiple of it.
+  u32 capacity;
+} pxe_session_page;
 
 typedef struct pxe_game_server {
   pxe_socket listen_socket;
-  pxe_session sessions[PXE_GAME_SERVER_MAX_SESSIONS];
+  // NULL for pages that aren't in use.
+  pxe_session_page* session_pages[PXE_GAME_SERVER_SESSION_PAGES];
+  // Changed every time a slot is freed or a page is created. Handles only
+  // ever get a generation once, so one can't match a later session even
+  // after its page was released and created again.
+  u32 next_generation;
+  // Slots of the connected sessions packed together for iterating. Removing
+  // one moves the last slot number into its place.
+  u32 live_sessions[PXE_GAME_SERVER_MAX_SESSIONS];
   size_t session_count;
+  // Handles of the sessions in the play state by entity id, UUID and
+  // lowercase username.
+  pxe_session_index sessions_by_eid;
+  pxe_session_index sessions_by_uuid;
+  pxe_session_index sessions_by_name;
+  // Sessions that still have input left after using up their read budget.
+  size_t read_pending_count;
+  // Deadlines of the sessions' timers in milliseconds of the monotonic clock.
+  pxe_timer_wheel timers;
+  // When the buffer pools are trimmed next, in milliseconds.
+  i64 next_trim_time;
 
 #ifdef _WIN32
-  WSAPOLLFD events[PXE_GAME_SERVER_MAX_SESSIONS];
+  // The listen socket followed by one entry per live_sessions entry.
+  WSAPOLLFD events[PXE_GAME_SERVER_MAX_SESSIONS + 1];
   size_t nevents;
 #else
   int epollfd;
-  struct epoll_event events[PXE_GAME_SERVER_MAX_SESSIONS];
+  struct epoll_event events[PXE_GAME_SERVER_EVENT_BATCH];
+  // Signaled by the reactors when they queue messages for the game thread.
+  int wakefd;
+  // Accepts the process that takes over from this one. -1 if unused.
+  int handoff_fd;
 #endif
 
   i32 next_entity_id;
@@ -31,10 +236,81 @@ typedef struct pxe_game_server {
 
   pxe_pool* write_pool;
   pxe_pool* read_pool;
+  // Holds the packet being processed when it's split across read buffers.
+  // It's reset before each packet, so it only needs room for the largest one
+  // no matter how many arrive in an iteration.
+  pxe_memory_arena packet_arena;
+  // Packets broadcast to many sessions, framed once in write_pool buffers.
+  pxe_shared_pool* shared_pool;
+  // The status response for server list pings, framed once and shared by
+  // every ping until a player joins or leaves. It's rebuilt by the next ping
+  // after that.
+  pxe_shared_frame* status_frame;
+  bool32 status_stale;
+  // Chunk Data for each spawn chunk, framed the first time a player needs it.
+  // The chunks never change, so every later player shares the same frames and
+  // each is only compressed once.
+  pxe_shared_frame* chunk_frames[PXE_GAME_SERVER_SPAWN_CHUNKS];
+
+  pxe_game_server_stats stats;
+
+  // Set when the network loop runs on io_uring.
+  struct pxe_io_uring* io_uring;
+
+  struct pxe_reactor* reactors[PXE_GAME_SERVER_MAX_REACTORS];
+  size_t reactor_count;
 } pxe_game_server;
 
-pxe_game_server* pxe_game_server_create(struct pxe_memory_arena* perm_arena);
+struct pxe_io_uring;
+struct pxe_reactor;
+
+// Returns the session in a slot that's in use.
+static inline pxe_session* pxe_game_server_slot_session(pxe_game_server* server,
+                                                        u32 slot) {
+  return server->session_pages[slot / PXE_GAME_SERVER_SESSION_PAGE_SIZE]
+             ->sessions +
+         slot % PXE_GAME_SERVER_SESSION_PAGE_SIZE;
+}
+
+// Returns the i-th connected session.
+static inline pxe_session* pxe_game_server_session(pxe_game_server* server,
+                                                   size_t i) {
+  return pxe_game_server_slot_session(server, server->live_sessions[i]);
+}
+
+// Returns the hot data of the i-th connected session without touching the
+// rest of the session.
+static inline pxe_session_hot* pxe_game_server_session_hot(
+    pxe_game_server* server, size_t i) {
+  u32 slot = server->live_sessions[i];
+
+  return server->session_pages[slot / PXE_GAME_SERVER_SESSION_PAGE_SIZE]->hot +
+         slot % PXE_GAME_SERVER_SESSION_PAGE_SIZE;
+}
+
+pxe_session_handle pxe_game_server_session_handle(pxe_game_server* server,
+                                                  pxe_session* session);
+// Returns NULL if the session the handle was made for has been removed.
+pxe_session* pxe_game_server_resolve_session(pxe_game_server* server,
+                                             pxe_session_handle handle);
+
+// These only find sessions in the play state and return NULL otherwise. Names
+// are matched ignoring case.
+pxe_session* pxe_game_server_get_session_by_eid(pxe_game_server* server,
+                                                i32 eid);
+pxe_session* pxe_game_server_get_session_by_uuid(pxe_game_server* server,
+                                                 pxe_uuid* uuid);
+pxe_session* pxe_game_server_get_session_by_name(pxe_game_server* server,
+                                                 const char* name);
+
+// Uses listen_socket for new connections if it's not NULL. Otherwise the
+// server listens on its own.
+pxe_game_server* pxe_game_server_create(struct pxe_memory_arena* perm_arena,
+                                        pxe_socket* listen_socket);
+// With take_over set, the server takes the listen socket and sessions over from
+// the server that's already running instead of starting fresh.
 void pxe_game_server_run(struct pxe_memory_arena* perm_arena,
-                         struct pxe_memory_arena* trans_arena);
+                         struct pxe_memory_arena* trans_arena,
+                         bool32 take_over);
 
 #endif
@@ -0,0 +1,259 @@
+#include "pxe_handoff.h"
+
+#ifdef __linux__
+
+#include "pxe_alloc.h"
+#include "pxe_buffer.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static bool32 pxe_handoff_address(const char* path, struct sockaddr_un* addr) {
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+
+  if (strlen(path) >= sizeof(addr->sun_path)) {
+    fprintf(stderr, "Handoff socket path is too long: %s\n", path);
+    return 0;
+  }
+
+  strcpy(addr->sun_path, path);
+
+  return 1;
+}
+
+int pxe_handoff_listen(const char* path) {
+  struct sockaddr_un addr;
+
+  if (!pxe_handoff_address(path, &addr)) return -1;
+
+  // Sequenced packets keep message boundaries, so each descriptor arrives
+  // with exactly the record it belongs to.
+  int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+  if (fd < 0) return -1;
+
+  unlink(path);
+
+  if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+      listen(fd, 1) != 0) {
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+int pxe_handoff_accept(int listen_fd) {
+  int fd = accept(listen_fd, NULL, NULL);
+
+  if (fd < 0) return -1;
+
+  // The handoff is done in one go, so the connection is used blocking.
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) & ~O_NONBLOCK);
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+  return fd;
+}
+
+int pxe_handoff_connect(const char* path) {
+  struct sockaddr_un addr;
+
+  if (!pxe_handoff_address(path, &addr)) return -1;
+
+  int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+
+  if (fd < 0) return -1;
+
+  if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+bool32 pxe_handoff_send(int fd, const void* data, size_t size, int pass_fd) {
+  struct iovec iov = {(void*)data, size};
+  struct msghdr msg = {0};
+  union {
+    struct cmsghdr header;
+    char data[CMSG_SPACE(sizeof(int))];
+  } control;
+
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+
+  if (pass_fd >= 0) {
+    memset(&control, 0, sizeof(control));
+
+    msg.msg_control = control.data;
+    msg.msg_controllen = sizeof(control.data);
+
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &pass_fd, sizeof(int));
+  }
+
+  ssize_t sent;
+
+  do {
+    sent = sendmsg(fd, &msg, MSG_NOSIGNAL);
+  } while (sent < 0 && errno == EINTR);
+
+  return sent == (ssize_t)size;
+}
+
+bool32 pxe_handoff_receive(int fd, void* data, size_t size, int* pass_fd) {
+  struct iovec iov = {data, size};
+  struct msghdr msg = {0};
+  union {
+    struct cmsghdr header;
+    char data[CMSG_SPACE(sizeof(int))];
+  } control;
+
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.data;
+  msg.msg_controllen = sizeof(control.data);
+
+  ssize_t received;
+
+  do {
+    received = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+  } while (received < 0 && errno == EINTR);
+
+  int received_fd = -1;
+  struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+
+  if (received > 0 && cmsg && cmsg->cmsg_level == SOL_SOCKET &&
+      cmsg->cmsg_type == SCM_RIGHTS) {
+    memcpy(&received_fd, CMSG_DATA(cmsg), sizeof(int));
+  }
+
+  if (pass_fd) {
+    *pass_fd = received_fd;
+  } else if (received_fd >= 0) {
+    close(received_fd);
+  }
+
+  if (received != (ssize_t)size || (msg.msg_flags & MSG_TRUNC)) {
+    if (pass_fd && received_fd >= 0) {
+      close(received_fd);
+      *pass_fd = -1;
+    }
+
+    return 0;
+  }
+
+  return 1;
+}
+
+bool32 pxe_handoff_send_chain(int fd, pxe_buffer_chain* chain, size_t offset,
+                              size_t size) {
+  u8 message[PXE_HANDOFF_MESSAGE_SIZE];
+  size_t message_size = 0;
+
+  for (; chain && size > 0; chain = chain->next) {
+    pxe_buffer* buffer = chain->buffer;
+
+    if (offset >= buffer->size) {
+      offset -= buffer->size;
+      continue;
+    }
+
+    u8* data = buffer->data + offset;
+    size_t remaining = buffer->size - offset;
+
+    offset = 0;
+
+    if (remaining > size) {
+      remaining = size;
+    }
+
+    size -= remaining;
+
+    while (remaining > 0) {
+      size_t copy_size = sizeof(message) - message_size;
+
+      if (copy_size > remaining) {
+        copy_size = remaining;
+      }
+
+      memcpy(message + message_size, data, copy_size);
+
+      message_size += copy_size;
+      data += copy_size;
+      remaining -= copy_size;
+
+      if (message_size == sizeof(message) || (size == 0 && remaining == 0)) {
+        if (!pxe_handoff_send(fd, message, message_size, -1)) return 0;
+
+        message_size = 0;
+      }
+    }
+  }
+
+  return size == 0;
+}
+
+bool32 pxe_handoff_receive_chain(int fd, pxe_pool* pool, size_t size,
+                                 pxe_buffer_chain** chain) {
+  u8 message[PXE_HANDOFF_MESSAGE_SIZE];
+  pxe_buffer_chain* last = NULL;
+
+  *chain = NULL;
+
+  while (size > 0) {
+    size_t message_size = size;
+
+    if (message_size > sizeof(message)) {
+      message_size = sizeof(message);
+    }
+
+    if (!pxe_handoff_receive(fd, message, message_size, NULL)) return 0;
+
+    size -= message_size;
+
+    for (u8* data = message; message_size > 0;) {
+      if (last == NULL || last->buffer->size >= last->buffer->max_size) {
+        // Sized for everything that's left so it ends up in few buffers.
+        pxe_buffer_chain* new_chain =
+            pxe_pool_alloc_size(pool, size + message_size);
+
+        if (last == NULL) {
+          *chain = new_chain;
+        } else {
+          last->next = new_chain;
+        }
+
+        last = new_chain;
+      }
+
+      pxe_buffer* buffer = last->buffer;
+      size_t copy_size = buffer->max_size - buffer->size;
+
+      if (copy_size > message_size) {
+        copy_size = message_size;
+      }
+
+      memcpy(buffer->data + buffer->size, data, copy_size);
+
+      buffer->size += copy_size;
+      data += copy_size;
+      message_size -= copy_size;
+    }
+  }
+
+  return 1;
+}
+
+#endif
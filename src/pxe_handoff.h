@@ -0,0 +1,109 @@
+#ifndef PIXIE_HANDOFF_H_
+#define PIXIE_HANDOFF_H_
+
+#include "pixie.h"
+
+#ifdef __linux__
+#include <netinet/in.h>
+
+#include "pxe_uuid.h"
+
+// Lets a freshly started server take the listen socket and every connected
+// session over from the running one, so it can be replaced without players
+// having to reconnect. The new process connects to the old one's handoff
+// socket and everything is sent over it in order:
+//   pxe_handoff_request from the new process
+//   pxe_handoff_header with the listen socket attached
+//   for each session, pxe_handoff_session with its socket attached, followed
+//   by read_size bytes of unprocessed input and write_size bytes of unsent
+//   output
+// Both processes need the same version, which has to change whenever any of
+// these structs do.
+#define PXE_HANDOFF_MAGIC 0x50584548
+#define PXE_HANDOFF_VERSION 4
+// Largest message used for session data.
+#define PXE_HANDOFF_MESSAGE_SIZE pxe_kilobytes(32)
+
+typedef struct pxe_handoff_request {
+  u32 magic;
+  u32 version;
+} pxe_handoff_request;
+
+typedef struct pxe_handoff_header {
+  u32 magic;
+  u32 version;
+  u32 session_count;
+  i32 next_entity_id;
+  u64 world_age;
+  u64 world_time;
+} pxe_handoff_header;
+
+typedef struct pxe_handoff_session {
+  u32 protocol_state;
+  bool32 compressed;
+  struct sockaddr_in endpoint;
+
+  i32 entity_id;
+  char username[16];
+  pxe_uuid uuid;
+  // These come from the monotonic clock, which both processes share. Timers
+  // that aren't active are 0.
+  i64 next_keep_alive;
+  i64 next_position_broadcast;
+  i64 timeout;
+  i64 last_damage_time;
+  i64 keep_alive_id;
+  bool32 keep_alive_pending;
+
+  u32 gamemode;
+
+  double previous_x;
+  double previous_y;
+  double previous_z;
+
+  double x;
+  double y;
+  double z;
+
+  float health;
+  float health_regen;
+
+  float yaw;
+  float pitch;
+
+  bool32 on_ground;
+  bool32 moves_dropped;
+  u32 chunks_remaining;
+
+  u32 read_size;
+  u32 write_size;
+} pxe_handoff_session;
+
+struct pxe_buffer_chain;
+struct pxe_pool;
+
+// Binds the handoff socket at path, replacing any socket left there. Returns
+// the non-blocking listening fd or -1.
+int pxe_handoff_listen(const char* path);
+// Accepts a process that wants to take over. Returns -1 if none is waiting.
+int pxe_handoff_accept(int listen_fd);
+// Returns the connected fd or -1 if no server is listening at path.
+int pxe_handoff_connect(const char* path);
+
+// Sends a single message. pass_fd is attached to it unless it's -1.
+bool32 pxe_handoff_send(int fd, const void* data, size_t size, int pass_fd);
+// Receives a single message of exactly size bytes. pass_fd is set to the
+// attached descriptor or -1 if it's not NULL.
+bool32 pxe_handoff_receive(int fd, void* data, size_t size, int* pass_fd);
+
+// Sends size bytes of the chain starting offset bytes in.
+bool32 pxe_handoff_send_chain(int fd, struct pxe_buffer_chain* chain,
+                              size_t offset, size_t size);
+// Receives size bytes into buffers from the pool. The chain is returned in
+// chain, which is left NULL when size is 0.
+bool32 pxe_handoff_receive_chain(int fd, struct pxe_pool* pool, size_t size,
+                                 struct pxe_buffer_chain** chain);
+
+#endif
+
+#endif
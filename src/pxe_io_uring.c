@@ -0,0 +1,440 @@
+#include "pxe_io_uring.h"
+
+#ifdef __linux__
+
+#include "pxe_alloc.h"
+#include "pxe_buffer.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static int pxe_io_uring_setup(u32 entries, struct io_uring_params* params) {
+  return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int pxe_io_uring_enter(int fd, u32 to_submit, u32 min_complete,
+                              u32 flags, void* arg, size_t arg_size) {
+  return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+                      arg, arg_size);
+}
+
+static int pxe_io_uring_register(int fd, u32 opcode, void* arg, u32 nr_args) {
+  return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static struct io_uring_sqe* pxe_io_uring_get_sqe(pxe_io_uring* ring) {
+  u32 head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+
+  if (ring->sq_local_tail - head >= ring->sq_entries) {
+    // The submission queue is full, so hand what's there to the kernel.
+    pxe_io_uring_submit(ring, 0);
+
+    head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+
+    if (ring->sq_local_tail - head >= ring->sq_entries) {
+      return NULL;
+    }
+  }
+
+  struct io_uring_sqe* sqe = ring->sqes + (ring->sq_local_tail & ring->sq_mask);
+
+  ++ring->sq_local_tail;
+
+  memset(sqe, 0, sizeof(*sqe));
+
+  return sqe;
+}
+
+static void pxe_io_uring_provide_buffer(pxe_io_uring* ring,
+                                        pxe_buffer_chain* chain, u16 bid) {
+  struct io_uring_buf* buf =
+      ring->buf_ring->bufs + (ring->buf_tail & (PXE_IO_URING_BUFFER_COUNT - 1));
+
+  buf->addr = (u64)(uintptr_t)chain->buffer->data;
+  buf->len = (u32)chain->buffer->max_size;
+  buf->bid = bid;
+
+  ++ring->buf_tail;
+
+  __atomic_store_n(&ring->buf_ring->tail, ring->buf_tail, __ATOMIC_RELEASE);
+}
+
+// Checks that multishot recv with provided buffers works by running one on a
+// socket pair. Older kernels accept the setup but fail the request itself.
+static bool32 pxe_io_uring_probe(pxe_io_uring* ring) {
+  int fds[2];
+
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+    return 0;
+  }
+
+  pxe_io_uring_conn probe = {0};
+  probe.fd = fds[0];
+
+  bool32 supported = 0;
+
+  if (pxe_io_uring_recv(ring, &probe) && write(fds[1], "p", 1) == 1 &&
+      pxe_io_uring_submit(ring, 1)) {
+    struct io_uring_cqe* cqe = pxe_io_uring_peek_cqe(ring);
+
+    if (cqe && cqe->res == 1 && (cqe->flags & IORING_CQE_F_MORE) &&
+        (cqe->flags & IORING_CQE_F_BUFFER)) {
+      supported = 1;
+    }
+
+    if (cqe && (cqe->flags & IORING_CQE_F_BUFFER)) {
+      u16 bid = (u16)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+
+      pxe_pool_free(ring->buffer_pool, pxe_io_uring_take_buffer(ring, bid, 0),
+                    1);
+    }
+
+    if (cqe) {
+      pxe_io_uring_cqe_seen(ring);
+    }
+  }
+
+  close(fds[1]);
+  close(fds[0]);
+
+  // Reap the end of the probe recv so it doesn't show up in the server loop.
+  while (supported) {
+    if (!pxe_io_uring_submit(ring, 1)) break;
+
+    struct io_uring_cqe* cqe = pxe_io_uring_peek_cqe(ring);
+
+    if (cqe == NULL) continue;
+
+    u32 flags = cqe->flags;
+
+    pxe_io_uring_cqe_seen(ring);
+
+    if (!(flags & IORING_CQE_F_MORE)) break;
+  }
+
+  return supported;
+}
+
+pxe_io_uring* pxe_io_uring_create(pxe_memory_arena* perm_arena,
+                                  pxe_pool* read_pool) {
+  struct io_uring_params params;
+
+  memset(&params, 0, sizeof(params));
+
+  int fd = pxe_io_uring_setup(PXE_IO_URING_ENTRIES, &params);
+
+  if (fd < 0) {
+    return NULL;
+  }
+
+  if (!(params.features & IORING_FEAT_NODROP)) {
+    close(fd);
+    return NULL;
+  }
+
+  size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(u32);
+  size_t cq_size =
+      params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    if (cq_size > sq_size) sq_size = cq_size;
+    cq_size = sq_size;
+  }
+
+  u8* sq_ptr = mmap(NULL, sq_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+
+  if (sq_ptr == MAP_FAILED) {
+    close(fd);
+    return NULL;
+  }
+
+  u8* cq_ptr = sq_ptr;
+
+  if (!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+    cq_ptr = mmap(NULL, cq_size, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+
+    if (cq_ptr == MAP_FAILED) {
+      munmap(sq_ptr, sq_size);
+      close(fd);
+      return NULL;
+    }
+  }
+
+  size_t sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  struct io_uring_sqe* sqes =
+      mmap(NULL, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+           fd, IORING_OFF_SQES);
+
+  size_t buf_ring_size =
+      PXE_IO_URING_BUFFER_COUNT * sizeof(struct io_uring_buf);
+  struct io_uring_buf_ring* buf_ring =
+      mmap(NULL, buf_ring_size, PROT_READ | PROT_WRITE,
+           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+  struct io_uring_buf_reg reg;
+
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = (u64)(uintptr_t)buf_ring;
+  reg.ring_entries = PXE_IO_URING_BUFFER_COUNT;
+  reg.bgid = PXE_IO_URING_BUFFER_GROUP;
+
+  if (sqes == MAP_FAILED || buf_ring == MAP_FAILED ||
+      pxe_io_uring_register(fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+    if (sqes != MAP_FAILED) munmap(sqes, sqes_size);
+    if (buf_ring != MAP_FAILED) munmap(buf_ring, buf_ring_size);
+    if (cq_ptr != sq_ptr) munmap(cq_ptr, cq_size);
+    munmap(sq_ptr, sq_size);
+    close(fd);
+    return NULL;
+  }
+
+  pxe_io_uring* ring = pxe_arena_push_type(perm_arena, pxe_io_uring);
+
+  ring->fd = fd;
+  ring->timed_wait = (params.features & IORING_FEAT_EXT_ARG) != 0;
+  ring->perm_arena = perm_arena;
+  ring->free_conns = NULL;
+
+  ring->sq_head = (u32*)(sq_ptr + params.sq_off.head);
+  ring->sq_tail = (u32*)(sq_ptr + params.sq_off.tail);
+  ring->sq_flags = (u32*)(sq_ptr + params.sq_off.flags);
+  ring->sq_mask = *(u32*)(sq_ptr + params.sq_off.ring_mask);
+  ring->sq_entries = *(u32*)(sq_ptr + params.sq_off.ring_entries);
+  ring->sq_local_tail = *ring->sq_tail;
+  ring->sqes = sqes;
+
+  // Submission slots always map to the sqe with the same index.
+  u32* sq_array = (u32*)(sq_ptr + params.sq_off.array);
+
+  for (u32 i = 0; i < ring->sq_entries; ++i) {
+    sq_array[i] = i;
+  }
+
+  ring->cq_head = (u32*)(cq_ptr + params.cq_off.head);
+  ring->cq_tail = (u32*)(cq_ptr + params.cq_off.tail);
+  ring->cq_mask = *(u32*)(cq_ptr + params.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe*)(cq_ptr + params.cq_off.cqes);
+
+  ring->buf_ring = buf_ring;
+  ring->buf_tail = 0;
+  ring->buffer_pool = read_pool;
+
+  for (u16 i = 0; i < PXE_IO_URING_BUFFER_COUNT; ++i) {
+    ring->buffers[i] = pxe_pool_alloc(read_pool);
+
+    pxe_io_uring_provide_buffer(ring, ring->buffers[i], i);
+  }
+
+  if (!pxe_io_uring_probe(ring)) {
+    // The ring memory stays in the perm arena but the kernel side is released.
+    close(fd);
+    return NULL;
+  }
+
+  return ring;
+}
+
+bool32 pxe_io_uring_submit(pxe_io_uring* ring, u32 wait_count) {
+  u32 to_submit = ring->sq_local_tail - *ring->sq_tail;
+  u32 flags = 0;
+
+  if (to_submit > 0) {
+    __atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+  }
+
+  // Completions that didn't fit in the completion queue are only flushed by
+  // entering with GETEVENTS.
+  if (wait_count > 0 || (__atomic_load_n(ring->sq_flags, __ATOMIC_RELAXED) &
+                         IORING_SQ_CQ_OVERFLOW)) {
+    flags |= IORING_ENTER_GETEVENTS;
+  }
+
+  if (to_submit == 0 && flags == 0) return 1;
+
+  int result;
+
+  do {
+    result =
+        pxe_io_uring_enter(ring->fd, to_submit, wait_count, flags, NULL, 0);
+  } while (result < 0 && errno == EINTR);
+
+  return result >= 0 || errno == EBUSY || errno == EAGAIN;
+}
+
+bool32 pxe_io_uring_wait(pxe_io_uring* ring, i32 timeout_ms) {
+  if (timeout_ms <= 0 || !ring->timed_wait || pxe_io_uring_peek_cqe(ring)) {
+    return pxe_io_uring_submit(ring, 0);
+  }
+
+  u32 to_submit = ring->sq_local_tail - *ring->sq_tail;
+
+  if (to_submit > 0) {
+    __atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+  }
+
+  struct __kernel_timespec timeout;
+  struct io_uring_getevents_arg arg;
+
+  timeout.tv_sec = timeout_ms / 1000;
+  timeout.tv_nsec = (i64)(timeout_ms % 1000) * 1000000;
+
+  memset(&arg, 0, sizeof(arg));
+  arg.ts = (u64)(uintptr_t)&timeout;
+
+  int result = pxe_io_uring_enter(ring->fd, to_submit, 1,
+                                  IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+                                  &arg, sizeof(arg));
+
+  // Timing out or getting interrupted is a normal wakeup.
+  return result >= 0 || errno == ETIME || errno == EINTR || errno == EBUSY ||
+         errno == EAGAIN;
+}
+
+struct io_uring_cqe* pxe_io_uring_peek_cqe(pxe_io_uring* ring) {
+  u32 head = *ring->cq_head;
+  u32 tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+  if (head == tail) return NULL;
+
+  return ring->cqes + (head & ring->cq_mask);
+}
+
+void pxe_io_uring_cqe_seen(pxe_io_uring* ring) {
+  __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+pxe_buffer_chain* pxe_io_uring_take_buffer(pxe_io_uring* ring, u16 bid,
+                                           size_t size) {
+  pxe_buffer_chain* chain = ring->buffers[bid];
+  pxe_buffer_chain* replacement = pxe_pool_alloc(ring->buffer_pool);
+
+  chain->buffer->size = size;
+  chain->next = NULL;
+
+  ring->buffers[bid] = replacement;
+
+  pxe_io_uring_provide_buffer(ring, replacement, bid);
+
+  return chain;
+}
+
+pxe_io_uring_conn* pxe_io_uring_conn_create(pxe_io_uring* ring,
+                                            struct pxe_session* session,
+                                            int fd) {
+  pxe_io_uring_conn* conn = ring->free_conns;
+
+  if (conn) {
+    ring->free_conns = conn->next_free;
+  } else {
+    conn = pxe_arena_push_type(ring->perm_arena, pxe_io_uring_conn);
+  }
+
+  memset(conn, 0, sizeof(*conn));
+
+  conn->session = session;
+  conn->fd = fd;
+
+  return conn;
+}
+
+bool32 pxe_io_uring_conn_release(pxe_io_uring* ring, pxe_io_uring_conn* conn) {
+  if (conn->session != NULL || conn->pending > 0) return 0;
+
+  conn->next_free = ring->free_conns;
+  ring->free_conns = conn;
+
+  return 1;
+}
+
+bool32 pxe_io_uring_accept(pxe_io_uring* ring, int listen_fd) {
+  struct io_uring_sqe* sqe = pxe_io_uring_get_sqe(ring);
+
+  if (sqe == NULL) return 0;
+
+  sqe->opcode = IORING_OP_ACCEPT;
+  sqe->fd = listen_fd;
+  sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+  sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+  sqe->user_data = PXE_IO_URING_OP_ACCEPT;
+
+  return 1;
+}
+
+bool32 pxe_io_uring_recv(pxe_io_uring* ring, pxe_io_uring_conn* conn) {
+  struct io_uring_sqe* sqe = pxe_io_uring_get_sqe(ring);
+
+  if (sqe == NULL) return 0;
+
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = conn->fd;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = PXE_IO_URING_BUFFER_GROUP;
+  sqe->user_data = (u64)(uintptr_t)conn | PXE_IO_URING_OP_RECV;
+
+  conn->recv_armed = 1;
+  ++conn->pending;
+
+  return 1;
+}
+
+bool32 pxe_io_uring_send_chain(pxe_io_uring* ring, pxe_io_uring_conn* conn,
+                               pxe_buffer_chain* chain, size_t offset) {
+  size_t count = 0;
+
+  while (chain && count < PXE_IO_URING_SEND_IOV) {
+    conn->iov[count].iov_base = chain->buffer->data + offset;
+    conn->iov[count].iov_len = chain->buffer->size - offset;
+
+    offset = 0;
+    ++count;
+
+    chain = chain->next;
+  }
+
+  if (count == 0) return 1;
+
+  struct io_uring_sqe* sqe = pxe_io_uring_get_sqe(ring);
+
+  if (sqe == NULL) return 0;
+
+  memset(&conn->msg, 0, sizeof(conn->msg));
+  conn->msg.msg_iov = conn->iov;
+  conn->msg.msg_iovlen = count;
+
+  sqe->opcode = IORING_OP_SENDMSG;
+  sqe->fd = conn->fd;
+  sqe->addr = (u64)(uintptr_t)&conn->msg;
+  sqe->len = 1;
+  sqe->msg_flags = MSG_NOSIGNAL;
+  sqe->user_data = (u64)(uintptr_t)conn | PXE_IO_URING_OP_SEND;
+
+  conn->sending = 1;
+  ++conn->pending;
+
+  return 1;
+}
+
+void pxe_io_uring_close(pxe_io_uring* ring, pxe_io_uring_conn* conn) {
+  conn->session = NULL;
+
+  if (conn->recv_armed) {
+    struct io_uring_sqe* sqe = pxe_io_uring_get_sqe(ring);
+
+    if (sqe) {
+      sqe->opcode = IORING_OP_ASYNC_CANCEL;
+      sqe->addr = (u64)(uintptr_t)conn | PXE_IO_URING_OP_RECV;
+      sqe->user_data = PXE_IO_URING_OP_CANCEL;
+    }
+  }
+
+  // Wakes up a send that is stuck on a full socket buffer.
+  shutdown(conn->fd, SHUT_RDWR);
+}
+
+#endif
@@ -0,0 +1,120 @@
+#ifndef PIXIE_IO_URING_H_
+#define PIXIE_IO_URING_H_
+
+#include "pixie.h"
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#define PXE_IO_URING_ENTRIES 4096
+// Number of read_pool buffers handed to the kernel for multishot recv. Must be
+// a power of two.
+#define PXE_IO_URING_BUFFER_COUNT 1024
+#define PXE_IO_URING_BUFFER_GROUP 0
+// The most buffers that will be passed to a single send submission.
+#define PXE_IO_URING_SEND_IOV 64
+
+// The low bits of each submission's user_data store what kind of request it
+// was. The rest is the pxe_io_uring_conn pointer, if any.
+typedef enum {
+  PXE_IO_URING_OP_ACCEPT = 1,
+  PXE_IO_URING_OP_RECV,
+  PXE_IO_URING_OP_SEND,
+  PXE_IO_URING_OP_CANCEL,
+
+  PXE_IO_URING_OP_MASK = 7
+} pxe_io_uring_op;
+
+struct pxe_buffer_chain;
+struct pxe_memory_arena;
+struct pxe_pool;
+struct pxe_session;
+
+// The requests in flight for one connection. This outlives its session until
+// every request that references it has completed.
+typedef struct pxe_io_uring_conn {
+  // NULL once the session was removed.
+  struct pxe_session* session;
+  int fd;
+  // Requests that will still produce a completion.
+  u32 pending;
+  bool32 recv_armed;
+  // Set while a send is in flight. Sends are serialized per connection so the
+  // stream stays in order.
+  bool32 sending;
+
+  struct msghdr msg;
+  struct iovec iov[PXE_IO_URING_SEND_IOV];
+
+  struct pxe_io_uring_conn* next_free;
+} pxe_io_uring_conn;
+
+typedef struct pxe_io_uring {
+  int fd;
+  // Set if the kernel can wait for completions with a timeout.
+  bool32 timed_wait;
+
+  u32* sq_head;
+  u32* sq_tail;
+  u32* sq_flags;
+  u32 sq_mask;
+  u32 sq_entries;
+  struct io_uring_sqe* sqes;
+  // Tail including the submissions that haven't been published yet.
+  u32 sq_local_tail;
+
+  u32* cq_head;
+  u32* cq_tail;
+  u32 cq_mask;
+  struct io_uring_cqe* cqes;
+
+  struct io_uring_buf_ring* buf_ring;
+  u16 buf_tail;
+  struct pxe_pool* buffer_pool;
+  struct pxe_buffer_chain* buffers[PXE_IO_URING_BUFFER_COUNT];
+
+  struct pxe_memory_arena* perm_arena;
+  pxe_io_uring_conn* free_conns;
+} pxe_io_uring;
+
+// Sets up the rings and registers read_pool buffers for multishot recv.
+// Returns NULL if the kernel doesn't support everything that's needed.
+pxe_io_uring* pxe_io_uring_create(struct pxe_memory_arena* perm_arena,
+                                  struct pxe_pool* read_pool);
+
+// Publishes queued submissions and waits for wait_count completions. This
+// doesn't enter the kernel if there's nothing to submit or wait for.
+bool32 pxe_io_uring_submit(pxe_io_uring* ring, u32 wait_count);
+// Publishes queued submissions and sleeps until a completion arrives or
+// timeout_ms passes. Kernels without timed waits only poll.
+bool32 pxe_io_uring_wait(pxe_io_uring* ring, i32 timeout_ms);
+// Returns the next completion or NULL. It must be marked seen before the next
+// peek.
+struct io_uring_cqe* pxe_io_uring_peek_cqe(pxe_io_uring* ring);
+void pxe_io_uring_cqe_seen(pxe_io_uring* ring);
+
+// Takes the pool buffer the kernel filled for bid and registers a fresh one
+// from the pool in its place.
+struct pxe_buffer_chain* pxe_io_uring_take_buffer(pxe_io_uring* ring, u16 bid,
+                                                  size_t size);
+
+pxe_io_uring_conn* pxe_io_uring_conn_create(pxe_io_uring* ring,
+                                            struct pxe_session* session,
+                                            int fd);
+// Returns the connection to the free list once nothing references it.
+bool32 pxe_io_uring_conn_release(pxe_io_uring* ring, pxe_io_uring_conn* conn);
+
+bool32 pxe_io_uring_accept(pxe_io_uring* ring, int listen_fd);
+bool32 pxe_io_uring_recv(pxe_io_uring* ring, pxe_io_uring_conn* conn);
+// Submits a send for the chain starting offset bytes into the first buffer.
+// The chain must stay untouched until the send completes.
+bool32 pxe_io_uring_send_chain(pxe_io_uring* ring, pxe_io_uring_conn* conn,
+                               struct pxe_buffer_chain* chain, size_t offset);
+// Detaches the connection from its session and cancels its recv.
+void pxe_io_uring_close(pxe_io_uring* ring, pxe_io_uring_conn* conn);
+
+#endif
+
+#endif
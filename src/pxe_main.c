@@ -6,6 +6,7 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #ifndef _MSC_VER
 int sprintf_s(char* str, size_t str_size, const char* format, ...) {
@@ -42,7 +43,21 @@ int main(int argc, char* argv[]) {
   pxe_arena_initialize(&trans_arena, trans_memory, trans_size);
   pxe_arena_initialize(&perm_arena, perm_memory, perm_size);
 
-  pxe_game_server_run(&perm_arena, &trans_arena);
+  bool32 take_over = 0;
+
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--upgrade") == 0) {
+      take_over = 1;
+    } else {
+      fprintf(stderr, "Unknown argument: %s\n", argv[i]);
+      return 1;
+    }
+  }
+
+  pxe_game_server_run(&perm_arena, &trans_arena, take_over);
+
+  free(perm_memory);
+  free(trans_memory);
 
   return 0;
 }
@@ -286,8 +286,7 @@ bool32 pxe_nbt_parse(char* data, size_t size, pxe_memory_arena* arena,
   chain.next = NULL;
 
   pxe_buffer_reader reader;
-  reader.chain = &chain;
-  reader.read_pos = 0;
+  pxe_buffer_reader_reset(&reader, &chain, 0);
 
   pxe_nbt_tag_type type = 0;
   if (pxe_buffer_read_u8(&reader, (u8*)&type) == 0) {
@@ -482,8 +481,7 @@ bool32 pxe_nbt_write_named_tag(pxe_buffer_writer* writer, pxe_nbt_tag* tag) {
 }
 
 bool32 pxe_nbt_write(pxe_nbt_tag_compound* compound, pxe_memory_arena* arena,
-                     char** out, size_t* size) {
-  pxe_pool* pool = pxe_pool_create(arena, 512);
+                     pxe_pool* pool, char** out, size_t* size) {
   pxe_buffer_writer writer = pxe_buffer_writer_create(pool);
 
   if (pxe_buffer_write_u8(&writer, (u8)PXE_NBT_TAG_TYPE_COMPOUND) == 0) {
@@ -508,8 +506,6 @@ bool32 pxe_nbt_write(pxe_nbt_tag_compound* compound, pxe_memory_arena* arena,
   }
 
   *size = pxe_buffer_size(writer.head);
-
-#if 0
   *out = pxe_arena_alloc(arena, *size);
 
   pxe_buffer_chain* current = writer.head;
@@ -519,10 +515,8 @@ bool32 pxe_nbt_write(pxe_nbt_tag_compound* compound, pxe_memory_arena* arena,
     pos += current->buffer->size;
     current = current->next;
   }
-#else
-  // This should work with temp arenas only
-  *out = (char*)writer.head->buffer->data;
-#endif
+
+  pxe_pool_free(pool, writer.head, 1);
 
   return 1;
 }
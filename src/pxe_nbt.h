@@ -91,11 +91,14 @@ typedef struct pxe_nbt_tag_long_array {
 } pxe_nbt_tag_long_array;
 
 struct pxe_memory_arena;
+struct pxe_pool;
 
 bool32 pxe_nbt_parse(char* data, size_t size, struct pxe_memory_arena* arena,
                      pxe_nbt_tag_compound* result);
+// The compound is written out in buffers from pool and then copied into arena.
 bool32 pxe_nbt_write(pxe_nbt_tag_compound* compound,
-                     struct pxe_memory_arena* arena, char** out, size_t* size);
+                     struct pxe_memory_arena* arena, struct pxe_pool* pool,
+                     char** out, size_t* size);
 void pxe_nbt_tag_compound_add(pxe_nbt_tag_compound* compound, pxe_nbt_tag tag);
 
 #endif
@@ -0,0 +1,550 @@
+#include "pxe_reactor.h"
+
+#ifdef __linux__
+
+#include "pxe_buffer.h"
+#include "pxe_game_server.h"
+#include "pxe_session.h"
+
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define PXE_REACTOR_LISTEN_EVENT PXE_REACTOR_MAX_CONNS
+#define PXE_REACTOR_WAKE_EVENT (PXE_REACTOR_MAX_CONNS + 1)
+
+bool32 pxe_spsc_queue_push(pxe_spsc_queue* queue,
+                           pxe_reactor_message* message) {
+  size_t tail = queue->tail;
+
+  if (tail - queue->cached_head >= PXE_REACTOR_QUEUE_SIZE) {
+    queue->cached_head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+
+    if (tail - queue->cached_head >= PXE_REACTOR_QUEUE_SIZE) {
+      return 0;
+    }
+  }
+
+  queue->messages[tail & (PXE_REACTOR_QUEUE_SIZE - 1)] = *message;
+
+  __atomic_store_n(&queue->tail, tail + 1, __ATOMIC_RELEASE);
+
+  return 1;
+}
+
+bool32 pxe_spsc_queue_pop(pxe_spsc_queue* queue, pxe_reactor_message* message) {
+  size_t head = queue->head;
+
+  if (head == queue->cached_tail) {
+    queue->cached_tail = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+
+    if (head == queue->cached_tail) {
+      return 0;
+    }
+  }
+
+  *message = queue->messages[head & (PXE_REACTOR_QUEUE_SIZE - 1)];
+
+  __atomic_store_n(&queue->head, head + 1, __ATOMIC_RELEASE);
+
+  return 1;
+}
+
+pxe_reactor* pxe_reactor_create(pxe_memory_arena* perm_arena, u32 index,
+                                pxe_socket* listen_socket,
+                                size_t read_buffer_size,
+                                size_t write_buffer_size) {
+  // The queues are cache line aligned, which the arena doesn't guarantee.
+  uintptr_t memory =
+      (uintptr_t)pxe_arena_alloc(perm_arena, sizeof(pxe_reactor) + 63);
+  pxe_reactor* reactor = (pxe_reactor*)((memory + 63) & ~(uintptr_t)63);
+
+  memset(reactor, 0, sizeof(*reactor));
+
+  reactor->index = index;
+  reactor->listen_socket = *listen_socket;
+  reactor->notify_fd = -1;
+  reactor->cpu = -1;
+
+  pxe_arena_initialize(&reactor->perm_arena,
+                       pxe_arena_alloc(perm_arena, PXE_REACTOR_ARENA_SIZE),
+                       PXE_REACTOR_ARENA_SIZE);
+  pxe_arena_initialize(
+      &reactor->trans_arena,
+      pxe_arena_alloc(perm_arena, PXE_REACTOR_TRANS_ARENA_SIZE),
+      PXE_REACTOR_TRANS_ARENA_SIZE);
+
+  reactor->read_pool = pxe_pool_create(&reactor->perm_arena, read_buffer_size);
+  reactor->write_returns =
+      pxe_pool_create(&reactor->perm_arena, write_buffer_size);
+  reactor->read_returns = pxe_pool_create(perm_arena, read_buffer_size);
+
+  for (u32 i = 0; i < PXE_REACTOR_MAX_CONNS; ++i) {
+    reactor->conns[i].next_free = i + 1;
+    reactor->session_indices[i] = PXE_REACTOR_NO_SESSION;
+  }
+
+  reactor->free_conn = 0;
+
+  reactor->epollfd = epoll_create1(0);
+
+  if (reactor->epollfd == -1) {
+    fprintf(stderr, "Failed to create reactor epoll fd.\n");
+    return NULL;
+  }
+
+  reactor->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+  if (reactor->wakefd == -1) {
+    fprintf(stderr, "Failed to create reactor eventfd.\n");
+    return NULL;
+  }
+
+  struct epoll_event event = {0};
+
+  event.events = EPOLLIN;
+  event.data.u64 = PXE_REACTOR_LISTEN_EVENT;
+
+  if (epoll_ctl(reactor->epollfd, EPOLL_CTL_ADD, reactor->listen_socket.fd,
+                &event)) {
+    fprintf(stderr, "Failed to add listen socket to reactor epoll.\n");
+    return NULL;
+  }
+
+  event.data.u64 = PXE_REACTOR_WAKE_EVENT;
+
+  if (epoll_ctl(reactor->epollfd, EPOLL_CTL_ADD, reactor->wakefd, &event)) {
+    fprintf(stderr, "Failed to add eventfd to reactor epoll.\n");
+    return NULL;
+  }
+
+  return reactor;
+}
+
+void pxe_reactor_post(pxe_reactor* reactor, pxe_reactor_message* message) {
+  reactor->wake_pending = 1;
+
+  while (!pxe_spsc_queue_push(&reactor->outbound, message)) {
+    // The reactor drains its queue even while it's waiting on the game thread,
+    // so this can't deadlock.
+    pxe_reactor_wake(reactor);
+    reactor->wake_pending = 1;
+    sched_yield();
+  }
+}
+
+void pxe_reactor_wake(pxe_reactor* reactor) {
+  if (!reactor->wake_pending) return;
+
+  u64 value = 1;
+
+  if (write(reactor->wakefd, &value, sizeof(value)) < 0) {
+    // The counter is already set, so the reactor will wake anyway.
+  }
+
+  reactor->wake_pending = 0;
+}
+
+static void pxe_reactor_update_events(pxe_reactor* reactor, u32 index) {
+  pxe_reactor_conn* conn = reactor->conns + index;
+  struct epoll_event event = {0};
+
+  event.events = EPOLLIN | EPOLLHUP;
+  event.data.u64 = index;
+
+  if (conn->write_registered) {
+    event.events |= EPOLLOUT;
+  }
+
+  epoll_ctl(reactor->epollfd, EPOLL_CTL_MOD, conn->socket.fd, &event);
+}
+
+static void pxe_reactor_process_outbound(pxe_reactor* reactor);
+
+// Wakes the game thread if anything was queued for it since the last notify.
+static void pxe_reactor_notify(pxe_reactor* reactor) {
+  if (!reactor->notify_pending || reactor->notify_fd == -1) return;
+
+  u64 value = 1;
+
+  if (write(reactor->notify_fd, &value, sizeof(value)) < 0) {
+    // The counter is already set, so the game thread will wake anyway.
+  }
+
+  reactor->notify_pending = 0;
+}
+
+// Hands a message to the game thread. Messages from the game thread keep being
+// processed while the queue is full.
+static void pxe_reactor_push(pxe_reactor* reactor,
+                             pxe_reactor_message* message) {
+  reactor->notify_pending = 1;
+
+  while (!pxe_spsc_queue_push(&reactor->inbound, message)) {
+    pxe_reactor_notify(reactor);
+    reactor->notify_pending = 1;
+    pxe_reactor_process_outbound(reactor);
+    sched_yield();
+  }
+}
+
+// Closes the socket and frees its buffers. The slot stays reserved until the
+// game thread closes it.
+static void pxe_reactor_close_socket(pxe_reactor* reactor,
+                                     pxe_reactor_conn* conn) {
+  if (conn->closed) return;
+
+  // Failed sends and receives have already closed the socket.
+  pxe_socket_disconnect(&conn->socket);
+  conn->closed = 1;
+
+  pxe_pool_free(reactor->read_pool, conn->read_chain, 1);
+  pxe_pool_free(reactor->write_returns, conn->write_chain, 1);
+
+  conn->read_chain = conn->last_read_chain = NULL;
+  conn->write_chain = conn->last_write_chain = NULL;
+  conn->read_size = conn->framed_size = conn->write_offset = 0;
+}
+
+static void pxe_reactor_release_conn(pxe_reactor* reactor, u32 index) {
+  pxe_reactor_conn* conn = reactor->conns + index;
+
+  if (!conn->active) return;
+
+  pxe_reactor_close_socket(reactor, conn);
+
+  conn->active = 0;
+  conn->next_free = reactor->free_conn;
+  reactor->free_conn = index;
+}
+
+static void pxe_reactor_disconnect(pxe_reactor* reactor, u32 index) {
+  pxe_reactor_conn* conn = reactor->conns + index;
+
+  if (conn->closed) return;
+
+  pxe_reactor_close_socket(reactor, conn);
+
+  pxe_reactor_message message = {PXE_REACTOR_MESSAGE_DISCONNECT, index, NULL};
+
+  pxe_reactor_push(reactor, &message);
+}
+
+static void pxe_reactor_flush(pxe_reactor* reactor, u32 index) {
+  pxe_reactor_conn* conn = reactor->conns + index;
+
+  while (conn->write_chain) {
+    size_t sent = pxe_socket_send_chain(&conn->socket, &reactor->trans_arena,
+                                        conn->write_chain, conn->write_offset);
+
+    pxe_arena_reset(&reactor->trans_arena);
+
+    if (conn->socket.state != PXE_SOCKET_STATE_CONNECTED) {
+      pxe_reactor_disconnect(reactor, index);
+      return;
+    }
+
+    if (sent == 0) break;
+
+    __atomic_store_n(&conn->sent_bytes, conn->sent_bytes + sent,
+                     __ATOMIC_RELAXED);
+    conn->write_offset += sent;
+
+    while (conn->write_chain &&
+           conn->write_offset >= conn->write_chain->buffer->size) {
+      conn->write_offset -= conn->write_chain->buffer->size;
+      conn->write_chain =
+          pxe_pool_free(reactor->write_returns, conn->write_chain, 0);
+    }
+  }
+
+  if (conn->write_chain == NULL) {
+    conn->last_write_chain = NULL;
+    conn->write_offset = 0;
+  }
+
+  bool32 queued = conn->write_chain != NULL;
+
+  if (queued != conn->write_registered) {
+    conn->write_registered = queued;
+    pxe_reactor_update_events(reactor, index);
+  }
+}
+
+static void pxe_reactor_process_outbound(pxe_reactor* reactor) {
+  pxe_reactor_message message;
+
+  while (pxe_spsc_queue_pop(&reactor->outbound, &message)) {
+    pxe_reactor_conn* conn = reactor->conns + message.conn;
+
+    switch (message.type) {
+      case PXE_REACTOR_MESSAGE_SEND: {
+        if (conn->closed) {
+          pxe_pool_free(reactor->write_returns, message.chain, 1);
+          break;
+        }
+
+        if (conn->write_chain == NULL) {
+          conn->write_chain = message.chain;
+        } else {
+          conn->last_write_chain->next = message.chain;
+        }
+
+        pxe_buffer_chain* last = message.chain;
+
+        while (last->next) {
+          last = last->next;
+        }
+
+        conn->last_write_chain = last;
+
+        if (!conn->write_registered) {
+          pxe_reactor_flush(reactor, message.conn);
+        }
+      } break;
+      case PXE_REACTOR_MESSAGE_CLOSE: {
+        pxe_reactor_release_conn(reactor, message.conn);
+      } break;
+      case PXE_REACTOR_MESSAGE_RELEASE: {
+        pxe_pool_free(reactor->read_pool, message.chain, 1);
+      } break;
+      case PXE_REACTOR_MESSAGE_TRIM: {
+        pxe_pool_trim(reactor->read_pool);
+      } break;
+      default: {
+      } break;
+    }
+  }
+}
+
+static void pxe_reactor_accept(pxe_reactor* reactor) {
+  pxe_socket new_socket = {0};
+
+  while (pxe_socket_accept(&reactor->listen_socket, &new_socket)) {
+    if (reactor->free_conn >= PXE_REACTOR_MAX_CONNS) {
+      fprintf(stderr, "Reactor %u is full. Rejecting connection.\n",
+              reactor->index);
+      closesocket(new_socket.fd);
+      continue;
+    }
+
+    if (PXE_SESSION_COALESCE_WRITES) {
+      pxe_socket_set_nodelay(&new_socket, 1);
+    }
+
+    if (reactor->busy_poll) {
+      pxe_socket_set_busy_poll(&new_socket, reactor->busy_poll);
+    }
+
+    u32 index = reactor->free_conn;
+    pxe_reactor_conn* conn = reactor->conns + index;
+
+    reactor->free_conn = conn->next_free;
+
+    memset(conn, 0, sizeof(*conn));
+    conn->socket = new_socket;
+    conn->active = 1;
+
+    struct epoll_event event = {0};
+
+    event.events = EPOLLIN | EPOLLHUP;
+    event.data.u64 = index;
+
+    if (epoll_ctl(reactor->epollfd, EPOLL_CTL_ADD, new_socket.fd, &event)) {
+      fprintf(stderr, "Failed to add new socket to reactor epoll.\n");
+    }
+
+    pxe_reactor_message message = {PXE_REACTOR_MESSAGE_CONNECT, index, NULL};
+
+    pxe_reactor_push(reactor, &message);
+  }
+}
+
+// Detaches the whole frames at the front of the read chain. The partial frame
+// at the end stays with the connection. A frame with an illegal length closes
+// the socket, since waiting for the rest of it would buffer whatever the
+// client sends.
+static pxe_buffer_chain* pxe_reactor_take_frames(pxe_reactor* reactor,
+                                                 pxe_reactor_conn* conn) {
+  pxe_buffer_reader reader;
+
+  pxe_buffer_reader_reset(&reader, conn->read_chain, conn->framed_size);
+
+  i32 length;
+
+  while (pxe_buffer_read_varint(&reader, &length)) {
+    if (length <= 0 || length > PXE_GAME_SERVER_MAX_PACKET_SIZE) {
+      fprintf(stderr, "Illegal packet length %d.\n", length);
+      pxe_socket_disconnect(&conn->socket);
+      break;
+    }
+
+    if (reader.read_pos + length > conn->read_size) break;
+
+    reader.read_pos += length;
+    conn->framed_size = reader.read_pos;
+  }
+
+  if (conn->framed_size == 0) return NULL;
+
+  pxe_buffer_chain* frames = conn->read_chain;
+  pxe_buffer_chain* prev = NULL;
+  pxe_buffer_chain* current = conn->read_chain;
+  size_t remaining = conn->framed_size;
+
+  while (current && remaining >= current->buffer->size) {
+    remaining -= current->buffer->size;
+    prev = current;
+    current = current->next;
+  }
+
+  if (remaining > 0) {
+    // The frames end inside this buffer, so the rest of it is moved to a new
+    // buffer.
+    pxe_buffer_chain* rest = pxe_pool_alloc(reactor->read_pool);
+    pxe_buffer* buffer = current->buffer;
+
+    rest->buffer->size = buffer->size - remaining;
+    memcpy(rest->buffer->data, buffer->data + remaining, rest->buffer->size);
+    buffer->size = remaining;
+
+    rest->next = current->next;
+    current->next = NULL;
+
+    if (conn->last_read_chain == current) {
+      conn->last_read_chain = rest;
+    }
+
+    conn->read_chain = rest;
+  } else {
+    prev->next = NULL;
+    conn->read_chain = current;
+
+    if (current == NULL) {
+      conn->last_read_chain = NULL;
+    }
+  }
+
+  conn->read_size -= conn->framed_size;
+  conn->framed_size = 0;
+
+  return frames;
+}
+
+static void pxe_reactor_read(pxe_reactor* reactor, u32 index) {
+  pxe_reactor_conn* conn = reactor->conns + index;
+  bool32 drained = 0;
+
+  // The socket is level-triggered, so anything left over past the budget is
+  // reported again by the next wait.
+  pxe_buffer_chain* chain = pxe_socket_receive_chain(
+      &conn->socket, &reactor->trans_arena, reactor->read_pool,
+      PXE_REACTOR_READ_BUDGET, &drained);
+
+  pxe_arena_reset(&reactor->trans_arena);
+
+  if (chain) {
+    if (conn->read_chain == NULL) {
+      conn->read_chain = chain;
+    } else {
+      conn->last_read_chain->next = chain;
+    }
+
+    while (chain) {
+      conn->read_size += chain->buffer->size;
+      conn->last_read_chain = chain;
+      chain = chain->next;
+    }
+
+    pxe_buffer_chain* frames = pxe_reactor_take_frames(reactor, conn);
+
+    if (frames) {
+      pxe_reactor_message message = {PXE_REACTOR_MESSAGE_PACKETS, index,
+                                     frames};
+
+      pxe_reactor_push(reactor, &message);
+    }
+  }
+
+  if (conn->socket.state != PXE_SOCKET_STATE_CONNECTED) {
+    pxe_reactor_disconnect(reactor, index);
+  }
+}
+
+static void* pxe_reactor_run(void* arg) {
+  pxe_reactor* reactor = arg;
+
+  if (reactor->cpu >= 0 && !pxe_reactor_pin_thread(reactor->cpu)) {
+    fprintf(stderr, "Failed to pin reactor %u to cpu %d.\n", reactor->index,
+            reactor->cpu);
+  }
+
+  int timeout = reactor->busy_poll ? 0 : -1;
+
+  while (reactor->listen_socket.state == PXE_SOCKET_STATE_LISTENING) {
+    int nfds = epoll_wait(reactor->epollfd, reactor->events,
+                          PXE_REACTOR_MAX_CONNS, timeout);
+
+    for (int event_index = 0; event_index < nfds; ++event_index) {
+      struct epoll_event* event = reactor->events + event_index;
+      u64 data = event->data.u64;
+
+      if (data == PXE_REACTOR_LISTEN_EVENT) {
+        pxe_reactor_accept(reactor);
+      } else if (data == PXE_REACTOR_WAKE_EVENT) {
+        u64 value;
+
+        if (read(reactor->wakefd, &value, sizeof(value)) < 0) {
+          // Another wake already reset the counter.
+        }
+      } else {
+        pxe_reactor_conn* conn = reactor->conns + data;
+
+        // The connection was closed earlier in this batch.
+        if (!conn->active || conn->closed) continue;
+
+        if (event->events & EPOLLOUT) {
+          pxe_reactor_flush(reactor, (u32)data);
+        }
+
+        if (!conn->closed && (event->events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+          pxe_reactor_read(reactor, (u32)data);
+        }
+      }
+    }
+
+    pxe_reactor_process_outbound(reactor);
+
+    pxe_buffer_chain* returns = pxe_pool_take(reactor->write_returns);
+
+    if (returns) {
+      pxe_reactor_message message = {PXE_REACTOR_MESSAGE_RELEASE, 0, returns};
+
+      pxe_reactor_push(reactor, &message);
+    }
+
+    pxe_reactor_notify(reactor);
+  }
+
+  return NULL;
+}
+
+bool32 pxe_reactor_pin_thread(i32 cpu) {
+  // The raw syscall is used so this doesn't depend on _GNU_SOURCE.
+  u64 mask[16] = {0};
+
+  if (cpu < 0 || cpu >= (i32)(sizeof(mask) * 8)) return 0;
+
+  mask[cpu / 64] = 1ULL << (cpu % 64);
+
+  return syscall(SYS_sched_setaffinity, 0, sizeof(mask), mask) == 0;
+}
+
+bool32 pxe_reactor_start(pxe_reactor* reactor) {
+  return pthread_create(&reactor->thread, NULL, pxe_reactor_run, reactor) == 0;
+}
+
+#endif
@@ -0,0 +1,140 @@
+#ifndef PIXIE_REACTOR_H_
+#define PIXIE_REACTOR_H_
+
+#include "pixie.h"
+#include "pxe_alloc.h"
+#include "pxe_socket.h"
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sys/epoll.h>
+
+// Must be a power of two.
+#define PXE_REACTOR_QUEUE_SIZE 8192
+#define PXE_REACTOR_MAX_CONNS 4096
+#define PXE_REACTOR_ARENA_SIZE pxe_megabytes(2)
+#define PXE_REACTOR_TRANS_ARENA_SIZE pxe_kilobytes(256)
+// Bytes read from one connection per wakeup before moving on to the others.
+#define PXE_REACTOR_READ_BUDGET pxe_kilobytes(16)
+// Marks a connection that doesn't have a session on the game thread.
+#define PXE_REACTOR_NO_SESSION 0xFFFFFFFF
+
+typedef enum {
+  // Sent from the reactor to the game thread.
+  PXE_REACTOR_MESSAGE_CONNECT,
+  // The chain only contains whole frames.
+  PXE_REACTOR_MESSAGE_PACKETS,
+  PXE_REACTOR_MESSAGE_DISCONNECT,
+
+  // Sent from the game thread to the reactor.
+  PXE_REACTOR_MESSAGE_SEND,
+  PXE_REACTOR_MESSAGE_CLOSE,
+
+  // Hands buffers back to the pool of the thread that allocated them.
+  PXE_REACTOR_MESSAGE_RELEASE,
+  // Asks the reactor to give back the memory of its idle read buffers.
+  PXE_REACTOR_MESSAGE_TRIM,
+} pxe_reactor_message_type;
+
+typedef struct pxe_reactor_message {
+  pxe_reactor_message_type type;
+  u32 conn;
+  struct pxe_buffer_chain* chain;
+} pxe_reactor_message;
+
+// Bounded queue between exactly one producer thread and one consumer thread.
+// Each side caches the other's index so it only touches the shared cache line
+// when the cached value says the queue is full or empty.
+typedef struct pxe_spsc_queue {
+  _Alignas(64) size_t head;
+  size_t cached_tail;
+  _Alignas(64) size_t tail;
+  size_t cached_head;
+  _Alignas(64) pxe_reactor_message messages[PXE_REACTOR_QUEUE_SIZE];
+} pxe_spsc_queue;
+
+typedef struct pxe_reactor_conn {
+  pxe_socket socket;
+
+  struct pxe_buffer_chain* read_chain;
+  struct pxe_buffer_chain* last_read_chain;
+  size_t read_size;
+  // Bytes at the front of read_chain that make up whole frames.
+  size_t framed_size;
+
+  struct pxe_buffer_chain* write_chain;
+  struct pxe_buffer_chain* last_write_chain;
+  size_t write_offset;
+  bool32 write_registered;
+  // Total bytes written to the socket. The game thread reads this to tell how
+  // much of what it sent is still queued.
+  u64 sent_bytes;
+
+  bool32 active;
+  // Set once the socket is gone. The slot stays reserved until the game thread
+  // closes it so the index can't be reused while messages for it are queued.
+  bool32 closed;
+  u32 next_free;
+} pxe_reactor_conn;
+
+typedef struct pxe_reactor {
+  u32 index;
+  pxe_socket listen_socket;
+  int epollfd;
+  int wakefd;
+  pthread_t thread;
+
+  // Written after messages were queued for the game thread. -1 if unused.
+  int notify_fd;
+  // When set, the reactor polls without sleeping and sockets busy poll for
+  // this many microseconds.
+  u32 busy_poll;
+  // The CPU the thread is pinned to or -1.
+  i32 cpu;
+
+  pxe_spsc_queue inbound;
+  pxe_spsc_queue outbound;
+
+  // Owned by the reactor thread.
+  pxe_memory_arena perm_arena;
+  pxe_memory_arena trans_arena;
+  pxe_pool* read_pool;
+  // Sent buffers that go back to the game thread's write pool. Nothing is
+  // allocated from it.
+  pxe_pool* write_returns;
+  pxe_reactor_conn conns[PXE_REACTOR_MAX_CONNS];
+  u32 free_conn;
+  bool32 notify_pending;
+  struct epoll_event events[PXE_REACTOR_MAX_CONNS];
+
+  // Owned by the game thread.
+  // The slot of each connection's session in the game server.
+  u32 session_indices[PXE_REACTOR_MAX_CONNS];
+  // Processed read buffers that go back to this reactor's read pool.
+  pxe_pool* read_returns;
+  bool32 wake_pending;
+} pxe_reactor;
+
+bool32 pxe_spsc_queue_push(pxe_spsc_queue* queue,
+                           pxe_reactor_message* message);
+bool32 pxe_spsc_queue_pop(pxe_spsc_queue* queue, pxe_reactor_message* message);
+
+// Takes over the listen socket. Buffers read from the network are
+// read_buffer_size bytes and are sent to the game thread as whole frames.
+pxe_reactor* pxe_reactor_create(struct pxe_memory_arena* perm_arena, u32 index,
+                                pxe_socket* listen_socket,
+                                size_t read_buffer_size,
+                                size_t write_buffer_size);
+bool32 pxe_reactor_start(pxe_reactor* reactor);
+// Pins the calling thread to a single CPU.
+bool32 pxe_reactor_pin_thread(i32 cpu);
+
+// These are called from the game thread.
+// Queues a message for the reactor, waiting for room if the queue is full.
+void pxe_reactor_post(pxe_reactor* reactor, pxe_reactor_message* message);
+// Wakes the reactor if anything was posted since the last wake.
+void pxe_reactor_wake(pxe_reactor* reactor);
+
+#endif
+
+#endif
@@ -0,0 +1,72 @@
+#include "pxe_ring.h"
+
+#include <stdio.h>
+
+#ifdef __linux__
+#include <linux/memfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+bool32 pxe_ring_create(pxe_ring* ring, size_t size) {
+  ring->data = NULL;
+  ring->size = size;
+  ring->head = 0;
+  ring->tail = 0;
+
+#ifdef __linux__
+  int fd = (int)syscall(SYS_memfd_create, "pixie-ring", MFD_CLOEXEC);
+
+  if (fd < 0) {
+    fprintf(stderr, "Failed to create ring memory.\n");
+    return 0;
+  }
+
+  if (ftruncate(fd, (off_t)size) != 0) {
+    close(fd);
+    return 0;
+  }
+
+  // Reserves both halves at once so nothing else can end up between them.
+  u8* data =
+      mmap(NULL, size * 2, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+  if (data == MAP_FAILED) {
+    close(fd);
+    return 0;
+  }
+
+  bool32 mapped =
+      mmap(data, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) !=
+          MAP_FAILED &&
+      mmap(data + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+           fd, 0) != MAP_FAILED;
+
+  // The mappings keep the memory alive on their own.
+  close(fd);
+
+  if (!mapped) {
+    munmap(data, size * 2);
+    return 0;
+  }
+
+  ring->data = data;
+
+  return 1;
+#else
+  return 0;
+#endif
+}
+
+void pxe_ring_destroy(pxe_ring* ring) {
+#ifdef __linux__
+  if (ring->data) {
+    munmap(ring->data, ring->size * 2);
+  }
+#endif
+
+  ring->data = NULL;
+  ring->head = 0;
+  ring->tail = 0;
+}
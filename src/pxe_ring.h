@@ -0,0 +1,55 @@
+#ifndef PIXIE_RING_H_
+#define PIXIE_RING_H_
+
+#include "pixie.h"
+
+// A byte ring whose memory is mapped twice back to back, so the size bytes
+// starting at any offset are contiguous. Whatever is in the ring can be read
+// or written with a single pointer no matter where it wraps. Only supported on
+// Linux, where pxe_ring_create fails elsewhere.
+typedef struct pxe_ring {
+  // NULL while the ring isn't created.
+  u8* data;
+  // A power of two and a multiple of the page size.
+  size_t size;
+  // Bytes read and written so far. Both go back to 0 when the ring empties,
+  // which keeps a mostly idle ring in its first pages.
+  size_t head;
+  size_t tail;
+} pxe_ring;
+
+bool32 pxe_ring_create(pxe_ring* ring, size_t size);
+void pxe_ring_destroy(pxe_ring* ring);
+
+static inline size_t pxe_ring_used(pxe_ring* ring) {
+  return ring->tail - ring->head;
+}
+
+static inline size_t pxe_ring_free(pxe_ring* ring) {
+  return ring->size - pxe_ring_used(ring);
+}
+
+// Points at pxe_ring_used bytes of unread data.
+static inline u8* pxe_ring_read_ptr(pxe_ring* ring) {
+  return ring->data + (ring->head & (ring->size - 1));
+}
+
+// Points at pxe_ring_free bytes of space.
+static inline u8* pxe_ring_write_ptr(pxe_ring* ring) {
+  return ring->data + (ring->tail & (ring->size - 1));
+}
+
+static inline void pxe_ring_produce(pxe_ring* ring, size_t size) {
+  ring->tail += size;
+}
+
+static inline void pxe_ring_consume(pxe_ring* ring, size_t size) {
+  ring->head += size;
+
+  if (ring->head == ring->tail) {
+    ring->head = 0;
+    ring->tail = 0;
+  }
+}
+
+#endif
@@ -1,37 +1,516 @@
 #include "pxe_session.h"
+#include "pxe_alloc.h"
 #include "pxe_game_server.h"
+#include "pxe_reactor.h"
+
+#include <string.h>
 
 void pxe_session_initialize(pxe_session* session) {
-  session->protocol_state = PXE_PROTOCOL_STATE_HANDSHAKING;
+  pxe_session_hot* hot = session->hot;
+
+  hot->protocol_state = PXE_PROTOCOL_STATE_HANDSHAKING;
+  hot->previous_x = hot->x = 0;
+  hot->previous_y = hot->y = 0;
+  hot->previous_z = hot->z = 0;
+  hot->yaw = 0;
+  hot->pitch = 0;
+  hot->on_ground = 1;
+  hot->health_regen = 0.25f;
+  hot->health = 20.0f;
+  hot->chunks_remaining = 0;
+
   session->socket.state = PXE_SOCKET_STATE_DISCONNECTED;
-  session->buffer_reader.read_pos = 0;
-  session->buffer_reader.chain = NULL;
+
+  for (u32 i = 0; i < PXE_SESSION_TIMER_COUNT; ++i) {
+    pxe_timer_init(session->timers + i, i);
+  }
+
+  session->keep_alive_pending = 0;
+  session->keep_alive_id = 0;
+  session->compressed = 0;
+  pxe_buffer_reader_reset(&session->buffer_reader, NULL, 0);
   session->last_read_chain = NULL;
   session->read_buffer_chain = NULL;
+  session->receive_ring.data = NULL;
   session->last_write_chain = NULL;
   session->write_buffer_chain = NULL;
+  session->write_offset = 0;
+  session->write_queued = 0;
+  session->write_posted = 0;
+  session->write_backlog_time = 0;
+  session->moves_dropped = 0;
+  session->move_resync_until = 0;
+  session->write_registered = 0;
+  session->read_pending = 0;
+  session->packets_queued = 0;
+  session->send_calls = 0;
+  session->zerocopy_sends = 0;
+  session->zerocopy_copied = 0;
+  session->zerocopy = 0;
+  session->zerocopy_chain = NULL;
+  session->last_zerocopy_chain = NULL;
+  session->zerocopy_first_id = 0;
+  session->zerocopy_pending = 0;
+  session->io_uring_conn = NULL;
+  session->reactor = NULL;
+  session->reactor_conn = 0;
   session->username[0] = 0;
-  session->next_keep_alive = 0;
-  session->previous_x = session->x = 0;
-  session->previous_y = session->y = 0;
-  session->previous_z = session->z = 0;
-  session->yaw = 0;
-  session->pitch = 0;
-  session->on_ground = 1;
-  session->next_position_broadcast = 0;
   session->gamemode = PXE_GAMEMODE_SURVIVAL;
-  session->health_regen = 0.25f;
-  session->health = 20.0f;
   session->last_damage_time = 0;
 }
 
 void pxe_session_free(pxe_session* session, pxe_game_server* server) {
   pxe_buffer_chain* chain = session->read_buffer_chain;
 
-  pxe_pool_free(server->read_pool, chain, 1);
+  pxe_pool_free(pxe_session_read_pool(session, server), chain, 1);
 
-  session->buffer_reader.chain = NULL;
-  session->buffer_reader.read_pos = 0;
+  pxe_buffer_reader_reset(&session->buffer_reader, NULL, 0);
   session->read_buffer_chain = NULL;
   session->last_read_chain = NULL;
+
+  pxe_ring_destroy(&session->receive_ring);
+
+  pxe_pool_free(server->write_pool, session->write_buffer_chain, 1);
+
+  session->write_buffer_chain = NULL;
+  session->last_write_chain = NULL;
+  session->write_offset = 0;
+  session->write_queued = 0;
+
+  // The socket is closing, so whatever the kernel still has queued from these
+  // buffers won't be read by anyone that cares.
+  pxe_pool_free(server->write_pool, session->zerocopy_chain, 1);
+
+  session->zerocopy_chain = NULL;
+  session->last_zerocopy_chain = NULL;
+  session->zerocopy_pending = 0;
+}
+
+pxe_pool* pxe_session_read_pool(pxe_session* session, pxe_game_server* server) {
+#ifdef __linux__
+  if (session->reactor) return session->reactor->read_returns;
+#endif
+
+  return server->read_pool;
+}
+
+void pxe_session_fail(pxe_session* session) {
+  // A reactor or io_uring owns the socket and closes it once the session is
+  // removed.
+  if (session->reactor == NULL && session->io_uring_conn == NULL) {
+    pxe_socket_disconnect(&session->socket);
+  }
+
+  session->socket.state = PXE_SOCKET_STATE_ERROR;
+}
+
+pxe_buffer_chain* pxe_session_wrap_ring(pxe_session* session) {
+  pxe_ring* ring = &session->receive_ring;
+
+  session->ring_buffer.data = pxe_ring_read_ptr(ring);
+  session->ring_buffer.size = pxe_ring_used(ring);
+  session->ring_buffer.max_size = session->ring_buffer.size;
+  session->ring_chain.buffer = &session->ring_buffer;
+  session->ring_chain.next = NULL;
+
+  return &session->ring_chain;
+}
+
+bool32 pxe_session_fill_ring(pxe_session* session, pxe_pool* pool) {
+  pxe_ring* ring = &session->receive_ring;
+  size_t size = pxe_buffer_size(session->read_buffer_chain) -
+                session->buffer_reader.read_pos;
+
+  if (size > pxe_ring_free(ring)) return 0;
+
+  pxe_buffer_reader* reader = &session->buffer_reader;
+
+  pxe_buffer_reader_reset(reader, session->read_buffer_chain,
+                          reader->read_pos);
+  pxe_buffer_read_raw_string(reader, (char*)pxe_ring_write_ptr(ring), size);
+  pxe_ring_produce(ring, size);
+
+  pxe_pool_free(pool, session->read_buffer_chain, 1);
+
+  pxe_buffer_reader_reset(reader, NULL, 0);
+  session->read_buffer_chain = NULL;
+  session->last_read_chain = NULL;
+
+  return 1;
+}
+
+// Releases the buffers at the front of the chain that were fully sent and
+// returns the first buffer that still has data left. offset is updated to be
+// relative to that buffer.
+static pxe_buffer_chain* pxe_session_release_sent(pxe_pool* pool,
+                                                  pxe_buffer_chain* chain,
+                                                  size_t* offset,
+                                                  bool32 owned) {
+  while (chain && *offset >= chain->buffer->size) {
+    pxe_buffer_chain* next = chain->next;
+
+    *offset -= chain->buffer->size;
+
+    if (owned) {
+      pxe_pool_free(pool, chain, 0);
+    }
+
+    chain = next;
+  }
+
+  return chain;
+}
+
+static void pxe_session_queue_copy(pxe_session* session, pxe_pool* pool,
+                                   pxe_buffer_chain* chain, size_t offset) {
+  pxe_buffer_chain* last = session->last_write_chain;
+
+  for (; chain; chain = chain->next) {
+    u8* data = chain->buffer->data + offset;
+    size_t size = chain->buffer->size - offset;
+
+    offset = 0;
+
+    while (size > 0) {
+      if (last == NULL || last->buffer->size >= last->buffer->max_size) {
+        pxe_buffer_chain* new_chain = pxe_pool_alloc_size(pool, size);
+
+        if (last == NULL) {
+          session->write_buffer_chain = new_chain;
+        } else {
+          last->next = new_chain;
+        }
+
+        last = new_chain;
+      }
+
+      pxe_buffer* buffer = last->buffer;
+      size_t copy_size = buffer->max_size - buffer->size;
+
+      if (copy_size > size) {
+        copy_size = size;
+      }
+
+      memcpy(buffer->data + buffer->size, data, copy_size);
+
+      buffer->size += copy_size;
+      data += copy_size;
+      size -= copy_size;
+      session->write_queued += copy_size;
+    }
+  }
+
+  session->last_write_chain = last;
+}
+
+bool32 pxe_session_send_chain(pxe_session* session, pxe_memory_arena* arena,
+                              pxe_pool* pool, pxe_buffer_chain* chain,
+                              bool32 owned) {
+  pxe_socket* socket = &session->socket;
+  size_t offset = 0;
+
+  if (socket->state != PXE_SOCKET_STATE_CONNECTED) {
+    if (owned) {
+      pxe_pool_free(pool, chain, 1);
+    }
+    return 0;
+  }
+
+  if (chain == NULL) return 1;
+
+  ++session->packets_queued;
+
+  if (!PXE_SESSION_COALESCE_WRITES && session->reactor == NULL &&
+      session->write_buffer_chain == NULL) {
+    offset = pxe_socket_send_chain(socket, arena, chain, 0);
+    ++session->send_calls;
+
+    if (socket->state != PXE_SOCKET_STATE_CONNECTED) {
+      if (owned) {
+        pxe_pool_free(pool, chain, 1);
+      }
+      return 0;
+    }
+
+    chain = pxe_session_release_sent(pool, chain, &offset, owned);
+
+    if (chain == NULL) return 1;
+  }
+
+  if (!owned) {
+    // The caller keeps the chain, so the rest of it has to be copied to
+    // buffers that live until the socket can take them.
+    pxe_session_queue_copy(session, pool, chain, offset);
+    return 1;
+  }
+
+  if (session->write_buffer_chain == NULL) {
+    session->write_buffer_chain = chain;
+    session->write_offset = offset;
+  } else {
+    session->last_write_chain->next = chain;
+  }
+
+  session->write_queued += chain->buffer->size - offset;
+
+  while (chain->next) {
+    chain = chain->next;
+    session->write_queued += chain->buffer->size;
+  }
+
+  session->last_write_chain = chain;
+
+  return 1;
+}
+
+bool32 pxe_session_send_bytes(pxe_session* session, pxe_memory_arena* arena,
+                              pxe_pool* pool, u8* data, size_t size) {
+  pxe_socket* socket = &session->socket;
+  pxe_buffer buffer = {data, size, size, 0, NULL, NULL};
+  pxe_buffer_chain chain = {&buffer, NULL};
+
+  if (socket->state != PXE_SOCKET_STATE_CONNECTED) return 0;
+
+  // Reactors and io_uring write from the queue, so the frame goes there.
+  if (session->reactor || session->io_uring_conn ||
+      session->write_buffer_chain) {
+    return pxe_session_send_chain(session, arena, pool, &chain, 0);
+  }
+
+  ++session->packets_queued;
+  ++session->send_calls;
+
+  size_t sent = pxe_socket_send_chain(socket, arena, &chain, 0);
+
+  if (socket->state != PXE_SOCKET_STATE_CONNECTED) return 0;
+
+  if (sent < size) {
+    pxe_session_queue_copy(session, pool, &chain, sent);
+  }
+
+  return 1;
+}
+
+bool32 pxe_session_send_shared(pxe_session* session, pxe_memory_arena* arena,
+                               pxe_pool* pool, pxe_shared_frame* frame) {
+  if (session->socket.state != PXE_SOCKET_STATE_CONNECTED) return 0;
+
+  pxe_buffer_chain* chain = frame->chain;
+  size_t size = frame->size;
+
+  if (session->compressed) {
+    if (!pxe_shared_frame_compress(frame)) {
+      pxe_session_fail(session);
+      return 0;
+    }
+
+    chain = frame->compressed;
+    size = frame->compressed_size;
+  }
+
+  pxe_buffer_chain* last = session->last_write_chain;
+
+  if (size <= PXE_SESSION_SHARED_COPY_SIZE && last &&
+      last->buffer->max_size - last->buffer->size >= size) {
+    ++session->packets_queued;
+    pxe_session_queue_copy(session, pool, chain, 0);
+    return 1;
+  }
+
+  return pxe_session_send_chain(
+      session, arena, pool, pxe_shared_frame_ref(frame, session->compressed),
+      1);
+}
+
+size_t pxe_session_write_queued(pxe_session* session) {
+  size_t queued = session->write_queued;
+
+#ifdef __linux__
+  if (session->reactor) {
+    pxe_reactor_conn* conn = session->reactor->conns + session->reactor_conn;
+
+    queued += (size_t)(session->write_posted -
+                       __atomic_load_n(&conn->sent_bytes, __ATOMIC_RELAXED));
+  }
+#endif
+
+  return queued;
+}
+
+void pxe_session_consume_sent(pxe_session* session, pxe_pool* pool,
+                              size_t sent) {
+  session->write_offset += sent;
+  session->write_queued -= sent;
+
+  if (session->zerocopy_pending > 0) {
+    pxe_buffer_chain* chain = session->write_buffer_chain;
+
+    // The kernel might still be reading these buffers, so they're held until
+    // the latest zero-copy send completes.
+    while (chain && session->write_offset >= chain->buffer->size) {
+      pxe_buffer_chain* next = chain->next;
+
+      session->write_offset -= chain->buffer->size;
+      chain->next = NULL;
+
+      if (session->last_zerocopy_chain) {
+        session->last_zerocopy_chain->next = chain;
+      } else {
+        session->zerocopy_chain = chain;
+      }
+
+      session->last_zerocopy_chain = chain;
+      session->zerocopy_marks[session->zerocopy_pending - 1] = chain;
+
+      chain = next;
+    }
+
+    session->write_buffer_chain = chain;
+  }
+
+  session->write_buffer_chain = pxe_session_release_sent(
+      pool, session->write_buffer_chain, &session->write_offset, 1);
+
+  if (session->write_buffer_chain == NULL) {
+    session->last_write_chain = NULL;
+    session->write_offset = 0;
+  }
+}
+
+// Returns 1 if the chain has more buffers than fit in a single send.
+static bool32 pxe_session_exceeds_single_send(pxe_buffer_chain* chain) {
+  for (size_t count = 0; chain; chain = chain->next) {
+    if (++count > PXE_SOCKET_MAX_IOV) return 1;
+  }
+
+  return 0;
+}
+
+// Returns 1 if the next send is big enough to be worth sending without a copy.
+static bool32 pxe_session_use_zerocopy(pxe_session* session) {
+  if (!session->zerocopy ||
+      session->zerocopy_pending >= PXE_SESSION_ZEROCOPY_SENDS) {
+    return 0;
+  }
+
+  pxe_buffer_chain* chain = session->write_buffer_chain;
+  size_t size = 0;
+
+  for (size_t count = 0; chain && count < PXE_SOCKET_MAX_IOV; ++count) {
+    size += chain->buffer->size;
+
+    if (size - session->write_offset >= PXE_SESSION_ZEROCOPY_THRESHOLD) {
+      return 1;
+    }
+
+    chain = chain->next;
+  }
+
+  return 0;
+}
+
+void pxe_session_complete_zerocopy(pxe_session* session, pxe_pool* pool) {
+  u32 first, last;
+  bool32 copied;
+
+  while (pxe_socket_read_zerocopy(&session->socket, &first, &last, &copied)) {
+    for (u32 i = 0; i < session->zerocopy_pending; ++i) {
+      u32 id = session->zerocopy_first_id + i;
+
+      if (id - first <= last - first) {
+        session->zerocopy_done[i] = 1;
+      }
+    }
+
+    if (copied) {
+      // The kernel copied the data after all, which happens on loopback and
+      // with devices that can't gather. Copying up front is cheaper.
+      ++session->zerocopy_copied;
+      session->zerocopy = 0;
+    }
+  }
+
+  // Completions can arrive out of order, but buffers are only released once
+  // every send before them is done too.
+  u32 done = 0;
+
+  while (done < session->zerocopy_pending && session->zerocopy_done[done]) {
+    pxe_buffer_chain* mark = session->zerocopy_marks[done++];
+
+    if (mark == NULL) continue;
+
+    pxe_buffer_chain* chain = session->zerocopy_chain;
+
+    session->zerocopy_chain = mark->next;
+    mark->next = NULL;
+
+    if (session->zerocopy_chain == NULL) {
+      session->last_zerocopy_chain = NULL;
+    }
+
+    pxe_pool_free(pool, chain, 1);
+  }
+
+  if (done == 0) return;
+
+  session->zerocopy_pending -= done;
+  session->zerocopy_first_id += done;
+
+  for (u32 i = 0; i < session->zerocopy_pending; ++i) {
+    session->zerocopy_marks[i] = session->zerocopy_marks[i + done];
+    session->zerocopy_done[i] = session->zerocopy_done[i + done];
+  }
+}
+
+bool32 pxe_session_flush(pxe_session* session, pxe_memory_arena* arena,
+                         pxe_pool* pool) {
+  pxe_socket* socket = &session->socket;
+
+  if (session->write_buffer_chain == NULL) return 1;
+
+  // Cork the socket when the queue takes multiple sends so the kernel doesn't
+  // push out a partial frame at the end of each one.
+  bool32 corked = pxe_session_exceeds_single_send(session->write_buffer_chain);
+
+  if (corked) {
+    pxe_socket_set_cork(socket, 1);
+  }
+
+  while (session->write_buffer_chain) {
+    bool32 zerocopy = 0;
+    size_t sent;
+
+    if (pxe_session_use_zerocopy(session)) {
+      sent = pxe_socket_send_chain_zerocopy(socket, arena,
+                                            session->write_buffer_chain,
+                                            session->write_offset, &zerocopy);
+    } else {
+      sent = pxe_socket_send_chain(socket, arena, session->write_buffer_chain,
+                                   session->write_offset);
+    }
+
+    ++session->send_calls;
+
+    if (socket->state != PXE_SOCKET_STATE_CONNECTED) {
+      return 0;
+    }
+
+    if (sent == 0) break;
+
+    if (zerocopy) {
+      u32 index = session->zerocopy_pending++;
+
+      session->zerocopy_marks[index] = NULL;
+      session->zerocopy_done[index] = 0;
+      ++session->zerocopy_sends;
+    }
+
+    pxe_session_consume_sent(session, pool, sent);
+  }
+
+  if (corked) {
+    pxe_socket_set_cork(socket, 0);
+  }
+
+  return 1;
 }
@@ -4,9 +4,71 @@
 #include "pixie.h"
 #include "protocol/pxe_protocol.h"
 #include "pxe_buffer.h"
+#include "pxe_ring.h"
 #include "pxe_socket.h"
+#include "pxe_timer_wheel.h"
 #include "pxe_uuid.h"
 
+// When set, packets are only appended to the session's write chain and get
+// written once per loop iteration by pxe_session_flush.
+#ifndef PXE_SESSION_COALESCE_WRITES
+#define PXE_SESSION_COALESCE_WRITES 1
+#endif
+
+// When set, flushes of at least PXE_SESSION_ZEROCOPY_THRESHOLD bytes are sent
+// without the kernel copying them. Only used by the epoll backend on Linux.
+#ifndef PXE_SESSION_ZEROCOPY
+#define PXE_SESSION_ZEROCOPY 0
+#endif
+
+#ifndef PXE_SESSION_ZEROCOPY_THRESHOLD
+#define PXE_SESSION_ZEROCOPY_THRESHOLD pxe_kilobytes(16)
+#endif
+
+// When set, sessions polled by the game thread itself read their input into a
+// ring of PXE_SESSION_RING_SIZE bytes that's mapped twice in a row. Packets in
+// it are always contiguous, so they're decoded in place without splitting
+// fields across pool buffers. A session that sends a packet larger than the
+// ring is disconnected. Only supported on Linux and not used by io_uring or
+// the reactors, which keep reading into buffer chains.
+#ifndef PXE_SESSION_RECEIVE_RING
+#define PXE_SESSION_RECEIVE_RING 0
+#endif
+
+// Must be a power of two and a multiple of the page size.
+#ifndef PXE_SESSION_RING_SIZE
+#define PXE_SESSION_RING_SIZE pxe_kilobytes(64)
+#endif
+
+// Zero-copy sends that can be waiting on completion at once. Flushes past
+// this are copied.
+#define PXE_SESSION_ZEROCOPY_SENDS 8
+
+// Shared frames up to this size are copied into the room left in the last
+// write buffer rather than queued by reference. A reference costs about as
+// much as copying that many bytes, and each one is another iovec to send.
+#ifndef PXE_SESSION_SHARED_COPY_SIZE
+#define PXE_SESSION_SHARED_COPY_SIZE 64
+#endif
+
+// Limits on output queued for a session that the socket hasn't taken yet. Past
+// the soft limit, packets that are safe to lose such as movement are dropped
+// and chunk streaming pauses. A session that stays past it for
+// PXE_SESSION_WRITE_GRACE_MS or goes past the hard limit is disconnected, so a
+// stalled client can't keep growing the write pool.
+#ifndef PXE_SESSION_WRITE_SOFT_LIMIT
+#define PXE_SESSION_WRITE_SOFT_LIMIT pxe_kilobytes(256)
+#endif
+
+#ifndef PXE_SESSION_WRITE_HARD_LIMIT
+#define PXE_SESSION_WRITE_HARD_LIMIT pxe_megabytes(2)
+#endif
+
+// Zero keeps sessions past the soft limit connected.
+#ifndef PXE_SESSION_WRITE_GRACE_MS
+#define PXE_SESSION_WRITE_GRACE_MS 10000
+#endif
+
 typedef enum {
   PXE_GAMEMODE_SURVIVAL = 0x00,
   PXE_GAMEMODE_CREATIVE,
@@ -16,18 +78,29 @@ typedef enum {
   PXE_GAMEMODE_COUNT
 } pxe_gamemode;
 
-typedef struct pxe_session {
-  pxe_protocol_state protocol_state;
-  pxe_socket socket;
+// The timers each session has on the server's timer wheel. A timer is only
+// active while the session needs it.
+typedef enum {
+  // Sends a keep-alive and the world time.
+  PXE_SESSION_TIMER_KEEP_ALIVE,
+  // Sends the session's movement to the other players.
+  PXE_SESSION_TIMER_POSITION,
+  // Runs every tick while the session is regenerating health or still has
+  // chunks to stream.
+  PXE_SESSION_TIMER_UPDATE,
+  // Disconnects the session for not finishing the login or not answering a
+  // keep-alive in time.
+  PXE_SESSION_TIMER_TIMEOUT,
 
-  i32 entity_id;
-  char username[16];
-  pxe_uuid uuid;
-  i64 next_keep_alive;
-  i64 next_position_broadcast;
-  i64 last_damage_time;
+  PXE_SESSION_TIMER_COUNT
+} pxe_session_timer_id;
 
-  pxe_gamemode gamemode;
+// The part of a session that the tick and the broadcasts look at for every
+// player. These are kept in their own array apart from the sockets and
+// buffers so walking all of the sessions only touches this data.
+typedef struct pxe_session_hot {
+  pxe_protocol_state protocol_state;
+  i32 entity_id;
 
   double previous_x;
   double previous_y;
@@ -44,20 +117,158 @@ typedef struct pxe_session {
   float pitch;
 
   bool32 on_ground;
+  // Chunks around spawn that still have to be sent.
+  u32 chunks_remaining;
+} pxe_session_hot;
+
+typedef struct pxe_session {
+  // Points into the server's array of hot data. It's assigned once with the
+  // session's slot and stays the same for every session that uses the slot.
+  pxe_session_hot* hot;
+  // The session's slot in the server, which is fixed along with hot.
+  u32 slot;
+  pxe_socket socket;
+
+  // Up to 16 characters and the terminator.
+  char username[17];
+  pxe_uuid uuid;
+  i64 last_damage_time;
+
+  pxe_gamemode gamemode;
+
+  pxe_timer timers[PXE_SESSION_TIMER_COUNT];
+  // Set from when a keep-alive is sent until the client answers it with the
+  // same id.
+  bool32 keep_alive_pending;
+  i64 keep_alive_id;
+
+  // Set once the session was told to use compression, after which packets in
+  // both directions are framed with their Data Length.
+  bool32 compressed;
 
   pxe_buffer_reader buffer_reader;
   // The chain of buffers that have been read and need to be fully processed.
   struct pxe_buffer_chain* read_buffer_chain;
   // Store the last buffer_chain so it's easy to append in order.
   struct pxe_buffer_chain* last_read_chain;
+  // Holds the input instead of the read chain when it was created.
+  pxe_ring receive_ring;
+  // The unread part of the ring as a chain, for reading it with buffer_reader.
+  pxe_buffer ring_buffer;
+  pxe_buffer_chain ring_chain;
 
+  // The chain of buffers that are queued to be sent to the socket.
   struct pxe_buffer_chain* write_buffer_chain;
   struct pxe_buffer_chain* last_write_chain;
+  // How much of the first write buffer has already been sent.
+  size_t write_offset;
+  // Bytes in the write chain that haven't been sent.
+  size_t write_queued;
+  // Bytes handed to the reactor, which sends them on its own.
+  u64 write_posted;
+  // When the queue went past the soft limit or 0 if it's under it.
+  i64 write_backlog_time;
+  // Set while the server is waiting for the socket to become writable.
+  bool32 write_registered;
+  // Set when the read budget ran out before the socket was drained.
+  bool32 read_pending;
+
+  // Packets queued and socket sends made since the server last collected them.
+  u32 packets_queued;
+  u32 send_calls;
+  u32 zerocopy_sends;
+  u32 zerocopy_copied;
+
+  // Set while zero-copy sends are enabled on the socket.
+  bool32 zerocopy;
+  // Sent buffers that the kernel might still be reading. Each pending send
+  // marks the last buffer released after it, and the buffers are returned to
+  // the pool once that send and every one before it have completed.
+  struct pxe_buffer_chain* zerocopy_chain;
+  struct pxe_buffer_chain* last_zerocopy_chain;
+  struct pxe_buffer_chain* zerocopy_marks[PXE_SESSION_ZEROCOPY_SENDS];
+  bool32 zerocopy_done[PXE_SESSION_ZEROCOPY_SENDS];
+  // Completion id of the oldest pending send.
+  u32 zerocopy_first_id;
+  u32 zerocopy_pending;
+
+  // Set when movement was dropped because the queue was backed up. Movement
+  // is then sent as teleports until move_resync_until, since the client
+  // missed some of the relative moves.
+  bool32 moves_dropped;
+  i64 move_resync_until;
+
+  // Requests in flight when the server runs on io_uring.
+  struct pxe_io_uring_conn* io_uring_conn;
+
+  // The reactor thread that owns the socket and the connection index within
+  // it. The session's own socket isn't used when this is set.
+  struct pxe_reactor* reactor;
+  u32 reactor_conn;
 } pxe_session;
 
 struct pxe_game_server;
+struct pxe_io_uring_conn;
+struct pxe_memory_arena;
+struct pxe_pool;
+struct pxe_reactor;
 
 void pxe_session_initialize(pxe_session* session);
 void pxe_session_free(pxe_session* session, struct pxe_game_server* server);
 
+// The pool the session's input buffers are freed to once they're processed.
+// Buffers a reactor read go back to that reactor, since only the pool that
+// owns a buffer counts it as returned.
+struct pxe_pool* pxe_session_read_pool(pxe_session* session,
+                                       struct pxe_game_server* server);
+
+// Marks the session's socket as errored after a packet couldn't be sent, so
+// the server removes the session instead of leaving the client waiting on it.
+void pxe_session_fail(pxe_session* session);
+
+// Points ring_chain at the unread part of the receive ring and returns it.
+pxe_buffer_chain* pxe_session_wrap_ring(pxe_session* session);
+// Moves the read chain into the receive ring. Returns 0 and leaves the chain
+// alone if it doesn't fit.
+bool32 pxe_session_fill_ring(pxe_session* session, struct pxe_pool* pool);
+
+// Sends the chain immediately if nothing is queued, then queues whatever the
+// socket didn't take. With PXE_SESSION_COALESCE_WRITES the whole chain is
+// queued for the next flush instead. If owned is set, the chain buffers are taken over by the
+// session and returned to the pool once sent. Otherwise the unsent bytes are
+// copied into buffers from the pool and the chain is left untouched.
+// Returns 0 if the socket is no longer connected.
+bool32 pxe_session_send_chain(pxe_session* session,
+                              struct pxe_memory_arena* arena,
+                              struct pxe_pool* pool,
+                              struct pxe_buffer_chain* chain, bool32 owned);
+// Sends a small frame that's only in the caller's memory. When nothing is
+// queued ahead of it, it's written straight to the socket even with
+// PXE_SESSION_COALESCE_WRITES, so only what the socket doesn't take is copied
+// into buffers from the pool. Returns 0 if the socket is no longer connected.
+bool32 pxe_session_send_bytes(pxe_session* session,
+                              struct pxe_memory_arena* arena,
+                              struct pxe_pool* pool, u8* data, size_t size);
+// Queues a shared frame for the session, or its compressed variant if the
+// session uses compression. pool must be the one the frame came from.
+// Returns 0 if the socket is no longer connected or the frame couldn't be
+// compressed, which fails the session.
+bool32 pxe_session_send_shared(pxe_session* session,
+                               struct pxe_memory_arena* arena,
+                               struct pxe_pool* pool,
+                               struct pxe_shared_frame* frame);
+// Returns the bytes queued for the session that haven't reached the socket,
+// including those waiting on its reactor.
+size_t pxe_session_write_queued(pxe_session* session);
+// Releases the first sent bytes of the write chain back to the pool.
+void pxe_session_consume_sent(pxe_session* session, struct pxe_pool* pool,
+                              size_t sent);
+// Writes queued data until the socket would block.
+// Returns 0 if the socket is no longer connected.
+bool32 pxe_session_flush(pxe_session* session, struct pxe_memory_arena* arena,
+                         struct pxe_pool* pool);
+// Reads zero-copy completions and returns the buffers that are no longer in
+// use to the pool.
+void pxe_session_complete_zerocopy(pxe_session* session, struct pxe_pool* pool);
+
 #endif
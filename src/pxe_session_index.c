@@ -0,0 +1,130 @@
+#include "pxe_session_index.h"
+
+#include "pxe_alloc.h"
+
+#include <string.h>
+
+static u64 pxe_session_index_hash(const u8* key) {
+  u64 a, b;
+
+  memcpy(&a, key, sizeof(a));
+  memcpy(&b, key + sizeof(a), sizeof(b));
+
+  // The finalizer from MurmurHash3, which spreads small sequential keys like
+  // entity ids across the whole table.
+  u64 hash = a ^ (b * 0x9E3779B97F4A7C15ULL);
+
+  hash ^= hash >> 33;
+  hash *= 0xFF51AFD7ED558CCDULL;
+  hash ^= hash >> 33;
+  hash *= 0xC4CEB9FE1A85EC53ULL;
+  hash ^= hash >> 33;
+
+  return hash;
+}
+
+// Returns the entry holding key or the empty entry where it would go.
+static pxe_session_index_entry* pxe_session_index_probe(
+    pxe_session_index_entry* entries, size_t capacity, const u8* key) {
+  size_t mask = capacity - 1;
+  size_t i = (size_t)pxe_session_index_hash(key) & mask;
+
+  while (entries[i].handle != 0 &&
+         memcmp(entries[i].key, key, PXE_SESSION_INDEX_KEY_SIZE) != 0) {
+    i = (i + 1) & mask;
+  }
+
+  return entries + i;
+}
+
+static bool32 pxe_session_index_grow(pxe_session_index* index) {
+  size_t capacity = index->capacity ? index->capacity * 2
+                                    : PXE_SESSION_INDEX_INITIAL_CAPACITY;
+  pxe_session_index_entry* entries =
+      pxe_page_alloc(capacity * sizeof(pxe_session_index_entry));
+
+  if (entries == NULL) return 0;
+
+  for (size_t i = 0; i < index->capacity; ++i) {
+    pxe_session_index_entry* entry = index->entries + i;
+
+    if (entry->handle == 0) continue;
+
+    *pxe_session_index_probe(entries, capacity, entry->key) = *entry;
+  }
+
+  if (index->entries) {
+    pxe_page_free(index->entries,
+                  index->capacity * sizeof(pxe_session_index_entry));
+  }
+
+  index->entries = entries;
+  index->capacity = capacity;
+
+  return 1;
+}
+
+bool32 pxe_session_index_insert(pxe_session_index* index, const void* key,
+                                u64 handle) {
+  if ((index->count + 1) * 2 > index->capacity &&
+      !pxe_session_index_grow(index)) {
+    return 0;
+  }
+
+  pxe_session_index_entry* entry =
+      pxe_session_index_probe(index->entries, index->capacity, key);
+
+  if (entry->handle != 0) return entry->handle == handle;
+
+  memcpy(entry->key, key, PXE_SESSION_INDEX_KEY_SIZE);
+  entry->handle = handle;
+  ++index->count;
+
+  return 1;
+}
+
+u64 pxe_session_index_find(pxe_session_index* index, const void* key) {
+  if (index->count == 0) return 0;
+
+  return pxe_session_index_probe(index->entries, index->capacity, key)->handle;
+}
+
+void pxe_session_index_remove(pxe_session_index* index, const void* key,
+                              u64 handle) {
+  if (index->count == 0) return;
+
+  pxe_session_index_entry* entry =
+      pxe_session_index_probe(index->entries, index->capacity, key);
+
+  if (entry->handle == 0 || entry->handle != handle) return;
+
+  size_t mask = index->capacity - 1;
+  size_t hole = (size_t)(entry - index->entries);
+
+  // Moves later entries of the run back into the hole unless that would put
+  // them before the slot they hash to.
+  for (size_t i = (hole + 1) & mask; index->entries[i].handle != 0;
+       i = (i + 1) & mask) {
+    size_t home =
+        (size_t)pxe_session_index_hash(index->entries[i].key) & mask;
+
+    if (((i - home) & mask) >= ((i - hole) & mask)) {
+      index->entries[hole] = index->entries[i];
+      hole = i;
+    }
+  }
+
+  index->entries[hole].handle = 0;
+  --index->count;
+}
+
+void pxe_session_index_free(pxe_session_index* index) {
+  if (index->entries) {
+    pxe_page_free(index->entries,
+                  index->capacity * sizeof(pxe_session_index_entry));
+  }
+
+  index->entries = NULL;
+  index->capacity = 0;
+  index->count = 0;
+}
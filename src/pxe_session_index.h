@@ -0,0 +1,38 @@
+#ifndef PIXIE_SESSION_INDEX_H_
+#define PIXIE_SESSION_INDEX_H_
+
+#include "pixie.h"
+
+// Keys are compared as this many bytes, so shorter keys are zero padded.
+#define PXE_SESSION_INDEX_KEY_SIZE 16
+// Capacity of the table before anything is inserted. Must be a power of two.
+#define PXE_SESSION_INDEX_INITIAL_CAPACITY 64
+
+typedef struct pxe_session_index_entry {
+  u8 key[PXE_SESSION_INDEX_KEY_SIZE];
+  // Zero marks an empty entry, which no session handle can be.
+  u64 handle;
+} pxe_session_index_entry;
+
+// Maps fixed-size keys to session handles with open addressing and linear
+// probing. Removal shifts the rest of the probe run back, so lookups never
+// have to step over deleted entries. The table doubles once it's half full.
+typedef struct pxe_session_index {
+  pxe_session_index_entry* entries;
+  size_t capacity;
+  size_t count;
+} pxe_session_index;
+
+// Maps key to handle. Returns 0 without changing anything if key is already
+// mapped to another handle, or if the table couldn't grow.
+bool32 pxe_session_index_insert(pxe_session_index* index, const void* key,
+                                u64 handle);
+// Returns 0 if nothing is mapped to key.
+u64 pxe_session_index_find(pxe_session_index* index, const void* key);
+// Removes key only if it's still mapped to handle, so a session can't remove
+// the entry of a newer one that took over its key.
+void pxe_session_index_remove(pxe_session_index* index, const void* key,
+                              u64 handle);
+void pxe_session_index_free(pxe_session_index* index);
+
+#endif
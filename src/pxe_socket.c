@@ -13,7 +13,20 @@
 #define MSG_DONTWAIT 0
 #else
 #include <fcntl.h>
+#include <sys/syscall.h>
 #define PXE_WOULDBLOCK EWOULDBLOCK
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+#ifdef __linux__
+#include <linux/errqueue.h>
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+#endif
 #endif
 
 static int pxe_get_error_code() {
@@ -81,7 +94,9 @@ void pxe_socket_disconnect(pxe_socket* socket) {
   }
 }
 
-bool32 pxe_socket_listen(pxe_socket* sock, const char* local_host, u16 port) {
+static bool32 pxe_socket_listen_internal(pxe_socket* sock,
+                                         const char* local_host, u16 port,
+                                         int backlog, bool32 shared) {
   struct addrinfo hint = {0}, *result;
 
   hint.ai_family = AF_INET;
@@ -98,6 +113,18 @@ bool32 pxe_socket_listen(pxe_socket* sock, const char* local_host, u16 port) {
   setsockopt(sock->fd, SOL_SOCKET, SO_REUSEADDR, (char*)&optval,
              sizeof(optval));
 
+#ifdef SO_REUSEPORT
+  if (shared) {
+    setsockopt(sock->fd, SOL_SOCKET, SO_REUSEPORT, (char*)&optval,
+               sizeof(optval));
+  }
+#else
+  if (shared) {
+    closesocket(sock->fd);
+    return 0;
+  }
+#endif
+
   char service[32];
 
   sprintf_s(service, pxe_array_size(service), "%d", port);
@@ -113,7 +140,7 @@ bool32 pxe_socket_listen(pxe_socket* sock, const char* local_host, u16 port) {
 
   freeaddrinfo(result);
 
-  if (listen(sock->fd, 20) != 0) {
+  if (listen(sock->fd, backlog) != 0) {
     return 0;
   }
 
@@ -122,25 +149,70 @@ bool32 pxe_socket_listen(pxe_socket* sock, const char* local_host, u16 port) {
   return 1;
 }
 
+bool32 pxe_socket_listen(pxe_socket* sock, const char* local_host, u16 port,
+                         int backlog) {
+  return pxe_socket_listen_internal(sock, local_host, port, backlog, 0);
+}
+
+bool32 pxe_socket_listen_shared(pxe_socket* sock, const char* local_host,
+                                u16 port, int backlog) {
+  return pxe_socket_listen_internal(sock, local_host, port, backlog, 1);
+}
+
 bool32 pxe_socket_accept(pxe_socket* socket, pxe_socket* result) {
   struct sockaddr_in their_addr;
 
   socklen_t addr_size = (int)sizeof(their_addr);
 
-  pxe_socket_set_block(socket, 0);
+#if defined(__linux__) && defined(SYS_accept4)
+  // accept4 is called through syscall because glibc only declares it with
+  // _GNU_SOURCE. It saves the fcntl calls to make the socket non-blocking.
+  pxe_socket_handle new_fd = (pxe_socket_handle)syscall(
+      SYS_accept4, socket->fd, (struct sockaddr*)&their_addr, &addr_size,
+      SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+  if (new_fd == PXE_SOCKET_ERROR) {
+    return 0;
+  }
+#else
   pxe_socket_handle new_fd =
       accept(socket->fd, (struct sockaddr*)&their_addr, &addr_size);
 
   if (new_fd == PXE_SOCKET_ERROR) {
     return 0;
   }
+#endif
 
   result->endpoint = their_addr;
   result->fd = new_fd;
   result->port = 0;
   result->state = PXE_SOCKET_STATE_CONNECTED;
 
+#if !defined(__linux__) || !defined(SYS_accept4)
+  pxe_socket_set_block(result, 0);
+#endif
+
+  return 1;
+}
+
+bool32 pxe_socket_accept_queue(pxe_socket* socket, u32* length,
+                               u32* capacity) {
+#if defined(__linux__) && defined(TCP_INFO)
+  struct tcp_info info;
+  socklen_t info_size = sizeof(info);
+
+  if (getsockopt(socket->fd, IPPROTO_TCP, TCP_INFO, &info, &info_size) != 0) {
+    return 0;
+  }
+
+  // Listen sockets report the accept queue in these fields.
+  *length = info.tcpi_unacked;
+  *capacity = info.tcpi_sacked;
+
   return 1;
+#else
+  return 0;
+#endif
 }
 
 size_t pxe_socket_send(pxe_socket* socket, const char* data, size_t size) {
@@ -175,30 +247,47 @@ size_t pxe_socket_send_buffer(pxe_socket* socket, pxe_buffer* buffer) {
   return pxe_socket_send(socket, (char*)buffer->data, buffer->size);
 }
 
-size_t pxe_socket_send_chain(pxe_socket* socket, struct pxe_memory_arena* arena,
-                             pxe_buffer_chain* chain) {
+static size_t pxe_socket_send_chain_internal(pxe_socket* socket,
+                                             struct pxe_memory_arena* arena,
+                                             pxe_buffer_chain* chain,
+                                             size_t offset, int flags,
+                                             bool32* zerocopied) {
+  if (socket->state != PXE_SOCKET_STATE_CONNECTED) {
+    return 0;
+  }
+
 #ifdef _WIN32
   WSABUF* wsa_buffers = pxe_arena_push_type(arena, WSABUF);
   WSABUF* current_buf = wsa_buffers;
   size_t num_buffers = 0;
 
   do {
-    current_buf->buf = (char*)chain->buffer->data;
-    current_buf->len = (ULONG)chain->buffer->size;
+    current_buf->buf = (char*)chain->buffer->data + offset;
+    current_buf->len = (ULONG)(chain->buffer->size - offset);
 
+    offset = 0;
     ++num_buffers;
 
-    current_buf = pxe_arena_push_type(arena, WSABUF);
-
     chain = chain->next;
-  } while (chain);
 
-  size_t sent = 0;
+    if (chain && num_buffers < PXE_SOCKET_MAX_IOV) {
+      current_buf = pxe_arena_push_type(arena, WSABUF);
+    }
+  } while (chain && num_buffers < PXE_SOCKET_MAX_IOV);
+
+  DWORD sent = 0;
 
-  if (WSASend(socket->fd, wsa_buffers, (DWORD)num_buffers, (DWORD*)&sent, 0,
-              NULL, NULL) != 0) {
+  if (WSASend(socket->fd, wsa_buffers, (DWORD)num_buffers, &sent, 0, NULL,
+              NULL) != 0) {
     int err = pxe_get_error_code();
-    fprintf(stderr, "Error using WSASend: %d\n", err);
+
+    if (err != PXE_WOULDBLOCK) {
+      pxe_socket_disconnect(socket);
+      socket->error_code = err;
+      socket->state = PXE_SOCKET_STATE_ERROR;
+    }
+
+    return 0;
   }
 
   return sent;
@@ -208,34 +297,136 @@ size_t pxe_socket_send_chain(pxe_socket* socket, struct pxe_memory_arena* arena,
   size_t num_buffers = 0;
 
   do {
-    cur_buf->iov_base = chain->buffer->data;
-    cur_buf->iov_len = chain->buffer->size;
+    cur_buf->iov_base = chain->buffer->data + offset;
+    cur_buf->iov_len = chain->buffer->size - offset;
 
+    offset = 0;
     ++num_buffers;
 
-    cur_buf = pxe_arena_push_type(arena, struct iovec);
-
     chain = chain->next;
-  } while (chain);
 
-  ssize_t sent;
+    if (chain && num_buffers < PXE_SOCKET_MAX_IOV) {
+      cur_buf = pxe_arena_push_type(arena, struct iovec);
+    }
+  } while (chain && num_buffers < PXE_SOCKET_MAX_IOV);
+
+  struct msghdr msg = {0};
+
+  msg.msg_iov = io_buffers;
+  msg.msg_iovlen = num_buffers;
 
-  sent = writev(socket->fd, io_buffers, num_buffers);
+  // sendmsg is used over writev so a closed peer doesn't raise SIGPIPE.
+  ssize_t sent = sendmsg(socket->fd, &msg, MSG_NOSIGNAL | flags);
+
+  if (zerocopied) {
+    *zerocopied = sent > 0;
+  }
 
   if (sent < 0) {
     int err = errno;
-    fprintf(stderr, "Error using writev: %d\n", err);
+
+#ifdef __linux__
+    // The socket ran out of memory for tracking zero-copy sends, so copy
+    // this one instead. It doesn't get a completion id.
+    if (err == ENOBUFS && (flags & MSG_ZEROCOPY)) {
+      sent = sendmsg(socket->fd, &msg, MSG_NOSIGNAL);
+
+      if (sent >= 0) return (size_t)sent;
+
+      err = errno;
+    }
+#endif
+
+    if (err != PXE_WOULDBLOCK && err != EAGAIN && err != EINTR) {
+      pxe_socket_disconnect(socket);
+      socket->error_code = err;
+      socket->state = PXE_SOCKET_STATE_ERROR;
+    }
+
+    return 0;
   }
 
-  return sent;
+  return (size_t)sent;
+#endif
+}
+
+size_t pxe_socket_send_chain(pxe_socket* socket, struct pxe_memory_arena* arena,
+                             pxe_buffer_chain* chain, size_t offset) {
+  return pxe_socket_send_chain_internal(socket, arena, chain, offset, 0, NULL);
+}
+
+size_t pxe_socket_send_chain_zerocopy(pxe_socket* socket,
+                                      struct pxe_memory_arena* arena,
+                                      pxe_buffer_chain* chain, size_t offset,
+                                      bool32* zerocopied) {
+  *zerocopied = 0;
+
+#ifdef __linux__
+  return pxe_socket_send_chain_internal(socket, arena, chain, offset,
+                                        MSG_ZEROCOPY, zerocopied);
+#else
+  return pxe_socket_send_chain_internal(socket, arena, chain, offset, 0, NULL);
+#endif
+}
+
+bool32 pxe_socket_set_zerocopy(pxe_socket* socket) {
+#ifdef __linux__
+  int value = 1;
+
+  // Loopback always copies, and the pinned pages count against the peer's
+  // receive buffer until it does, which stalls small receive windows.
+  if ((ntohl(socket->endpoint.sin_addr.s_addr) >> 24) == 127) return 0;
+
+  return setsockopt(socket->fd, SOL_SOCKET, SO_ZEROCOPY, &value,
+                    sizeof(value)) == 0;
+#else
+  return 0;
+#endif
+}
+
+bool32 pxe_socket_read_zerocopy(pxe_socket* socket, u32* first, u32* last,
+                                bool32* copied) {
+#ifdef __linux__
+  char control[128];
+  struct msghdr msg = {0};
+
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+
+  while (recvmsg(socket->fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) >= 0) {
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+         cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+      if (!(cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_RECVERR) &&
+          !(cmsg->cmsg_level == IPPROTO_IPV6 && cmsg->cmsg_type == IPV6_RECVERR)) {
+        continue;
+      }
+
+      struct sock_extended_err* err =
+          (struct sock_extended_err*)CMSG_DATA(cmsg);
+
+      if (err->ee_origin != SO_EE_ORIGIN_ZEROCOPY) continue;
+
+      *first = err->ee_info;
+      *last = err->ee_data;
+      *copied = (err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) != 0;
+
+      return 1;
+    }
+
+    // Skip anything on the error queue that isn't a zero-copy completion.
+    msg.msg_controllen = sizeof(control);
+  }
 #endif
+
+  return 0;
 }
 
 size_t pxe_socket_receive(pxe_socket* socket, char* data, size_t size) {
   int recv_amount = recv(socket->fd, data, (int)size, MSG_DONTWAIT);
 
   if (recv_amount <= 0) {
-    int err = pxe_get_error_code();
+    // A zero return is an orderly shutdown, so errno is stale.
+    int err = recv_amount == 0 ? 0 : pxe_get_error_code();
 
     if (err == PXE_WOULDBLOCK) {
       return 0;
@@ -254,6 +445,134 @@ size_t pxe_socket_receive(pxe_socket* socket, char* data, size_t size) {
   return recv_amount;
 }
 
+pxe_buffer_chain* pxe_socket_receive_chain(pxe_socket* socket,
+                                           struct pxe_memory_arena* arena,
+                                           pxe_pool* pool, size_t max_size,
+                                           bool32* drained) {
+  pxe_buffer_chain* head = NULL;
+  pxe_buffer_chain* last = NULL;
+
+  *drained = 0;
+
+  while (max_size > 0 && socket->state == PXE_SOCKET_STATE_CONNECTED) {
+    size_t count = (max_size + pool->element_size - 1) / pool->element_size;
+
+    if (count > PXE_SOCKET_MAX_READ_IOV) {
+      count = PXE_SOCKET_MAX_READ_IOV;
+    }
+
+    pxe_buffer_chain* batch = NULL;
+    pxe_buffer_chain* batch_last = NULL;
+    size_t capacity = 0;
+
+#ifdef _WIN32
+    WSABUF* buffers = pxe_arena_push_type_count(arena, WSABUF, count);
+#else
+    struct iovec* buffers = pxe_arena_push_type_count(arena, struct iovec, count);
+#endif
+
+    for (size_t i = 0; i < count; ++i) {
+      pxe_buffer_chain* chain = pxe_pool_alloc(pool);
+
+#ifdef _WIN32
+      buffers[i].buf = (char*)chain->buffer->data;
+      buffers[i].len = (ULONG)chain->buffer->max_size;
+#else
+      buffers[i].iov_base = chain->buffer->data;
+      buffers[i].iov_len = chain->buffer->max_size;
+#endif
+
+      capacity += chain->buffer->max_size;
+
+      if (batch == NULL) {
+        batch = chain;
+      } else {
+        batch_last->next = chain;
+      }
+
+      batch_last = chain;
+    }
+
+#ifdef _WIN32
+    DWORD flags = 0;
+    DWORD received_size = 0;
+    int result = WSARecv(socket->fd, buffers, (DWORD)count, &received_size,
+                         &flags, NULL, NULL);
+    i64 received = result == 0 ? (i64)received_size : -1;
+#else
+    i64 received = readv(socket->fd, buffers, (int)count);
+#endif
+
+    if (received <= 0) {
+      pxe_pool_free(pool, batch, 1);
+
+      int err = received == 0 ? 0 : pxe_get_error_code();
+      bool32 would_block = err == PXE_WOULDBLOCK;
+      bool32 interrupted = 0;
+
+#ifndef _WIN32
+      would_block = would_block || err == EAGAIN;
+      interrupted = err == EINTR;
+#endif
+
+      if (would_block) {
+        *drained = 1;
+      } else if (!interrupted) {
+        pxe_socket_disconnect(socket);
+
+        if (err != 0) {
+          socket->error_code = err;
+          socket->state = PXE_SOCKET_STATE_ERROR;
+        }
+
+        *drained = 1;
+      }
+
+      break;
+    }
+
+    size_t remaining = (size_t)received;
+
+    while (batch) {
+      pxe_buffer_chain* next = batch->next;
+
+      if (remaining == 0) {
+        pxe_pool_free(pool, batch, 0);
+      } else {
+        size_t size = batch->buffer->max_size;
+
+        if (size > remaining) {
+          size = remaining;
+        }
+
+        batch->buffer->size = size;
+        batch->next = NULL;
+        remaining -= size;
+
+        if (head == NULL) {
+          head = batch;
+        } else {
+          last->next = batch;
+        }
+
+        last = batch;
+      }
+
+      batch = next;
+    }
+
+    // A short read on a stream socket means there's nothing left to read.
+    if ((size_t)received < capacity) {
+      *drained = 1;
+      break;
+    }
+
+    max_size = (size_t)received < max_size ? max_size - (size_t)received : 0;
+  }
+
+  return head;
+}
+
 void pxe_socket_set_block(pxe_socket* socket, bool32 block) {
   unsigned long mode = block ? 0 : 1;
 
@@ -267,3 +586,28 @@ void pxe_socket_set_block(pxe_socket* socket, bool32 block) {
   fcntl(socket->fd, F_SETFL, flags);
 #endif
 }
+
+void pxe_socket_set_nodelay(pxe_socket* socket, bool32 nodelay) {
+  int optval = nodelay ? 1 : 0;
+
+  setsockopt(socket->fd, IPPROTO_TCP, TCP_NODELAY, (char*)&optval,
+             sizeof(optval));
+}
+
+void pxe_socket_set_cork(pxe_socket* socket, bool32 cork) {
+#ifdef TCP_CORK
+  int optval = cork ? 1 : 0;
+
+  setsockopt(socket->fd, IPPROTO_TCP, TCP_CORK, (char*)&optval,
+             sizeof(optval));
+#endif
+}
+
+void pxe_socket_set_busy_poll(pxe_socket* socket, u32 usecs) {
+#ifdef SO_BUSY_POLL
+  int optval = (int)usecs;
+
+  setsockopt(socket->fd, SOL_SOCKET, SO_BUSY_POLL, (char*)&optval,
+             sizeof(optval));
+#endif
+}
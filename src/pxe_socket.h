@@ -12,6 +12,7 @@
 #include <errno.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/uio.h>
@@ -19,6 +20,11 @@
 #define closesocket close
 #endif
 
+// The most buffers that will be passed to a single vectored send.
+#define PXE_SOCKET_MAX_IOV 1024
+// The most buffers that will be filled by a single vectored receive.
+#define PXE_SOCKET_MAX_READ_IOV 64
+
 #ifdef _WIN64
 typedef unsigned long long pxe_socket_handle;
 #else
@@ -61,17 +67,65 @@ typedef struct {
 struct pxe_memory_arena;
 struct pxe_buffer;
 struct pxe_buffer_chain;
+struct pxe_pool;
 
 bool32 pxe_socket_connect(pxe_socket* socket, const char* server, u16 port);
 void pxe_socket_disconnect(pxe_socket* socket);
-// Binds and listens on the provided port.
-bool32 pxe_socket_listen(pxe_socket* socket, const char* local_host, u16 port);
+// Binds and listens on the provided port. backlog is the size of the queue of
+// connections waiting to be accepted.
+bool32 pxe_socket_listen(pxe_socket* socket, const char* local_host, u16 port,
+                         int backlog);
+// Listens with SO_REUSEPORT so several sockets can share the port and the
+// kernel spreads new connections between them. Fails if that isn't supported.
+bool32 pxe_socket_listen_shared(pxe_socket* socket, const char* local_host,
+                                u16 port, int backlog);
+// Accepts a pending connection as a non-blocking socket. The listen socket
+// must be non-blocking. Returns 0 once there are no more connections.
 bool32 pxe_socket_accept(pxe_socket* socket, pxe_socket* result);
+// Gets how many connections are waiting in the listen socket's accept queue
+// and how many fit. Returns 0 if the platform doesn't report it.
+bool32 pxe_socket_accept_queue(pxe_socket* socket, u32* length, u32* capacity);
 size_t pxe_socket_send(pxe_socket* socket, const char* data, size_t size);
 size_t pxe_socket_send_buffer(pxe_socket* socket, struct pxe_buffer* buffer);
+// Sends as much of the chain as the socket will take without blocking, starting
+// offset bytes into the first buffer. Returns the number of bytes sent. The
+// socket state is set to PXE_SOCKET_STATE_ERROR if the send failed.
 size_t pxe_socket_send_chain(pxe_socket* socket, struct pxe_memory_arena* arena,
-                             struct pxe_buffer_chain* chain);
+                             struct pxe_buffer_chain* chain, size_t offset);
+// Like pxe_socket_send_chain, but the kernel reads straight from the buffers
+// instead of copying them. zerocopied is set when the send got the socket's
+// next completion id, counting from 0, and the buffers then can't be changed
+// until pxe_socket_read_zerocopy reports that id as done. Needs
+// pxe_socket_set_zerocopy first. Sends are copied when the kernel is out of
+// memory for tracking them and on other platforms.
+size_t pxe_socket_send_chain_zerocopy(pxe_socket* socket,
+                                      struct pxe_memory_arena* arena,
+                                      struct pxe_buffer_chain* chain,
+                                      size_t offset, bool32* zerocopied);
+// Returns 0 if the platform doesn't support zero-copy sends or the peer is on
+// loopback, where the kernel copies the data anyway.
+bool32 pxe_socket_set_zerocopy(pxe_socket* socket);
+// Reads the next zero-copy completion from the socket's error queue. Sends with
+// ids first through last are done. copied is set if the kernel had to copy the
+// data anyway. Returns 0 once there are no more completions.
+bool32 pxe_socket_read_zerocopy(pxe_socket* socket, u32* first, u32* last,
+                                bool32* copied);
 size_t pxe_socket_receive(pxe_socket* socket, char* data, size_t size);
+// Reads up to max_size bytes into buffers from the pool, filling many buffers
+// per call. drained is set once the socket had nothing more to read, which
+// lets edge-triggered callers know they don't have to come back. Returns the
+// filled buffers or NULL if nothing was read.
+struct pxe_buffer_chain* pxe_socket_receive_chain(
+    pxe_socket* socket, struct pxe_memory_arena* arena, struct pxe_pool* pool,
+    size_t max_size, bool32* drained);
 void pxe_socket_set_block(pxe_socket* socket, bool32 block);
+// Disables Nagle's algorithm so small writes go out without delay.
+void pxe_socket_set_nodelay(pxe_socket* socket, bool32 nodelay);
+// Holds back partial frames until the socket is uncorked. Does nothing on
+// platforms without TCP_CORK.
+void pxe_socket_set_cork(pxe_socket* socket, bool32 cork);
+// Lets receives spin on the device queue for up to usecs before sleeping. Does
+// nothing on platforms without SO_BUSY_POLL.
+void pxe_socket_set_busy_poll(pxe_socket* socket, u32 usecs);
 
 #endif
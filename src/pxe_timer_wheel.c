@@ -0,0 +1,127 @@
+#include "pxe_timer_wheel.h"
+
+#define PXE_TIMER_WHEEL_MASK (PXE_TIMER_WHEEL_SLOTS - 1)
+// Furthest ahead of now a deadline can be.
+#define PXE_TIMER_WHEEL_RANGE \
+  (((u64)1 << (PXE_TIMER_WHEEL_BITS * PXE_TIMER_WHEEL_LEVELS)) - 1)
+
+static void pxe_timer_list_init(pxe_timer* list) {
+  list->next = list;
+  list->prev = list;
+}
+
+static void pxe_timer_link(pxe_timer* list, pxe_timer* timer) {
+  timer->prev = list->prev;
+  timer->next = list;
+  list->prev->next = timer;
+  list->prev = timer;
+}
+
+// Puts the timer in the slot for its deadline. Deadlines before earliest are
+// treated as earliest, which is the first time the wheel hasn't handled yet.
+static void pxe_timer_wheel_place(pxe_timer_wheel* wheel, pxe_timer* timer,
+                                  u64 earliest) {
+  if (timer->deadline < earliest) {
+    timer->deadline = earliest;
+  }
+
+  if (timer->deadline - wheel->now > PXE_TIMER_WHEEL_RANGE) {
+    timer->deadline = wheel->now + PXE_TIMER_WHEEL_RANGE;
+  }
+
+  u64 delta = timer->deadline - wheel->now;
+  size_t level = 0;
+
+  while (level < PXE_TIMER_WHEEL_LEVELS - 1 &&
+         delta >= (u64)1 << (PXE_TIMER_WHEEL_BITS * (level + 1))) {
+    ++level;
+  }
+
+  size_t slot = (size_t)(timer->deadline >> (PXE_TIMER_WHEEL_BITS * level)) &
+                PXE_TIMER_WHEEL_MASK;
+
+  pxe_timer_link(&wheel->slots[level][slot], timer);
+}
+
+void pxe_timer_wheel_init(pxe_timer_wheel* wheel, u64 now) {
+  wheel->now = now;
+
+  for (size_t level = 0; level < PXE_TIMER_WHEEL_LEVELS; ++level) {
+    for (size_t slot = 0; slot < PXE_TIMER_WHEEL_SLOTS; ++slot) {
+      pxe_timer_list_init(&wheel->slots[level][slot]);
+    }
+  }
+}
+
+void pxe_timer_init(pxe_timer* timer, u32 id) {
+  timer->next = NULL;
+  timer->prev = NULL;
+  timer->deadline = 0;
+  timer->id = id;
+}
+
+void pxe_timer_schedule(pxe_timer_wheel* wheel, pxe_timer* timer,
+                        u64 deadline) {
+  pxe_timer_cancel(timer);
+
+  timer->deadline = deadline;
+  // The slot for now was already handled.
+  pxe_timer_wheel_place(wheel, timer, wheel->now + 1);
+}
+
+void pxe_timer_cancel(pxe_timer* timer) {
+  if (timer->next == NULL) return;
+
+  timer->prev->next = timer->next;
+  timer->next->prev = timer->prev;
+  timer->next = NULL;
+  timer->prev = NULL;
+}
+
+void pxe_timer_wheel_advance(pxe_timer_wheel* wheel, u64 now, pxe_timer* due) {
+  pxe_timer_list_init(due);
+
+  while (wheel->now < now) {
+    u64 time = ++wheel->now;
+    size_t top = 0;
+
+    while (top + 1 < PXE_TIMER_WHEEL_LEVELS &&
+           (time & (((u64)1 << (PXE_TIMER_WHEEL_BITS * (top + 1))) - 1)) == 0) {
+      ++top;
+    }
+
+    // Higher levels go first since their timers can land in the slots of the
+    // lower levels that start now.
+    for (size_t level = top; level > 0; --level) {
+      pxe_timer* list =
+          &wheel->slots[level][(time >> (PXE_TIMER_WHEEL_BITS * level)) &
+                               PXE_TIMER_WHEEL_MASK];
+
+      while (list->next != list) {
+        pxe_timer* timer = list->next;
+
+        pxe_timer_cancel(timer);
+        pxe_timer_wheel_place(wheel, timer, time);
+      }
+    }
+
+    pxe_timer* list = &wheel->slots[0][time & PXE_TIMER_WHEEL_MASK];
+
+    while (list->next != list) {
+      pxe_timer* timer = list->next;
+
+      pxe_timer_cancel(timer);
+      pxe_timer_link(due, timer);
+    }
+  }
+}
+
+pxe_timer* pxe_timer_pop(pxe_timer* due) {
+  if (due->next == due) return NULL;
+
+  pxe_timer* timer = due->next;
+
+  pxe_timer_cancel(timer);
+
+  return timer;
+}
@@ -0,0 +1,56 @@
+#ifndef PIXIE_TIMER_WHEEL_H_
+#define PIXIE_TIMER_WHEEL_H_
+
+#include "pixie.h"
+
+// Each level has 1 << PXE_TIMER_WHEEL_BITS slots, and each slot on a level
+// covers as much time as a whole turn of the level below it. Deadlines are in
+// whatever unit the wheel is advanced in, which is milliseconds for the game
+// server, so the four levels reach about 4.6 hours ahead. Later deadlines are
+// moved in to the furthest the wheel can hold.
+#define PXE_TIMER_WHEEL_BITS 6
+#define PXE_TIMER_WHEEL_SLOTS (1 << PXE_TIMER_WHEEL_BITS)
+#define PXE_TIMER_WHEEL_LEVELS 4
+
+// Kept inside whatever the timer is for, so scheduling never allocates. The
+// id is up to the owner and isn't touched by the wheel.
+typedef struct pxe_timer {
+  struct pxe_timer* next;
+  struct pxe_timer* prev;
+  u64 deadline;
+  u32 id;
+} pxe_timer;
+
+// Timers are kept in the slot of their deadline on the lowest level that
+// reaches it. When the wheel passes the start of a higher slot, the timers in
+// it are spread out over the levels below, so each timer is only moved a few
+// times before it's due and advancing only touches the timers that are.
+typedef struct pxe_timer_wheel {
+  // Everything due up to and including now has been returned.
+  u64 now;
+  // Each slot is the head of a circular list of its timers.
+  pxe_timer slots[PXE_TIMER_WHEEL_LEVELS][PXE_TIMER_WHEEL_SLOTS];
+} pxe_timer_wheel;
+
+void pxe_timer_wheel_init(pxe_timer_wheel* wheel, u64 now);
+void pxe_timer_init(pxe_timer* timer, u32 id);
+
+static inline bool32 pxe_timer_active(pxe_timer* timer) {
+  return timer->next != NULL;
+}
+
+// Moves the timer to deadline, cancelling it first if it's active. Deadlines
+// that have already passed are returned by the next advance.
+void pxe_timer_schedule(pxe_timer_wheel* wheel, pxe_timer* timer,
+                        u64 deadline);
+// Does nothing if the timer isn't active. Timers that were returned by an
+// advance but not popped yet can be cancelled too.
+void pxe_timer_cancel(pxe_timer* timer);
+
+// Moves every timer due by now onto the due list, which is initialized here.
+// They stay active until they're popped, so they can still be cancelled.
+void pxe_timer_wheel_advance(pxe_timer_wheel* wheel, u64 now, pxe_timer* due);
+// Takes the first timer off a due list. Returns NULL once it's empty.
+pxe_timer* pxe_timer_pop(pxe_timer* due);
+
+#endif
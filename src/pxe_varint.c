@@ -1,45 +1,153 @@
 #include "pxe_varint.h"
 
-size_t pxe_varint_write(i32 signed_value, char* buf) {
-  size_t index = 0;
+#include <string.h>
 
-  u32 value = (u32)signed_value;
+#if PXE_VARINT_FAST && defined(__BMI2__)
+#include <immintrin.h>
+#endif
 
-  do {
-    u8 byte = (u8)(value & 0x7F);
+#ifdef _MSC_VER
+#include <intrin.h>
 
-    value >>= 7;
+static inline size_t pxe_clz64(u64 value) {
+  unsigned long index;
 
-    if (value) {
-      byte |= 0x80;
-    }
+  _BitScanReverse64(&index, value);
 
-    buf[index++] = byte;
-  } while (value);
+  return 63 - index;
+}
+
+static inline size_t pxe_ctz64(u64 value) {
+  unsigned long index;
+
+  _BitScanForward64(&index, value);
 
   return index;
 }
+#else
+#define pxe_clz64(value) ((size_t)__builtin_clzll(value))
+#define pxe_ctz64(value) ((size_t)__builtin_ctzll(value))
+#endif
 
-size_t pxe_varint_size(i32 signed_value) {
+// The continuation bits of the first eight bytes.
+#define PXE_VARINT_CONTINUATION 0x8080808080808080ULL
+
+// Every byte holds 7 bits of the value, so the size is the number of
+// significant bits divided by 7 and rounded up.
+static inline size_t pxe_varint_bits_size(u64 value) {
+  size_t bits = 64 - pxe_clz64(value | 1);
+
+  return (bits + 6) / 7;
+}
+
+#if PXE_VARINT_FAST
+// Packs the low 7 bits of the first eight bytes of word together.
+static inline u64 pxe_varint_compact(u64 word) {
+#ifdef __BMI2__
+  return _pext_u64(word, ~PXE_VARINT_CONTINUATION);
+#else
+  word &= ~PXE_VARINT_CONTINUATION;
+  // Close the gaps in pairs of bytes, then pairs of those, then the halves.
+  word = (word & 0x007F007F007F007FULL) | ((word & 0x7F007F007F007F00ULL) >> 1);
+  word = (word & 0x00003FFF00003FFFULL) | ((word & 0x3FFF00003FFF0000ULL) >> 2);
+  word = (word & 0x000000000FFFFFFFULL) | ((word & 0x0FFFFFFF00000000ULL) >> 4);
+
+  return word;
+#endif
+}
+
+// Spreads the low 56 bits of value over eight bytes of 7 bits each.
+static inline u64 pxe_varint_spread(u64 value) {
+#ifdef __BMI2__
+  return _pdep_u64(value, ~PXE_VARINT_CONTINUATION);
+#else
+  value = (value & 0x000000000FFFFFFFULL) |
+          ((value & 0x00FFFFFFF0000000ULL) << 4);
+  value = (value & 0x00003FFF00003FFFULL) |
+          ((value & 0x0FFFC0000FFFC000ULL) << 2);
+  value = (value & 0x007F007F007F007FULL) |
+          ((value & 0x3F803F803F803F80ULL) << 1);
+
+  return value;
+#endif
+}
+
+// Decodes a VarInt of at most max_size bytes from the first eight bytes of
+// buf without looking at them one at a time. Returns 0 if it doesn't end in
+// time.
+static inline size_t pxe_varint_read_word(const char* buf, size_t max_size,
+                                          u64* value) {
+  u64 word;
+
+  memcpy(&word, buf, sizeof(word));
+
+  u64 ends = ~word & PXE_VARINT_CONTINUATION &
+             (PXE_VARINT_CONTINUATION >> (64 - max_size * 8));
+
+  if (ends == 0) return 0;
+
+  // Keeps every byte up to and including the first without a continuation
+  // bit.
+  word &= ends ^ (ends - 1);
+  *value = pxe_varint_compact(word);
+
+  return (pxe_ctz64(ends) + 1) / 8;
+}
+
+// Encodes a value below 2^56 with one store of size bytes.
+static inline void pxe_varint_write_word(u64 value, size_t size, char* buf) {
+  u64 word = pxe_varint_spread(value) |
+             (PXE_VARINT_CONTINUATION & ((1ULL << (size * 8 - 8)) - 1));
+
+  // Two stores that overlap in the middle cover every size without a loop.
+  if (size >= 4) {
+    u32 head = (u32)word;
+    u32 tail = (u32)(word >> (size * 8 - 32));
+
+    memcpy(buf, &head, sizeof(head));
+    memcpy(buf + size - sizeof(tail), &tail, sizeof(tail));
+  } else if (size >= 2) {
+    u16 head = (u16)word;
+    u16 tail = (u16)(word >> (size * 8 - 16));
+
+    memcpy(buf, &head, sizeof(head));
+    memcpy(buf + size - sizeof(tail), &tail, sizeof(tail));
+  } else {
+    buf[0] = (char)word;
+  }
+}
+#endif
+
+size_t pxe_varint_write_scalar(i32 signed_value, char* buf) {
   size_t index = 0;
 
   u32 value = (u32)signed_value;
 
   do {
+    u8 byte = (u8)(value & 0x7F);
+
     value >>= 7;
 
-    ++index;
+    if (value) {
+      byte |= 0x80;
+    }
+
+    buf[index++] = byte;
   } while (value);
 
   return index;
 }
 
-size_t pxe_varint_read(char* buf, size_t buf_size, i32* value) {
+size_t pxe_varint_read_scalar(char* buf, size_t buf_size, i32* value) {
   int shift = 0;
   size_t i = 0;
 
   *value = 0;
 
+  if (buf_size > 5) {
+    buf_size = 5;
+  }
+
   do {
     if (i >= buf_size) {
       // The buffer doesn't have enough data to fully read this VarInt.
@@ -47,14 +155,14 @@ size_t pxe_varint_read(char* buf, size_t buf_size, i32* value) {
       return 0;
     }
 
-    *value |= (i32)(buf[i] & 0x7F) << shift;
+    *value |= (i32)((u32)(buf[i] & 0x7F) << shift);
     shift += 7;
   } while ((buf[i++] & 0x80) != 0);
 
   return i;
 }
 
-size_t pxe_varlong_write(i64 signed_value, char* buf) {
+size_t pxe_varlong_write_scalar(i64 signed_value, char* buf) {
   size_t index = 0;
 
   u64 value = (u64)signed_value;
@@ -74,26 +182,16 @@ size_t pxe_varlong_write(i64 signed_value, char* buf) {
   return index;
 }
 
-size_t pxe_varlong_size(i64 signed_value) {
-  size_t index = 0;
-
-  u64 value = (u64)signed_value;
-
-  do {
-    value >>= 7;
-
-    ++index;
-  } while (value);
-
-  return index;
-}
-
-size_t pxe_varlong_read(char* buf, size_t buf_size, i64* value) {
+size_t pxe_varlong_read_scalar(char* buf, size_t buf_size, i64* value) {
   int shift = 0;
   size_t i = 0;
 
   *value = 0;
 
+  if (buf_size > 10) {
+    buf_size = 10;
+  }
+
   do {
     if (i >= buf_size) {
       // The buffer doesn't have enough data to fully read this VarLong.
@@ -101,9 +199,90 @@ size_t pxe_varlong_read(char* buf, size_t buf_size, i64* value) {
       return 0;
     }
 
-    *value |= (i64)(buf[i] & 0x7F) << shift;
+    *value |= (i64)((u64)(buf[i] & 0x7F) << shift);
     shift += 7;
   } while ((buf[i++] & 0x80) != 0);
 
   return i;
 }
+
+size_t pxe_varint_write(i32 signed_value, char* buf) {
+#if PXE_VARINT_FAST
+  u32 value = (u32)signed_value;
+
+  if (value < 0x80) {
+    buf[0] = (char)value;
+    return 1;
+  }
+
+  size_t size = pxe_varint_bits_size(value);
+
+  pxe_varint_write_word(value, size, buf);
+
+  return size;
+#else
+  return pxe_varint_write_scalar(signed_value, buf);
+#endif
+}
+
+size_t pxe_varint_size(i32 signed_value) {
+  return pxe_varint_bits_size((u32)signed_value);
+}
+
+size_t pxe_varint_read(char* buf, size_t buf_size, i32* value) {
+#if PXE_VARINT_FAST
+  // Packet ids and most lengths are a single byte.
+  if (buf_size > 0 && (buf[0] & 0x80) == 0) {
+    *value = buf[0];
+    return 1;
+  }
+
+  if (buf_size >= sizeof(u64)) {
+    u64 result;
+    size_t size = pxe_varint_read_word(buf, 5, &result);
+
+    // Too long to be a VarInt, which the scalar path reads as 0 too.
+    *value = size > 0 ? (i32)(u32)result : 0;
+
+    return size;
+  }
+#endif
+
+  return pxe_varint_read_scalar(buf, buf_size, value);
+}
+
+size_t pxe_varlong_write(i64 signed_value, char* buf) {
+  u64 value = (u64)signed_value;
+
+#if PXE_VARINT_FAST
+  size_t size = pxe_varint_bits_size(value);
+
+  if (size <= sizeof(u64)) {
+    pxe_varint_write_word(value, size, buf);
+    return size;
+  }
+#endif
+
+  return pxe_varlong_write_scalar(signed_value, buf);
+}
+
+size_t pxe_varlong_size(i64 signed_value) {
+  return pxe_varint_bits_size((u64)signed_value);
+}
+
+size_t pxe_varlong_read(char* buf, size_t buf_size, i64* value) {
+#if PXE_VARINT_FAST
+  if (buf_size >= sizeof(u64)) {
+    u64 result;
+    size_t size = pxe_varint_read_word(buf, sizeof(u64), &result);
+
+    // Only the longest values don't end in the first eight bytes.
+    if (size > 0) {
+      *value = (i64)result;
+      return size;
+    }
+  }
+#endif
+
+  return pxe_varlong_read_scalar(buf, buf_size, value);
+}
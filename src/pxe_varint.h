@@ -3,16 +3,38 @@
 
 #include "pixie.h"
 
+// Reads and writes values up to eight bytes long with a single load or store
+// and bit operations instead of a loop over the bytes. It's used with BMI2
+// when the compiler targets it. This needs a little-endian machine, and the
+// byte at a time versions are used otherwise.
+#ifndef PXE_VARINT_FAST
+#if defined(_MSC_VER) || (defined(__BYTE_ORDER__) && \
+                          __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#define PXE_VARINT_FAST 1
+#else
+#define PXE_VARINT_FAST 0
+#endif
+#endif
+
 // buf must be at least 5 bytes for int
 size_t pxe_varint_write(i32 value, char* buf);
 size_t pxe_varint_size(i32 value);
-// Returns the number of bytes that were read from buf.
+// Returns the number of bytes that were read from buf. VarInts longer than 5
+// bytes aren't read.
 size_t pxe_varint_read(char* buf, size_t buf_size, i32* value);
 
 // buf must be at least 10 bytes for long
 size_t pxe_varlong_write(i64 value, char* buf);
 size_t pxe_varlong_size(i64 value);
-// Returns the number of bytes that were read from buf.
+// Returns the number of bytes that were read from buf. VarLongs longer than 10
+// bytes aren't read.
 size_t pxe_varlong_read(char* buf, size_t buf_size, i64* value);
 
+// The byte at a time versions, which the others fall back to when the buffer
+// is too short for a whole load.
+size_t pxe_varint_write_scalar(i32 value, char* buf);
+size_t pxe_varint_read_scalar(char* buf, size_t buf_size, i32* value);
+size_t pxe_varlong_write_scalar(i64 value, char* buf);
+size_t pxe_varlong_read_scalar(char* buf, size_t buf_size, i64* value);
+
 #endif
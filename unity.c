@@ -1,9 +1,17 @@
 #include "src/pxe_alloc.c"
 #include "src/pxe_buffer.c"
+#include "src/pxe_compress.c"
+#include "src/pxe_frame.c"
 #include "src/pxe_game_server.c"
+#include "src/pxe_handoff.c"
+#include "src/pxe_io_uring.c"
 #include "src/pxe_nbt.c"
+#include "src/pxe_reactor.c"
+#include "src/pxe_ring.c"
 #include "src/pxe_session.c"
+#include "src/pxe_session_index.c"
 #include "src/pxe_socket.c"
+#include "src/pxe_timer_wheel.c"
 #include "src/pxe_uuid.c"
 #include "src/pxe_varint.c"
 #include "src/protocol/pxe_protocol_play.c"